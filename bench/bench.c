@@ -0,0 +1,559 @@
+/** @file End-to-end throughput benchmark of `gamma_compute` over reproducible
+ *      synthetic dose phantoms. Results are written to stdout as JSON, where
+ *      throughput counts active (above threshold) voxels, and each time is the
+ *      fastest of the repeated runs of its case
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include <time.h>
+#include "gamma.h"
+#include "pool.h"
+
+
+#define BENCH_PI 3.14159265358979323846
+
+
+/** @brief Synthetic dose fields, as functions of physical coordinates */
+enum bench_phantom {
+    BENCH_GAUSSIAN,     /* A smooth Gaussian */
+    BENCH_IMRT,         /* Modulated leaf strips with steep penumbrae */
+    BENCH_PHANTOMS
+};
+
+
+/** @brief Relations of the measured grid to the reference grid */
+enum bench_grid {
+    BENCH_COINCIDENT,   /* The same lattice */
+    BENCH_SHIFTED,      /* Coarser spacing and a fractional voxel offset */
+    BENCH_ROTATED,      /* Rotated a few degrees about the third axis */
+    BENCH_GRIDS
+};
+
+
+static const char *const bench_phantom_names[] = { "gaussian", "imrt" };
+static const char *const bench_grid_names[] = {
+    "coincident", "shifted", "rotated"
+};
+static const char *const bench_norm_names[] = { "GLOBAL", "LOCAL", "ABSOLUTE" };
+static const char *const bench_storage_names[] = { "f64", "f32", "u16", "u32" };
+static const char *const bench_search_names[] = {
+    "PATTERN", "EXHAUSTIVE", "CELLS", "BRANCH"
+};
+
+
+/** @brief Benchmark settings */
+struct bench_config {
+    int             sizes[8];       /* Reference grid sizes along each axis */
+    int             nsizes;         /* Grid size count */
+    int             threads[16];    /* Thread counts of the scaling run */
+    int             nthreads;       /* Thread count count */
+    int             repeat;         /* Runs of each case, of which the fastest
+                                       counts */
+    bool            first;          /* A case has already been written */
+    gamma_storage_t storage;        /* Storage type of both distributions */
+    gamma_search_t  search;         /* Search engine */
+};
+
+
+/** @brief A generated reference/measured pair */
+struct bench_pair {
+    struct gamma_distribution ref;
+    struct gamma_distribution meas;
+};
+
+
+/** @brief Grid spacing of the reference dose in mm */
+#define BENCH_SPACING 2.0
+
+
+/** @brief Read a wall clock
+ *  @returns Seconds since some fixed point in time
+ */
+static double bench_clock(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+
+/** @brief Evaluate a phantom
+ *  @param phantom
+ *      Phantom
+ *  @param extent
+ *      Edge length of the phantom's cube in mm
+ *  @param pos
+ *      Physical coordinates in mm
+ *  @returns The dose at @p pos in Gy
+ */
+static double bench_dose(enum bench_phantom phantom,
+                         double             extent,
+                         const gamma_vec_t *pos)
+{
+    const double c = extent / 2.0;
+    const double x = pos->vec[0] - c, y = pos->vec[1] - c, z = pos->vec[2];
+    const double sigma = extent / 6.0, half = extent / 4.0, pen = 1.5;
+    double edge, leaf;
+
+    switch (phantom) {
+    case BENCH_GAUSSIAN:
+    default:
+        return 2.0 * exp(-(x * x + y * y + gamma_sqr(z - c))
+                         / (2.0 * sigma * sigma));
+    case BENCH_IMRT:
+        /* A rectangular field with sigmoid penumbrae, modulated in 5 mm leaf
+           strips and attenuated with depth */
+        edge = 1.0 / (1.0 + exp((fabs(x) - half) / pen));
+        edge *= 1.0 / (1.0 + exp((fabs(y) - half) / pen));
+        leaf = 0.6 + 0.4 * fabs(sin(BENCH_PI * floor(y / 5.0) / 3.7));
+        return 2.0 * edge * leaf * exp(-0.005 * z) + 0.02;
+    }
+}
+
+
+/** @brief Fill a distribution by sampling a phantom on a lattice
+ *  @param dist
+ *      Distribution to initialize
+ *  @param matr
+ *      Affine matrix
+ *  @param n
+ *      Grid size along each axis
+ *  @param phantom
+ *      Phantom
+ *  @param extent
+ *      Edge length of the phantom's cube in mm
+ *  @param shift
+ *      Physical displacement applied to the phantom, i.e. a delivery error
+ *  @param scale
+ *      Dose scaling applied to the phantom
+ *  @returns true on success, false on allocation failure
+ */
+static bool bench_sample(struct gamma_distribution *dist,
+                         const gamma_mat_t         *matr,
+                         int                        n,
+                         enum bench_phantom         phantom,
+                         double                     extent,
+                         const gamma_vec_t         *shift,
+                         double                     scale)
+{
+    const gamma_idx_t dims = {{ n, n, n, 0 }};
+    gamma_vec_t pos;
+    double *data;
+    int i, j, k;
+
+    data = malloc(sizeof *data * n * n * n);
+    if (!data) {
+        return false;
+    }
+    for (k = 0; k < n; k++) {
+        for (j = 0; j < n; j++) {
+            for (i = 0; i < n; i++) {
+                pos = (const gamma_vec_t){{ i, j, k, 1 }};
+                pos = gamma_matmul_mv(matr, &pos);
+                pos = gamma_vec_sub(&pos, shift);
+                data[i + n * (j + (size_t)n * k)]
+                    = scale * bench_dose(phantom, extent, &pos);
+            }
+        }
+    }
+    if (!gamma_distribution_set(dist, matr, &dims, data)) {
+        free(data);
+        return false;
+    }
+    return true;
+}
+
+
+/** @brief Move a distribution into another storage type, as a compact dose
+ *      grid would hold it. Integer storage maps the maximum dose to the top of
+ *      its range, as the dose grid scaling of DICOM RT Dose does
+ *  @param dist
+ *      Distribution of doubles
+ *  @param storage
+ *      Storage type
+ *  @returns true on success, false on allocation failure
+ */
+static bool bench_store(struct gamma_distribution *dist, gamma_storage_t storage)
+{
+    static const size_t sizes[] = { 8, 4, 2, 4 };
+    static const double tops[] = { 1.0, 1.0, 65535.0, 4294967295.0 };
+    const double *src = dist->data;
+    double scale;
+    void *data;
+    size_t i;
+
+    if (storage == GAMMA_STORAGE_F64) {
+        return true;
+    }
+    data = malloc(sizes[storage] * dist->len + 1);
+    if (!data) {
+        return false;
+    }
+    scale = dist->max > 0.0 ? dist->max / tops[storage] : 1.0;
+    for (i = 0; i < dist->len; i++) {
+        switch (storage) {
+        case GAMMA_STORAGE_F32:
+        default:
+            ((float *)data)[i] = (float)src[i];
+            break;
+        case GAMMA_STORAGE_U16:
+            ((uint16_t *)data)[i] = (uint16_t)llround(fmax(src[i], 0.0) / scale);
+            break;
+        case GAMMA_STORAGE_U32:
+            ((uint32_t *)data)[i] = (uint32_t)llround(fmax(src[i], 0.0) / scale);
+            break;
+        }
+    }
+    free(dist->data);
+    return gamma_distribution_set_storage(dist, &dist->matrix, &dist->dims,
+                                          storage, scale, NULL, data);
+}
+
+
+/** @brief Release a pair */
+static void bench_pair_destroy(struct bench_pair *pair)
+{
+    free(pair->ref.data);
+    free(pair->meas.data);
+}
+
+
+/** @brief Generate a reference/measured pair
+ *  @param[out] pair
+ *      Pair to initialize
+ *  @param phantom
+ *      Phantom
+ *  @param grid
+ *      Relation of the measured grid to the reference grid
+ *  @param n
+ *      Reference grid size along each axis
+ *  @param storage
+ *      Storage type of both distributions
+ *  @returns true on success, false on allocation failure
+ */
+static bool bench_pair_init(struct bench_pair  *pair,
+                            enum bench_phantom  phantom,
+                            enum bench_grid     grid,
+                            int                 n,
+                            gamma_storage_t     storage)
+{
+    const double extent = BENCH_SPACING * n, angle = 4.0 * BENCH_PI / 180.0;
+    const gamma_vec_t none = { 0 }, shift = {{ 0.7, -0.4, 0.3, 0 }};
+    gamma_mat_t rmat = gamma_mat_identity, mmat;
+    int m = n, axis;
+
+    for (axis = 0; axis < 3; axis++) {
+        rmat.cols[axis].vec[axis] = BENCH_SPACING;
+    }
+    mmat = rmat;
+    switch (grid) {
+    case BENCH_COINCIDENT:
+    default:
+        break;
+    case BENCH_SHIFTED:
+        m = (int)(n * BENCH_SPACING / 2.5);
+        for (axis = 0; axis < 3; axis++) {
+            mmat.cols[axis].vec[axis] = 2.5;
+            mmat.cols[3].vec[axis] = 0.9;
+        }
+        break;
+    case BENCH_ROTATED:
+        mmat.cols[0] = (const gamma_vec_t){{
+            BENCH_SPACING * cos(angle), BENCH_SPACING * sin(angle), 0, 0
+        }};
+        mmat.cols[1] = (const gamma_vec_t){{
+            -BENCH_SPACING * sin(angle), BENCH_SPACING * cos(angle), 0, 0
+        }};
+        mmat.cols[3] = (const gamma_vec_t){{ 0.05 * extent, -0.02 * extent,
+                                             0, 1 }};
+        break;
+    }
+    if (!bench_sample(&pair->ref, &rmat, n, phantom, extent, &none, 1.0)) {
+        return false;
+    }
+    if (!bench_sample(&pair->meas, &mmat, m, phantom, extent, &shift, 1.02)) {
+        free(pair->ref.data);
+        return false;
+    }
+    if (!bench_store(&pair->ref, storage) || !bench_store(&pair->meas, storage)) {
+        bench_pair_destroy(pair);
+        return false;
+    }
+    return true;
+}
+
+
+/** @brief Run one benchmark case and write it out
+ *  @param cfg
+ *      Benchmark settings
+ *  @param pair
+ *      Dose pair
+ *  @param phantom
+ *      Phantom of @p pair
+ *  @param grid
+ *      Grid relation of @p pair
+ *  @param n
+ *      Reference grid size of @p pair
+ *  @param params
+ *      Gamma parameters
+ *  @param opts
+ *      Gamma options
+ *  @returns true on success, false if `gamma_compute` failed
+ */
+static bool bench_case(struct bench_config        *cfg,
+                       const struct bench_pair    *pair,
+                       enum bench_phantom          phantom,
+                       enum bench_grid             grid,
+                       int                         n,
+                       const struct gamma_params  *params,
+                       const struct gamma_options *opts)
+{
+    struct gamma_results res = { .dist = NULL };
+    double best = HUGE_VAL, start, elapsed;
+    int r;
+
+    for (r = 0; r < cfg->repeat; r++) {
+        start = bench_clock();
+        if (!gamma_compute(params, opts, &pair->ref, &pair->meas, &res)) {
+            return false;
+        }
+        elapsed = bench_clock() - start;
+        best = fmin(best, elapsed);
+    }
+    printf("%s\n    {\"phantom\": \"%s\", \"grid\": \"%s\", \"size\": %d, "
+           "\"voxels\": %zu, \"norm\": \"%s\", \"search\": \"%s\", "
+           "\"shrinks\": %ld, \"warm_start\": %s, \"threads\": %d, "
+           "\"active\": %ld, \"pass_rate\": %.6f, \"mean\": %.6f, "
+           "\"seconds\": %.6f, \"voxels_per_second\": %.1f, ",
+           cfg->first ? "," : "",
+           bench_phantom_names[phantom], bench_grid_names[grid], n,
+           pair->meas.len, bench_norm_names[params->norm],
+           bench_search_names[opts->search],
+           opts->shrinks, opts->warm ? "true" : "false",
+           gamma_pool_threads(opts->threads), res.stats.total,
+           res.stats.total ? (double)res.pass / res.stats.total : 0.0,
+           res.stats.mean, best, res.stats.total / best);
+#if defined(GAMMA_COUNTERS)
+    printf("\"evals_per_voxel\": %.2f}",
+           res.stats.total ? (double)res.counters.evals / res.stats.total : 0.0);
+#else
+    printf("\"evals_per_voxel\": null}");
+#endif
+    fflush(stdout);
+    cfg->first = true;
+    return true;
+}
+
+
+/** @brief Parse a comma-separated list of positive integers
+ *  @param str
+ *      String
+ *  @param[out] list
+ *      Receives the integers
+ *  @param cap
+ *      Capacity of @p list
+ *  @returns The integer count, or zero if @p str is malformed
+ */
+static int bench_parse_list(const char *str, int *list, int cap)
+{
+    char *end;
+    long val;
+    int len = 0;
+
+    do {
+        val = strtol(str, &end, 10);
+        if (end == str || val <= 0 || val > 4096 || len == cap) {
+            return 0;
+        }
+        list[len++] = (int)val;
+        str = end + (*end == ',');
+    } while (*end == ',');
+    return *end ? 0 : len;
+}
+
+
+/** @brief Print usage */
+static void bench_usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--quick] [--repeat N] [--sizes N,...] "
+            "[--threads N,...] [--storage TYPE] [--search ENGINE]\n"
+            "  --quick      one small size and a single run per case\n"
+            "  --repeat N   runs per case, of which the fastest counts "
+            "(default 3)\n"
+            "  --sizes      reference grid sizes (default 48,96)\n"
+            "  --threads    thread counts of the scaling run (default 1, 2, 4, "
+            "... up to the processor count)\n"
+            "  --storage    dose storage type, one of f64, f32, u16 or u32 "
+            "(default f64)\n"
+            "  --search     search engine, one of PATTERN, EXHAUSTIVE, CELLS or "
+            "BRANCH (default PATTERN)\n",
+            argv0);
+}
+
+
+/** @brief Parse the command line
+ *  @param cfg
+ *      Settings to fill in
+ *  @param argc
+ *      Argument count
+ *  @param argv
+ *      Arguments
+ *  @returns true on success, false on a malformed command line
+ */
+static bool bench_parse(struct bench_config *cfg, int argc, char **argv)
+{
+    const int procs = gamma_pool_threads(0);
+    size_t k;
+    int i, t;
+
+    cfg->sizes[0] = 48;
+    cfg->sizes[1] = 96;
+    cfg->nsizes = 2;
+    cfg->repeat = 3;
+    cfg->nthreads = 0;
+    for (t = 1; t < procs && cfg->nthreads < 15; t *= 2) {
+        cfg->threads[cfg->nthreads++] = t;
+    }
+    cfg->threads[cfg->nthreads++] = procs;
+    cfg->first = false;
+    cfg->storage = GAMMA_STORAGE_F64;
+    cfg->search = GAMMA_SEARCH_PATTERN;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            cfg->sizes[0] = 32;
+            cfg->nsizes = 1;
+            cfg->repeat = 1;
+        } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            cfg->repeat = atoi(argv[++i]);
+            if (cfg->repeat < 1) {
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            cfg->nsizes = bench_parse_list(argv[++i], cfg->sizes,
+                                           (int)BUFLEN(cfg->sizes));
+            if (!cfg->nsizes) {
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            cfg->nthreads = bench_parse_list(argv[++i], cfg->threads,
+                                             (int)BUFLEN(cfg->threads));
+            if (!cfg->nthreads) {
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--storage") && i + 1 < argc) {
+            i++;
+            for (k = 0; k < BUFLEN(bench_storage_names); k++) {
+                if (!strcmp(argv[i], bench_storage_names[k])) {
+                    break;
+                }
+            }
+            if (k == BUFLEN(bench_storage_names)) {
+                return false;
+            }
+            cfg->storage = (gamma_storage_t)k;
+        } else if (!strcmp(argv[i], "--search") && i + 1 < argc) {
+            i++;
+            for (k = 0; k < BUFLEN(bench_search_names); k++) {
+                if (!strcmp(argv[i], bench_search_names[k])) {
+                    break;
+                }
+            }
+            if (k == BUFLEN(bench_search_names)) {
+                return false;
+            }
+            cfg->search = (gamma_search_t)k;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char **argv)
+{
+    static const long shrinks[] = { 4, 8 };
+    struct gamma_params params = {
+        .diff   = 0.03,
+        .dta    = 2.0,
+        .thrsh  = 0.10,
+        .norm   = GAMMA_NORM_GLOBAL,
+    };
+    struct gamma_options opts = {
+        .shrinks    = 6,
+        .search     = GAMMA_SEARCH_PATTERN,
+        .subdiv     = 4,
+        .radius     = 2.0,
+        .threads    = 1,
+    };
+    struct bench_config cfg;
+    struct bench_pair pair;
+    int phantom, grid, size, norm, i;
+    bool ok = true;
+
+    if (!bench_parse(&cfg, argc, argv)) {
+        bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    opts.search = cfg.search;
+
+    printf("{\n  \"benchmark\": \"gamma_bench\",\n  \"repeat\": %d,\n"
+           "  \"storage\": \"%s\",\n  \"cases\": [",
+           cfg.repeat, bench_storage_names[cfg.storage]);
+    for (phantom = 0; ok && phantom < BENCH_PHANTOMS; phantom++) {
+        for (grid = 0; ok && grid < BENCH_GRIDS; grid++) {
+            for (size = 0; ok && size < cfg.nsizes; size++) {
+                if (!bench_pair_init(&pair, phantom, grid, cfg.sizes[size],
+                                     cfg.storage)) {
+                    ok = false;
+                    break;
+                }
+                /* Every normalization at the default shrinks, then the
+                   other shrink counts under global normalization */
+                for (norm = 0; ok && norm <= GAMMA_NORM_ABSOLUTE; norm++) {
+                    params.norm = norm;
+                    ok = bench_case(&cfg, &pair, phantom, grid,
+                                    cfg.sizes[size], &params, &opts);
+                }
+                params.norm = GAMMA_NORM_GLOBAL;
+                for (i = 0; ok && i < (int)BUFLEN(shrinks); i++) {
+                    opts.shrinks = shrinks[i];
+                    ok = bench_case(&cfg, &pair, phantom, grid,
+                                    cfg.sizes[size], &params, &opts);
+                }
+                opts.shrinks = 6;
+                bench_pair_destroy(&pair);
+            }
+        }
+    }
+
+    /* Thread scaling on the hardest phantom at the largest size */
+    printf("\n  ],\n  \"scaling\": [");
+    cfg.first = false;
+    size = cfg.nsizes - 1;
+    if (ok && bench_pair_init(&pair, BENCH_IMRT, BENCH_ROTATED,
+                              cfg.sizes[size], cfg.storage)) {
+        for (i = 0; ok && i < cfg.nthreads; i++) {
+            opts.threads = cfg.threads[i];
+            ok = bench_case(&cfg, &pair, BENCH_IMRT, BENCH_ROTATED,
+                            cfg.sizes[size], &params, &opts);
+        }
+        bench_pair_destroy(&pair);
+    } else {
+        ok = false;
+    }
+    printf("\n  ]\n}\n");
+
+    if (!ok) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/** @file The variant kernels of gamma_micro. This file is compiled once for
+ *      each variant, selected by the macro `MICRO_VARIANT`, which is one of
+ *      `scalar`, `auto` or `simd`. The first two differ only by the flags that
+ *      they are built with
+ */
+
+#include "micro.h"
+
+#if !defined(MICRO_VARIANT)
+#   error "MICRO_VARIANT must name the variant being built"
+#endif
+
+#define MICRO_CAT_(a, b) a ##b
+#define MICRO_CAT(a, b) MICRO_CAT_(a, b)
+#define MICRO_STR_(a) #a
+#define MICRO_STR(a) MICRO_STR_(a)
+
+#define MICRO_TABLE MICRO_CAT(micro_kernels_, MICRO_VARIANT)
+
+#if defined(MICRO_SIMD)
+#   if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#       include <immintrin.h>
+#       define MICRO_AVX2 1
+#   endif
+#endif
+
+
+#if !defined(MICRO_SIMD)
+
+static void micro_interp_single(struct micro_data *data)
+{
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->out[i] = gamma_interp_single(&data->cells[i], &data->offs[i]);
+    }
+}
+
+
+static void micro_interp_prepare(struct micro_data *data)
+{
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->prep[i] = data->cells[i];
+        gamma_interp_prepare(&data->prep[i]);
+    }
+}
+
+
+static void micro_interp_eval(struct micro_data *data)
+{
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->out[i] = gamma_interp_eval(&data->prep[i], &data->offs[i]);
+    }
+}
+
+
+static void micro_matmul_mv(struct micro_data *data)
+{
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->vout[i] = gamma_matmul_mv(&data->mat, &data->vecs[i]);
+    }
+}
+
+#elif defined(MICRO_AVX2)
+
+/** @brief Interpolate a cell whose corners are split into the lower and upper
+ *      planes, lerping along each axis from the last
+ */
+static void micro_interp_single(struct micro_data *data)
+{
+    __m256d lo, hi, z;
+    __m128d a, b, y, r;
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        lo = _mm256_load_pd(&data->cells[i].buf[0]);
+        hi = _mm256_load_pd(&data->cells[i].buf[4]);
+        z = _mm256_broadcast_sd(&data->offs[i].vec[2]);
+        lo = _mm256_fmadd_pd(_mm256_sub_pd(hi, lo), z, lo);
+        a = _mm256_castpd256_pd128(lo);
+        b = _mm256_extractf128_pd(lo, 1);
+        y = _mm_set1_pd(data->offs[i].vec[1]);
+        r = _mm_fmadd_pd(_mm_sub_pd(b, a), y, a);
+        data->out[i] = _mm_cvtsd_f64(r) + data->offs[i].vec[0]
+                     * (_mm_cvtsd_f64(_mm_unpackhi_pd(r, r)) - _mm_cvtsd_f64(r));
+    }
+}
+
+
+/** @brief Difference the planes, then the rows, then the columns, exactly as
+ *      `gamma_interp_prepare` does
+ */
+static void micro_interp_prepare(struct micro_data *data)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    __m256d lo, hi;
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        lo = _mm256_load_pd(&data->cells[i].buf[0]);
+        hi = _mm256_load_pd(&data->cells[i].buf[4]);
+        hi = _mm256_sub_pd(hi, lo);
+        lo = _mm256_sub_pd(lo, _mm256_permute2f128_pd(lo, lo, 0x08));
+        hi = _mm256_sub_pd(hi, _mm256_permute2f128_pd(hi, hi, 0x08));
+        lo = _mm256_sub_pd(lo, _mm256_blend_pd(_mm256_permute_pd(lo, 0x0),
+                                               zero, 0x5));
+        hi = _mm256_sub_pd(hi, _mm256_blend_pd(_mm256_permute_pd(hi, 0x0),
+                                               zero, 0x5));
+        _mm256_store_pd(&data->prep[i].buf[0], lo);
+        _mm256_store_pd(&data->prep[i].buf[4], hi);
+    }
+}
+
+
+static void micro_interp_eval(struct micro_data *data)
+{
+    __m256d lo, hi, z;
+    __m128d r;
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        lo = _mm256_load_pd(&data->prep[i].buf[0]);
+        hi = _mm256_load_pd(&data->prep[i].buf[4]);
+        z = _mm256_broadcast_sd(&data->offs[i].vec[2]);
+        lo = _mm256_fmadd_pd(hi, z, lo);
+        r = _mm_fmadd_pd(_mm256_extractf128_pd(lo, 1),
+                         _mm_set1_pd(data->offs[i].vec[1]),
+                         _mm256_castpd256_pd128(lo));
+        data->out[i] = _mm_cvtsd_f64(r) + data->offs[i].vec[0]
+                     * _mm_cvtsd_f64(_mm_unpackhi_pd(r, r));
+    }
+}
+
+
+static void micro_matmul_mv(struct micro_data *data)
+{
+    const __m256d c0 = _mm256_load_pd(data->mat.cols[0].vec);
+    const __m256d c1 = _mm256_load_pd(data->mat.cols[1].vec);
+    const __m256d c2 = _mm256_load_pd(data->mat.cols[2].vec);
+    const __m256d c3 = _mm256_load_pd(data->mat.cols[3].vec);
+    const double *v;
+    __m256d res;
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        v = data->vecs[i].vec;
+        res = _mm256_mul_pd(c0, _mm256_broadcast_sd(&v[0]));
+        res = _mm256_fmadd_pd(c1, _mm256_broadcast_sd(&v[1]), res);
+        res = _mm256_fmadd_pd(c2, _mm256_broadcast_sd(&v[2]), res);
+        res = _mm256_fmadd_pd(c3, _mm256_broadcast_sd(&v[3]), res);
+        _mm256_store_pd(data->vout[i].vec, res);
+    }
+}
+
+#endif
+
+
+#if !defined(MICRO_SIMD) || defined(MICRO_AVX2)
+
+const struct micro_kernels MICRO_TABLE = {
+    .variant        = MICRO_STR(MICRO_VARIANT),
+    .interp_single  = micro_interp_single,
+    .interp_prepare = micro_interp_prepare,
+    .interp_eval    = micro_interp_eval,
+    .matmul_mv      = micro_matmul_mv,
+};
+
+#else
+
+const struct micro_kernels MICRO_TABLE = {
+    .variant        = MICRO_STR(MICRO_VARIANT),
+};
+
+#endif
@@ -0,0 +1,694 @@
+/** @file Microbenchmarks of the hot primitives of the library. Each kernel is
+ *      timed over a batch of inputs and reported per call, in nanoseconds and,
+ *      where the target has a time-stamp counter, in its reference cycles
+ *      (which tick at the nominal clock rate, not the core's). The
+ *      header-inline primitives are built three ways, without vectorization,
+ *      with the compiler's vectorizers and with intrinsics, and are checked
+ *      against each other. The library's own functions are measured as the
+ *      library was built, so time them in an optimized build. Results are
+ *      written to stdout as JSON
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include <time.h>
+#include "distribution.h"
+#include "micro.h"
+#include "psearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>
+#   define MICRO_TSC 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#   include <intrin.h>
+#   define MICRO_TSC 1
+#endif
+
+
+#define MICRO_PI 3.14159265358979323846
+
+/** @brief Edge length of the benchmark distributions in pixels */
+#define MICRO_DIMS 64
+
+/** @brief Matrices cycled through by the inversion kernel */
+#define MICRO_MATS 64
+
+/** @brief Input points per pattern search, which is far costlier than the
+ *      other kernels
+ */
+#define MICRO_SEARCH_DIV 64
+
+
+/** @brief Benchmark settings */
+struct micro_config {
+    size_t len;         /* Inputs per batch */
+    int    repeat;      /* Timed samples of each kernel, of which the fastest
+                           counts */
+    double sample;      /* Least duration of a sample in seconds */
+    bool   first;       /* A kernel has already been written */
+};
+
+
+/** @brief Everything the kernels work on, of which the variant kernels see
+ *      only the first member
+ */
+struct micro_bench {
+    struct micro_data         data;     /* Variant kernel data */
+    struct gamma_distribution rot;      /* Distribution on a rotated grid */
+    struct gamma_distribution ax;       /* Distribution on an axial grid */
+    gamma_vec_t              *pos;      /* Physical coordinates inside both */
+    gamma_scal_t             *soa[3];   /* The same, as a structure of arrays */
+    gamma_vec_t              *inner;    /* Pixel coordinates of interior cells */
+    gamma_vec_t              *edge;     /* Pixel coordinates of boundary cells,
+                                           which have corners out of bounds */
+    gamma_mat_t              *mats;     /* Affine matrices to invert */
+    gamma_mat_t              *inv;      /* Their inverses */
+    gamma_vec_t               bases[3]; /* Pattern search bases */
+    gamma_mat_t               quad;     /* Quadratic form of the objective */
+    long                      evals;    /* Objective evaluations so far */
+};
+
+
+/** @brief A timed kernel */
+struct micro_case {
+    const char *kernel;     /* Kernel name */
+    const char *variant;    /* Variant name */
+    micro_fn_t *func;       /* Kernel */
+    size_t      div;        /* Inputs per call */
+};
+
+
+/** @brief Read a wall clock
+ *  @returns Seconds since some fixed point in time
+ */
+static double micro_clock(void)
+{
+    struct timespec ts;
+
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+
+/** @brief Read the time-stamp counter
+ *  @returns The counter, or zero if the target has none
+ */
+static unsigned long long micro_ticks(void)
+{
+#if defined(MICRO_TSC)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+/** @brief Draw a uniform random number
+ *  @param lo
+ *      Lower bound
+ *  @param hi
+ *      Upper bound
+ *  @returns A number in [lo, hi)
+ */
+static double micro_uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0));
+}
+
+
+/** @brief Recover the bench from the variant kernel data at its start */
+static struct micro_bench *micro_bench_of(struct micro_data *data)
+{
+    return (struct micro_bench *)data;
+}
+
+
+static void micro_distribution_interp(struct micro_data *data)
+{
+    struct micro_bench *bench = micro_bench_of(data);
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->out[i] = gamma_distribution_interp(&bench->rot, &bench->pos[i]);
+    }
+}
+
+
+static void micro_distribution_interp_axial(struct micro_data *data)
+{
+    struct micro_bench *bench = micro_bench_of(data);
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->out[i] = gamma_distribution_interp(&bench->ax, &bench->pos[i]);
+    }
+}
+
+
+static void micro_distribution_interpn(struct micro_data *data)
+{
+    struct micro_bench *bench = micro_bench_of(data);
+
+    gamma_distribution_interpn(&bench->rot, data->len,
+                               (const gamma_scal_t *const *)bench->soa,
+                               data->out);
+}
+
+
+static void micro_distribution_sample_interior(struct micro_data *data)
+{
+    struct micro_bench *bench = micro_bench_of(data);
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->out[i] = gamma_distribution_sample(&bench->ax, &bench->inner[i]);
+    }
+}
+
+
+static void micro_distribution_sample_boundary(struct micro_data *data)
+{
+    struct micro_bench *bench = micro_bench_of(data);
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        data->out[i] = gamma_distribution_sample(&bench->ax, &bench->edge[i]);
+    }
+}
+
+
+static void micro_mat_invert(struct micro_data *data)
+{
+    struct micro_bench *bench = micro_bench_of(data);
+    size_t i;
+
+    for (i = 0; i < data->len; i++) {
+        bench->inv[i % MICRO_MATS] = bench->mats[i % MICRO_MATS];
+        gamma_mat_invert(&bench->inv[i % MICRO_MATS]);
+    }
+}
+
+
+/** @brief A convex quadratic objective, counting its evaluations
+ *  @param pos
+ *      Coordinates
+ *  @param aux
+ *      Unused
+ *  @param data
+ *      The bench
+ *  @returns The quadratic form at @p pos
+ */
+static double micro_objective(const gamma_vec_t *pos, double *aux, void *data)
+{
+    struct micro_bench *bench = data;
+    gamma_vec_t qp;
+
+    (void)aux;
+    bench->evals++;
+    qp = gamma_matmul_mv(&bench->quad, pos);
+    return gamma_vec_dp(pos, &qp);
+}
+
+
+static void micro_pattern_search(struct micro_data *data)
+{
+    struct micro_bench *bench = micro_bench_of(data);
+    const struct gamma_psfunc func = {
+        .func   = micro_objective,
+        .data   = bench,
+        .dims   = 3,
+        .bases  = bench->bases,
+        .accept = -HUGE_VAL,
+    };
+    struct gamma_pspair pair;
+    size_t i;
+
+    for (i = 0; i < data->len; i += MICRO_SEARCH_DIV) {
+        pair.vec = data->offs[i];
+        pair.vec.vec[3] = 0.0;
+        pair.val = micro_objective(&pair.vec, &pair.aux, bench);
+        gamma_pattern_search(&func, &pair, 1.0, 6);
+        data->out[i] = pair.val;
+    }
+}
+
+
+/** @brief Time a kernel
+ *  @param cfg
+ *      Benchmark settings
+ *  @param func
+ *      Kernel
+ *  @param data
+ *      Kernel data
+ *  @param calls
+ *      Calls per run of @p func
+ *  @param[out] ns
+ *      Receives the nanoseconds per call
+ *  @param[out] cycles
+ *      Receives the time-stamp counter ticks per call
+ */
+static void micro_time(const struct micro_config *cfg,
+                       micro_fn_t                *func,
+                       struct micro_data         *data,
+                       size_t                     calls,
+                       double                    *ns,
+                       double                    *cycles)
+{
+    unsigned long long ticks;
+    double start, elapsed;
+    long reps = 1, r;
+    int s;
+
+    /* Warm up, and find how many runs fill a sample */
+    for (;;) {
+        start = micro_clock();
+        for (r = 0; r < reps; r++) {
+            func(data);
+        }
+        elapsed = micro_clock() - start;
+        if (elapsed >= cfg->sample || reps >= 1L << 30) {
+            break;
+        }
+        reps *= 2;
+    }
+
+    *ns = *cycles = HUGE_VAL;
+    for (s = 0; s < cfg->repeat; s++) {
+        ticks = micro_ticks();
+        start = micro_clock();
+        for (r = 0; r < reps; r++) {
+            func(data);
+        }
+        elapsed = micro_clock() - start;
+        ticks = micro_ticks() - ticks;
+        *ns = fmin(*ns, 1e9 * elapsed / ((double)reps * calls));
+        *cycles = fmin(*cycles, (double)ticks / ((double)reps * calls));
+    }
+}
+
+
+/** @brief Time a kernel and write it out
+ *  @param cfg
+ *      Benchmark settings
+ *  @param bench
+ *      Kernel data
+ *  @param kcase
+ *      Kernel
+ *  @param err
+ *      Largest deviation from the scalar variant, or a negative value to omit
+ */
+static void micro_case(struct micro_config     *cfg,
+                       struct micro_bench      *bench,
+                       const struct micro_case *kcase,
+                       double                   err)
+{
+    const size_t calls = (bench->data.len + kcase->div - 1) / kcase->div;
+    double ns, cycles;
+    long evals;
+
+    evals = bench->evals;
+    kcase->func(&bench->data);
+    evals = bench->evals - evals;
+    micro_time(cfg, kcase->func, &bench->data, calls, &ns, &cycles);
+
+    printf("%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", "
+           "\"ns_per_call\": %.3f, ",
+           cfg->first ? "," : "", kcase->kernel, kcase->variant, ns);
+#if defined(MICRO_TSC)
+    printf("\"cycles_per_call\": %.2f", cycles);
+#else
+    printf("\"cycles_per_call\": null");
+#endif
+    if (evals) {
+        printf(", \"evals_per_call\": %.2f", (double)evals / calls);
+    }
+    if (err >= 0.0) {
+        printf(", \"max_abs_diff\": %.3g", err);
+    }
+    printf("}");
+    fflush(stdout);
+    cfg->first = true;
+}
+
+
+/** @brief Find the largest difference between two arrays */
+static double micro_diff(const double *a, const double *b, size_t len)
+{
+    double res = 0.0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        res = fmax(res, fabs(a[i] - b[i]));
+    }
+    return res;
+}
+
+
+/** @brief Run the variant kernels
+ *  @param cfg
+ *      Benchmark settings
+ *  @param bench
+ *      Kernel data
+ *  @param ref
+ *      Scratch of `8 * len` doubles for the scalar results
+ */
+static void micro_variants(struct micro_config *cfg,
+                           struct micro_bench  *bench,
+                           double              *ref)
+{
+    static const struct micro_kernels *const variants[] = {
+        &micro_kernels_scalar, &micro_kernels_auto, &micro_kernels_simd
+    };
+    static const char *const names[] = {
+        "interp_single", "interp_prepare", "interp_eval", "matmul_mv"
+    };
+    struct micro_data *data = &bench->data;
+    const size_t len = data->len;
+    struct micro_case kcase = { .div = 1 };
+    micro_fn_t *funcs[4];
+    double *res[4] = {
+        data->out, data->prep->buf, data->out, data->vout->vec
+    };
+    size_t width[4] = { len, 8 * len, len, 4 * len };
+    double err;
+    int k, v;
+
+    for (k = 0; k < 4; k++) {
+        for (v = 0; v < (int)BUFLEN(variants); v++) {
+            funcs[0] = variants[v]->interp_single;
+            funcs[1] = variants[v]->interp_prepare;
+            funcs[2] = variants[v]->interp_eval;
+            funcs[3] = variants[v]->matmul_mv;
+            if (!funcs[k]) {
+                continue;
+            }
+            /* Evaluation needs prepared cells, which every variant prepares
+               identically */
+            if (k == 2) {
+                micro_kernels_scalar.interp_prepare(data);
+            }
+            funcs[k](data);
+            if (v == 0) {
+                memcpy(ref, res[k], sizeof *ref * width[k]);
+                err = -1.0;
+            } else {
+                err = micro_diff(ref, res[k], width[k]);
+            }
+            kcase.kernel = names[k];
+            kcase.variant = variants[v]->variant;
+            kcase.func = funcs[k];
+            micro_case(cfg, bench, &kcase, err);
+        }
+    }
+}
+
+
+/** @brief Set up a distribution over a smooth field
+ *  @param dist
+ *      Distribution to initialize
+ *  @param matr
+ *      Affine matrix
+ *  @returns true on success, false on allocation failure
+ */
+static bool micro_distribution(struct gamma_distribution *dist,
+                               const gamma_mat_t         *matr)
+{
+    const gamma_idx_t dims = {{ MICRO_DIMS, MICRO_DIMS, MICRO_DIMS, 0 }};
+    const size_t len = (size_t)MICRO_DIMS * MICRO_DIMS * MICRO_DIMS;
+    double *data;
+    size_t i;
+
+    data = malloc(sizeof *data * len);
+    if (!data) {
+        return false;
+    }
+    for (i = 0; i < len; i++) {
+        data[i] = sin(0.1 * (double)(i % MICRO_DIMS))
+                + cos(0.07 * (double)(i / MICRO_DIMS % MICRO_DIMS))
+                + 0.01 * (double)(i / MICRO_DIMS / MICRO_DIMS);
+    }
+    if (!gamma_distribution_set(dist, matr, &dims, data)) {
+        free(data);
+        return false;
+    }
+    return true;
+}
+
+
+/** @brief Allocate and fill every input
+ *  @param bench
+ *      Bench to initialize, which must be zeroed
+ *  @param len
+ *      Inputs per batch
+ *  @returns true on success, false on allocation failure
+ */
+static bool micro_bench_init(struct micro_bench *bench, size_t len)
+{
+    const double angle = 3.0 * MICRO_PI / 180.0;
+    struct micro_data *data = &bench->data;
+    gamma_mat_t rot = gamma_mat_identity, ax = gamma_mat_identity;
+    gamma_vec_t *offs;
+    double ext;
+    size_t i;
+    int j, axis;
+
+    data->len = len;
+    data->cells = gamma_aligned_alloc(alignof (struct gamma_interp),
+                                      sizeof *data->cells * len);
+    data->prep = gamma_aligned_alloc(alignof (struct gamma_interp),
+                                     sizeof *data->prep * len);
+    data->offs = gamma_aligned_alloc(alignof (gamma_vec_t),
+                                     sizeof *data->offs * len);
+    data->vecs = gamma_aligned_alloc(alignof (gamma_vec_t),
+                                     sizeof *data->vecs * len);
+    data->vout = gamma_aligned_alloc(alignof (gamma_vec_t),
+                                     sizeof *data->vout * len);
+    data->out = malloc(sizeof *data->out * len);
+    bench->pos = gamma_aligned_alloc(alignof (gamma_vec_t),
+                                     sizeof *bench->pos * len);
+    bench->inner = gamma_aligned_alloc(alignof (gamma_vec_t),
+                                       sizeof *bench->inner * len);
+    bench->edge = gamma_aligned_alloc(alignof (gamma_vec_t),
+                                      sizeof *bench->edge * len);
+    bench->mats = gamma_aligned_alloc(alignof (gamma_mat_t),
+                                      sizeof *bench->mats * MICRO_MATS);
+    bench->inv = gamma_aligned_alloc(alignof (gamma_mat_t),
+                                     sizeof *bench->inv * MICRO_MATS);
+    for (axis = 0; axis < 3; axis++) {
+        bench->soa[axis] = malloc(sizeof *bench->soa[axis] * len);
+    }
+    if (!data->cells || !data->prep || !data->offs || !data->vecs
+        || !data->vout || !data->out || !bench->pos || !bench->inner
+        || !bench->edge || !bench->mats || !bench->inv || !bench->soa[0]
+        || !bench->soa[1] || !bench->soa[2]) {
+        return false;
+    }
+
+    srand(12345);
+    for (i = 0; i < len; i++) {
+        for (j = 0; j < 8; j++) {
+            data->cells[i].buf[j] = micro_uniform(0.0, 2.0);
+        }
+        data->offs[i] = (const gamma_vec_t){{
+            micro_uniform(0, 1), micro_uniform(0, 1), micro_uniform(0, 1), 0
+        }};
+        data->vecs[i] = (const gamma_vec_t){{
+            micro_uniform(-50, 50), micro_uniform(-50, 50),
+            micro_uniform(-50, 50), 1
+        }};
+    }
+
+    /* 2 mm grids, one of them rotated about the third axis */
+    for (axis = 0; axis < 3; axis++) {
+        ax.cols[axis].vec[axis] = rot.cols[axis].vec[axis] = 2.0;
+        ax.cols[3].vec[axis] = 0.5;
+    }
+    rot.cols[0] = (const gamma_vec_t){{
+        2.0 * cos(angle), 2.0 * sin(angle), 0, 0
+    }};
+    rot.cols[1] = (const gamma_vec_t){{
+        -2.0 * sin(angle), 2.0 * cos(angle), 0, 0
+    }};
+    data->mat = rot;
+    data->mat.cols[3] = (const gamma_vec_t){{ 1.5, -2.5, 3.5, 1 }};
+    if (!micro_distribution(&bench->rot, &rot)) {
+        return false;
+    }
+    if (!micro_distribution(&bench->ax, &ax)) {
+        return false;
+    }
+
+    /* Physical points well inside both grids, and pixel points either inside
+       or straddling one face of the lattice */
+    ext = 2.0 * (MICRO_DIMS - 1);
+    for (i = 0; i < len; i++) {
+        bench->pos[i] = (const gamma_vec_t){{
+            micro_uniform(0.2 * ext, 0.8 * ext),
+            micro_uniform(0.2 * ext, 0.8 * ext),
+            micro_uniform(0.2 * ext, 0.8 * ext), 1
+        }};
+        for (axis = 0; axis < 3; axis++) {
+            bench->soa[axis][i] = bench->pos[i].vec[axis];
+        }
+        bench->inner[i] = (const gamma_vec_t){{
+            micro_uniform(1, MICRO_DIMS - 2), micro_uniform(1, MICRO_DIMS - 2),
+            micro_uniform(1, MICRO_DIMS - 2), 1
+        }};
+        offs = &bench->edge[i];
+        *offs = bench->inner[i];
+        axis = (int)(i % 3);
+        offs->vec[axis] = i / 3 % 2 ? micro_uniform(-1, 0)
+                                    : micro_uniform(MICRO_DIMS - 1, MICRO_DIMS);
+    }
+
+    for (i = 0; i < MICRO_MATS; i++) {
+        for (j = 0; j < 3; j++) {
+            for (axis = 0; axis < 3; axis++) {
+                bench->mats[i].cols[j].vec[axis] = micro_uniform(-1, 1)
+                                                 + 3.0 * (j == axis);
+            }
+            bench->mats[i].cols[j].vec[3] = 0.0;
+            bench->mats[i].cols[3].vec[j] = micro_uniform(-10, 10);
+        }
+        bench->mats[i].cols[3].vec[3] = 1.0;
+    }
+
+    /* The pattern search minimizes an ellipsoid with axes of 1 and 10,
+       turned off the search bases */
+    for (axis = 0; axis < 3; axis++) {
+        bench->bases[axis] = (const gamma_vec_t){ 0 };
+        bench->bases[axis].vec[axis] = 1.0;
+    }
+    bench->quad = gamma_mat_identity;
+    bench->quad.cols[0] = (const gamma_vec_t){{ 5.5, 4.5, 0, 0 }};
+    bench->quad.cols[1] = (const gamma_vec_t){{ 4.5, 5.5, 0, 0 }};
+    bench->quad.cols[3] = (const gamma_vec_t){ 0 };
+    return true;
+}
+
+
+/** @brief Release everything allocated by `micro_bench_init` */
+static void micro_bench_destroy(struct micro_bench *bench)
+{
+    int axis;
+
+    gamma_aligned_free(bench->data.cells);
+    gamma_aligned_free(bench->data.prep);
+    gamma_aligned_free(bench->data.offs);
+    gamma_aligned_free(bench->data.vecs);
+    gamma_aligned_free(bench->data.vout);
+    free(bench->data.out);
+    gamma_aligned_free(bench->pos);
+    gamma_aligned_free(bench->inner);
+    gamma_aligned_free(bench->edge);
+    gamma_aligned_free(bench->mats);
+    gamma_aligned_free(bench->inv);
+    for (axis = 0; axis < 3; axis++) {
+        free(bench->soa[axis]);
+    }
+    free(bench->rot.data);
+    free(bench->ax.data);
+}
+
+
+/** @brief Print usage */
+static void micro_usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--quick] [--repeat N] [--len N]\n"
+            "  --quick      shorter and fewer samples\n"
+            "  --repeat N   samples per kernel, of which the fastest counts "
+            "(default 7)\n"
+            "  --len N      inputs per batch (default 4096)\n",
+            argv0);
+}
+
+
+/** @brief Parse the command line
+ *  @param cfg
+ *      Settings to fill in
+ *  @param argc
+ *      Argument count
+ *  @param argv
+ *      Arguments
+ *  @returns true on success, false on a malformed command line
+ */
+static bool micro_parse(struct micro_config *cfg, int argc, char **argv)
+{
+    long len;
+    int i;
+
+    cfg->len = 4096;
+    cfg->repeat = 7;
+    cfg->sample = 5e-3;
+    cfg->first = false;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            cfg->repeat = 2;
+            cfg->sample = 5e-4;
+        } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            cfg->repeat = atoi(argv[++i]);
+            if (cfg->repeat < 1) {
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--len") && i + 1 < argc) {
+            len = atol(argv[++i]);
+            if (len < MICRO_SEARCH_DIV || len > 1L << 24) {
+                return false;
+            }
+            cfg->len = (size_t)len;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char **argv)
+{
+    static const struct micro_case library[] = {
+        { "distribution_interp", "library", micro_distribution_interp, 1 },
+        { "distribution_interp_axial", "library",
+          micro_distribution_interp_axial, 1 },
+        { "distribution_interpn", "library", micro_distribution_interpn, 1 },
+        { "distribution_sample_interior", "library",
+          micro_distribution_sample_interior, 1 },
+        { "distribution_sample_boundary", "library",
+          micro_distribution_sample_boundary, 1 },
+        { "mat_invert", "library", micro_mat_invert, 1 },
+        { "pattern_search", "library", micro_pattern_search,
+          MICRO_SEARCH_DIV },
+    };
+    struct micro_config cfg;
+    struct micro_bench bench = { .data.len = 0 };
+    double *ref;
+    size_t i;
+
+    if (!micro_parse(&cfg, argc, argv)) {
+        micro_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    ref = malloc(sizeof *ref * 8 * cfg.len);
+    if (!ref || !micro_bench_init(&bench, cfg.len)) {
+        free(ref);
+        micro_bench_destroy(&bench);
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n  \"benchmark\": \"gamma_micro\",\n  \"len\": %zu,\n"
+           "  \"repeat\": %d,\n  \"kernels\": [", cfg.len, cfg.repeat);
+    micro_variants(&cfg, &bench, ref);
+    for (i = 0; i < BUFLEN(library); i++) {
+        micro_case(&cfg, &bench, &library[i], -1.0);
+    }
+    printf("\n  ]\n}\n");
+
+    free(ref);
+    micro_bench_destroy(&bench);
+    return EXIT_SUCCESS;
+}
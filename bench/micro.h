@@ -0,0 +1,60 @@
+#pragma once
+
+/** @file Kernels of the gamma_micro microbenchmark that are built once per
+ *      code generation variant, so that the header-inline primitives of the
+ *      library may be compared as the compiler emits them with and without
+ *      vectorization, and against explicit SIMD
+ */
+
+#ifndef GAMMA_MICRO_H
+#define GAMMA_MICRO_H
+
+#include <stddef.h>
+#include "interp.h"
+#include "mat.h"
+
+
+/** @brief Inputs and outputs of the kernels */
+struct micro_data {
+    size_t               len;   /* Element count of each array */
+    struct gamma_interp *cells; /* Interpolator corner values */
+    struct gamma_interp *prep;  /* Prepared interpolators */
+    gamma_vec_t         *offs;  /* Unit pixel offsets into the cells */
+    gamma_vec_t         *vecs;  /* Homogeneous coordinates */
+    gamma_vec_t         *vout;  /* Vector results */
+    double              *out;   /* Scalar results */
+    gamma_mat_t          mat;   /* Affine matrix */
+};
+
+
+/** @brief A kernel, which processes every element of the data once
+ *  @param data
+ *      Kernel data
+ */
+typedef void micro_fn_t(struct micro_data *data);
+
+
+/** @brief The kernels of one variant. A kernel is null where the variant does
+ *      not exist on the target
+ */
+struct micro_kernels {
+    const char *variant;            /* Variant name */
+    micro_fn_t *interp_single;      /* `gamma_interp_single` */
+    micro_fn_t *interp_prepare;     /* `gamma_interp_prepare`, from a copy of
+                                       the corner values */
+    micro_fn_t *interp_eval;        /* `gamma_interp_eval` */
+    micro_fn_t *matmul_mv;          /* `gamma_matmul_mv` */
+};
+
+
+/** @brief Built with vectorization disabled */
+extern const struct micro_kernels micro_kernels_scalar;
+
+/** @brief Built with the compiler's vectorizers enabled */
+extern const struct micro_kernels micro_kernels_auto;
+
+/** @brief Written with intrinsics */
+extern const struct micro_kernels micro_kernels_simd;
+
+
+#endif /* GAMMA_MICRO_H */
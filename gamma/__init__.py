@@ -1 +1,2 @@
-from .gamma import Parameters, Options, Distribution, Results, compute
+from .gamma import Parameters, Options, Distribution, Results, Future, \
+    compute, compute_async, load
@@ -3,12 +3,44 @@
 #ifndef GAMMA_COMMON_H
 #define GAMMA_COMMON_H
 
+#include <stdlib.h>
+
 /** @brief Declaration specifier for (small) functions defined in-header */
 #define GAMMA_INLINE static inline
 
 /** @brief Also known as `ARRAYLEN` when other people write it */
 #define BUFLEN(buf) (sizeof (buf) / sizeof *(buf))
 
+/** @brief Allocate memory aligned to at least @p align bytes, as is needed by
+ *      any buffer of the (over-)aligned vector types
+ *  @param align
+ *      Alignment, a power of two
+ *  @param size
+ *      Allocation size in bytes
+ *  @returns A pointer to the new buffer, or NULL on failure. Release it with
+ *      `gamma_aligned_free`
+ */
+GAMMA_INLINE void *gamma_aligned_alloc(size_t align, size_t size)
+{
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, align);
+#else
+    return aligned_alloc(align, (size + align - 1) & ~(align - 1));
+#endif
+}
+
+
+/** @brief Release a buffer obtained from `gamma_aligned_alloc` */
+GAMMA_INLINE void gamma_aligned_free(void *ptr)
+{
+#if defined(_MSC_VER)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+
 /** Create all the extern "C"-type macros if not already defined */
 #if defined(__cplusplus) && __cplusplus
 #   if !defined(EXTERN_C)
@@ -0,0 +1,96 @@
+#pragma once
+
+/** @file Hot-path counters. They are only counted if the library is built with
+ *      `GAMMA_COUNTERS` defined, and are otherwise compiled out, so that the
+ *      counts reported are zero
+ */
+
+#ifndef GAMMA_COUNTERS_H
+#define GAMMA_COUNTERS_H
+
+#include "common.h"
+
+#if defined(GAMMA_COUNTERS)
+#   include <threads.h>
+#endif
+
+EXTERN_C_BEGIN
+
+
+/** @brief Bins of the histogram of objective evaluations per voxel. Bin zero
+ *      counts voxels that needed none, and bin i > 0 voxels that needed
+ *      [2^(i - 1), 2^i), except that the last bin counts everything beyond
+ */
+#define GAMMA_COUNTER_BINS 16
+
+
+/** @brief Counts of the work done by a run */
+struct gamma_counters {
+    long long evals;    /* Objective evaluations */
+    long long iters;    /* Pattern search stencils */
+    long long shrinks;  /* Pattern search stencil shrinks */
+    long long skipped;  /* Measured dose voxels skipped below threshold */
+    long long oob;      /* Interpolation corners gathered out of bounds */
+    long long hist[GAMMA_COUNTER_BINS]; /* Voxels by objective evaluations */
+};
+
+
+/** @brief Find the histogram bin of a voxel
+ *  @param evals
+ *      Objective evaluations at the voxel
+ *  @returns The bin of @p evals
+ */
+GAMMA_INLINE int gamma_counters_bin(long long evals)
+{
+    int res = 0;
+
+    while (evals && res < GAMMA_COUNTER_BINS - 1) {
+        evals >>= 1;
+        res++;
+    }
+    return res;
+}
+
+
+/** @brief Add counters to others
+ *  @param[in, out] dst
+ *      Destination
+ *  @param src
+ *      Counters to add
+ */
+GAMMA_INLINE void gamma_counters_merge(struct gamma_counters       *dst,
+                                       const struct gamma_counters *src)
+{
+    int i;
+
+    dst->evals += src->evals;
+    dst->iters += src->iters;
+    dst->shrinks += src->shrinks;
+    dst->skipped += src->skipped;
+    dst->oob += src->oob;
+    for (i = 0; i < GAMMA_COUNTER_BINS; i++) {
+        dst->hist[i] += src->hist[i];
+    }
+}
+
+
+#if defined(GAMMA_COUNTERS)
+
+/** @brief The counters of the calling thread, which the main loop moves into
+ *      its per-thread partial results after each task
+ */
+extern thread_local struct gamma_counters gamma_counters_local;
+
+/** @brief Add to a counter of the calling thread */
+#   define GAMMA_COUNT(field, n) ((void)(gamma_counters_local.field += (n)))
+
+#else
+
+#   define GAMMA_COUNT(field, n) ((void)0)
+
+#endif
+
+
+EXTERN_C_END
+
+#endif /* GAMMA_COUNTERS_H */
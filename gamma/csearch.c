@@ -0,0 +1,754 @@
+#include <stdalign.h>
+#include <stdlib.h>
+#include <tgmath.h>
+#include "counters.h"
+#include "csearch.h"
+#include "interp.h"
+
+
+/** @brief The most Newton steps taken within a cell */
+#define GAMMA_CSRCH_STEPS 8
+
+
+/** @brief Times a step that does not descend is halved before giving up */
+#define GAMMA_CSRCH_HALVINGS 4
+
+
+/** @brief Steps no longer than this in each unit cell coordinate are
+ *      converged
+ */
+#define GAMMA_CSRCH_TOL 1e-6
+
+
+/** @brief Weights of the dose difference when seeking the distance to
+ *      agreement in a cell, each as the multiple of half its longest diagonal
+ *      that the range of its corner values costs. Each weight is minimized
+ *      from the minimum of the one before, since the heaviest alone leaves
+ *      the steps crawling along the isodose surface
+ */
+static const double gamma_csrch_penalties[] = { 1e0, 1e2, 1e4 };
+
+
+/** @brief Dose difference, as a proportion of the range of the corner values,
+ *      within which a point lies on the isodose surface
+ */
+#define GAMMA_CSRCH_ISO 1e-6
+
+
+/** @brief The objective restricted to one cell, in unit cell coordinates u,
+ *      as |A u + d|^2 + (ratio * (D(u) - dose))^2 where D is trilinear
+ */
+struct gamma_cellfunc {
+    struct gamma_interp interp; /* Prepared interpolator of the cell */
+    double              gram[3][3]; /* A^T A */
+    double              lin[3];     /* A^T d */
+    double              cst;        /* |d|^2 */
+    double              ratio;      /* Weight of the dose difference */
+    double              dose;       /* Dose to match */
+};
+
+
+/** @brief Halves of the gradient and Hessian of the objective at a point */
+struct gamma_cellstep {
+    double val;         /* Objective */
+    double grad[3];     /* Half the gradient */
+    double hess[3][3];  /* Half the Hessian */
+    double gn[3][3];    /* Half the Gauss-Newton approximation of the Hessian,
+                           which is positive definite */
+};
+
+
+/** @brief Compare two cell offsets by distance bound, for qsort
+ *  @param a
+ *      Cell offset
+ *  @param b
+ *      Cell offset
+ *  @returns The ordering of @p a with respect to @p b
+ */
+static int gamma_cells_compare(const void *a, const void *b)
+{
+    const struct gamma_celloff *lhs = a, *rhs = b;
+
+    return (lhs->val > rhs->val) - (lhs->val < rhs->val);
+}
+
+
+bool gamma_cells_init(struct gamma_cells *cells,
+                      const gamma_mat_t  *lattice,
+                      gamma_scal_t        radius)
+{
+    const gamma_scal_t rsqr = gamma_sqr(radius);
+    gamma_mat_t inverse = *lattice;
+    gamma_scal_t norm = 0.0, gap[3], val;
+    gamma_vec_t row;
+    int bound[3], i, j, k, axis;
+    bool axial = true;
+    size_t cap;
+
+    cells->len = 0;
+    cells->offs = NULL;
+    inverse.cols[3] = gamma_mat_identity.cols[3];
+    if (!gamma_mat_invert(&inverse)) {
+        return false;
+    }
+    for (axis = 0; axis < 3; axis++) {
+        /* Cells one apart along an axis may touch, so reach one further */
+        row = (const gamma_vec_t){{
+            inverse.cols[0].vec[axis],
+            inverse.cols[1].vec[axis],
+            inverse.cols[2].vec[axis],
+            0
+        }};
+        bound[axis] = (int)floor(radius * sqrt(gamma_vec_dp(&row, &row))) + 1;
+        norm += gamma_vec_dp(&row, &row);
+        for (i = 0; i < 3; i++) {
+            axial = axial && (i == axis || lattice->cols[axis].vec[i] == 0.0);
+        }
+    }
+
+    cap = (size_t)(2 * bound[0] + 1) * (2 * bound[1] + 1) * (2 * bound[2] + 1);
+    cells->offs = gamma_aligned_alloc(alignof (struct gamma_celloff),
+                                      sizeof *cells->offs * cap);
+    if (!cells->offs) {
+        return false;
+    }
+    for (k = -bound[2]; k <= bound[2]; k++) {
+        for (j = -bound[1]; j <= bound[1]; j++) {
+            for (i = -bound[0]; i <= bound[0]; i++) {
+                /* Points of the two cells differ by [k - 1, k + 1] in lattice
+                   coordinates, whose shortest member is gap */
+                gap[0] = fmax(abs(i) - 1, 0);
+                gap[1] = fmax(abs(j) - 1, 0);
+                gap[2] = fmax(abs(k) - 1, 0);
+                if (axial) {
+                    val = gamma_sqr(lattice->cols[0].vec[0] * gap[0])
+                        + gamma_sqr(lattice->cols[1].vec[1] * gap[1])
+                        + gamma_sqr(lattice->cols[2].vec[2] * gap[2]);
+                } else {
+                    /* |v| <= |A^-1|_F |A v| for any lattice displacement v */
+                    val = (gamma_sqr(gap[0]) + gamma_sqr(gap[1])
+                         + gamma_sqr(gap[2])) / norm;
+                }
+                cells->offs[cells->len].lat
+                    = (const gamma_idx_t){{ i, j, k, 0 }};
+                cells->offs[cells->len].val = val;
+                cells->len += val <= rsqr;
+            }
+        }
+    }
+    qsort(cells->offs, cells->len, sizeof *cells->offs, gamma_cells_compare);
+    return true;
+}
+
+
+void gamma_cells_destroy(struct gamma_cells *cells)
+{
+    gamma_aligned_free(cells->offs);
+    cells->offs = NULL;
+    cells->len = 0;
+}
+
+
+/** @brief Read the corner values of a cell
+ *  @param dist
+ *      Distribution
+ *  @param lat
+ *      Lattice index of the first corner
+ *  @param[out] interp
+ *      Receives the corner values, zero for any out of bounds
+ */
+static void gamma_cell_corners(const struct gamma_distribution *dist,
+                               const gamma_idx_t               *lat,
+                               struct gamma_interp             *interp)
+{
+    gamma_idx_t idx;
+    ptrdiff_t base;
+    bool inside;
+    int c;
+
+    inside = lat->idx[0] >= 0 && lat->idx[0] + 1 < dist->dims.idx[0]
+          && lat->idx[1] >= 0 && lat->idx[1] + 1 < dist->dims.idx[1]
+          && lat->idx[2] >= 0 && lat->idx[2] + 1 < dist->dims.idx[2];
+    if (inside) {
+        base = gamma_distribution_offset(dist, lat->idx[0], lat->idx[1],
+                                         lat->idx[2]);
+        for (c = 0; c < 8; c++) {
+            interp->buf[c] = gamma_distribution_value(
+                dist, base + gamma_distribution_offset(dist, c & 1, c >> 1 & 1,
+                                                       c >> 2));
+        }
+        return;
+    }
+    for (c = 0; c < 8; c++) {
+        idx = *lat;
+        idx.idx[0] += c & 1;
+        idx.idx[1] += c >> 1 & 1;
+        idx.idx[2] += c >> 2;
+        interp->buf[c] = gamma_distribution_at(dist, &idx);
+    }
+}
+
+
+/** @brief Evaluate the objective of a cell with its derivatives
+ *  @param cell
+ *      Cell objective
+ *  @param u
+ *      Unit cell coordinates
+ *  @param[out] step
+ *      Receives the value and derivatives
+ */
+static void gamma_cell_eval(const struct gamma_cellfunc *cell,
+                            const double                 u[3],
+                            struct gamma_cellstep       *step)
+{
+    const double *b = cell->interp.buf;
+    const double x = u[0], y = u[1], z = u[2];
+    double dose, grad[3], cross[3], res;
+    int i, j;
+
+    /* The prepared interpolator holds the coefficients of the monomials */
+    dose = b[0] + b[1] * x + b[2] * y + b[3] * x * y + b[4] * z + b[5] * x * z
+         + b[6] * y * z + b[7] * x * y * z;
+    grad[0] = b[1] + b[3] * y + b[5] * z + b[7] * y * z;
+    grad[1] = b[2] + b[3] * x + b[6] * z + b[7] * x * z;
+    grad[2] = b[4] + b[5] * x + b[6] * y + b[7] * x * y;
+    cross[0] = b[6] + b[7] * x;     /* d2/dy dz */
+    cross[1] = b[5] + b[7] * y;     /* d2/dx dz */
+    cross[2] = b[3] + b[7] * z;     /* d2/dx dy */
+
+    res = cell->ratio * (dose - cell->dose);
+    step->val = cell->cst + gamma_sqr(res);
+    for (i = 0; i < 3; i++) {
+        step->grad[i] = cell->lin[i] + cell->ratio * res * grad[i];
+        step->val += u[i] * (2.0 * cell->lin[i]);
+        for (j = 0; j < 3; j++) {
+            step->grad[i] += cell->gram[i][j] * u[j];
+            step->val += u[i] * cell->gram[i][j] * u[j];
+            step->gn[i][j] = cell->gram[i][j]
+                           + gamma_sqr(cell->ratio) * grad[i] * grad[j];
+            step->hess[i][j] = step->gn[i][j];
+            if (i != j) {
+                step->hess[i][j] += cell->ratio * res * cross[3 - i - j];
+            }
+        }
+    }
+}
+
+
+/** @brief Solve for a Newton step over the free coordinates
+ *  @param hess
+ *      Half the Hessian
+ *  @param grad
+ *      Half the gradient
+ *  @param fixed
+ *      Coordinates held where they are
+ *  @param[out] dir
+ *      Receives the step, zero along the fixed coordinates
+ *  @returns true on success, false if @p hess is not positive definite over
+ *      the free coordinates
+ */
+static bool gamma_cell_solve(const double hess[3][3],
+                             const double grad[3],
+                             const bool   fixed[3],
+                             double       dir[3])
+{
+    double chol[3][3] = { { 0 } }, sum;
+    int i, j, k;
+
+    /* Cholesky factorization, with the fixed coordinates as the identity */
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j <= i; j++) {
+            if (fixed[i] || fixed[j]) {
+                chol[i][j] = i == j;
+                continue;
+            }
+            sum = hess[i][j];
+            for (k = 0; k < j; k++) {
+                sum -= chol[i][k] * chol[j][k];
+            }
+            if (i == j) {
+                if (!(sum > 0.0)) {
+                    return false;
+                }
+                chol[i][i] = sqrt(sum);
+            } else {
+                chol[i][j] = sum / chol[j][j];
+            }
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        sum = fixed[i] ? 0.0 : -grad[i];
+        for (k = 0; k < i; k++) {
+            sum -= chol[i][k] * dir[k];
+        }
+        dir[i] = sum / chol[i][i];
+    }
+    for (i = 2; i >= 0; i--) {
+        sum = dir[i];
+        for (k = i + 1; k < 3; k++) {
+            sum -= chol[k][i] * dir[k];
+        }
+        dir[i] = sum / chol[i][i];
+    }
+    return true;
+}
+
+
+/** @brief Search along a direction projected onto the cell for a lower value
+ *  @param cell
+ *      Cell objective
+ *  @param[in, out] u
+ *      Unit cell coordinates, moved to the lower value if one is found
+ *  @param dir
+ *      Direction, which is halved until the value descends
+ *  @param[in, out] step
+ *      Value and derivatives at @p u, updated with it
+ *  @returns true if the value descended, false if @p u is unchanged
+ */
+static bool gamma_cell_descend(const struct gamma_cellfunc *cell,
+                               double                       u[3],
+                               const double                 dir[3],
+                               struct gamma_cellstep       *step)
+{
+    struct gamma_cellstep next;
+    double test[3], scale = 1.0;
+    int h, i;
+
+    for (h = 0; h <= GAMMA_CSRCH_HALVINGS; h++, scale *= 0.5) {
+        for (i = 0; i < 3; i++) {
+            test[i] = fmin(fmax(u[i] + scale * dir[i], 0.0), 1.0);
+        }
+        gamma_cell_eval(cell, test, &next);
+        GAMMA_COUNT(evals, 1);
+        if (next.val < step->val) {
+            *step = next;
+            u[0] = test[0];
+            u[1] = test[1];
+            u[2] = test[2];
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** @brief Minimize the objective of a cell by projected Newton steps
+ *  @param cell
+ *      Cell objective
+ *  @param[in, out] u
+ *      Starting unit cell coordinates, and where the minimum is written
+ */
+static void gamma_cell_minimize(const struct gamma_cellfunc *cell,
+                                double                       u[3])
+{
+    struct gamma_cellstep step;
+    double dir[3], len;
+    bool fixed[3], solved;
+    int n, i;
+
+    gamma_cell_eval(cell, u, &step);
+    GAMMA_COUNT(evals, 1);
+    for (n = 0; n < GAMMA_CSRCH_STEPS; n++) {
+        /* Hold the coordinates on faces that the gradient pushes against */
+        for (i = 0; i < 3; i++) {
+            fixed[i] = (u[i] <= 0.0 && step.grad[i] > 0.0)
+                    || (u[i] >= 1.0 && step.grad[i] < 0.0);
+        }
+        solved = gamma_cell_solve((const double (*)[3])step.hess, step.grad,
+                                  fixed, dir)
+              || gamma_cell_solve((const double (*)[3])step.gn, step.grad,
+                                  fixed, dir);
+        if (solved) {
+            len = fmax(fmax(fabs(dir[0]), fabs(dir[1])), fabs(dir[2]));
+            if (!(len > GAMMA_CSRCH_TOL)) {
+                break;
+            }
+            if (gamma_cell_descend(cell, u, dir, &step)) {
+                continue;
+            }
+        }
+        /* Projection may turn a Newton step uphill where a face cuts it short,
+           but a short enough step down the scaled gradient always descends */
+        for (i = 0; i < 3; i++) {
+            dir[i] = -step.grad[i] / step.gn[i][i];
+        }
+        if (!gamma_cell_descend(cell, u, dir, &step)) {
+            break;
+        }
+    }
+}
+
+
+/** @brief The state of a search at one origin */
+struct gamma_cellwalk {
+    const struct gamma_csfunc *func;    /* Objective */
+    const gamma_mat_t         *mat;     /* Pixel-to-physical transformation */
+    gamma_vec_t                origin;  /* Physical coordinates of the origin */
+    gamma_vec_t                pix;     /* Pixel coordinates of the origin */
+    double                     circ;    /* Half the longest diagonal of a
+                                           cell */
+    struct gamma_cellfunc      cell;    /* Objective of the current cell */
+    struct gamma_pspair       *best;    /* Best point found so far */
+    double                    *dta;     /* Squared distance to agreement found
+                                           so far, or NULL if not wanted */
+};
+
+
+/** @brief Start a search
+ *  @param[out] walk
+ *      Search state
+ *  @param func
+ *      Objective
+ *  @param init
+ *      Origin and the objective there, where the results are written
+ *  @param dta
+ *      Where the squared distance to agreement is written, or NULL
+ */
+static void gamma_cellwalk_init(struct gamma_cellwalk     *walk,
+                                const struct gamma_csfunc *func,
+                                struct gamma_pspair       *init,
+                                double                    *dta)
+{
+    const gamma_mat_t *mat = &func->dist->matrix;
+    gamma_vec_t diag;
+    int i, j, c;
+
+    walk->func = func;
+    walk->mat = mat;
+    walk->origin = init->vec;
+    walk->pix = gamma_matmul_mv(&func->dist->inverse, &init->vec);
+    walk->best = init;
+    walk->dta = dta;
+    if (dta) {
+        *dta = HUGE_VAL;
+    }
+    for (c = 0, walk->circ = 0.0; c < 4; c++) {
+        diag = gamma_vec_fmadds(&mat->cols[1], (c & 1) ? -1.0 : 1.0,
+                                &mat->cols[0]);
+        diag = gamma_vec_fmadds(&mat->cols[2], (c & 2) ? -1.0 : 1.0, &diag);
+        walk->circ = fmax(walk->circ, 0.5 * sqrt(gamma_vec_dp(&diag, &diag)));
+    }
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            walk->cell.gram[i][j] = gamma_vec_dp(&mat->cols[i], &mat->cols[j]);
+        }
+    }
+    walk->cell.ratio = func->ratio;
+    walk->cell.dose = func->dose;
+}
+
+
+/** @brief Bound the squared distance from the origin to a cube of cells
+ *  @param walk
+ *      Search state
+ *  @param lo
+ *      Lattice coordinates of the first corner of the cube
+ *  @param size
+ *      Edge of the cube in cells
+ *  @returns The bound, which is exact if the lattice is axial
+ */
+static double gamma_cellwalk_dist(const struct gamma_cellwalk *walk,
+                                  const double                 lo[3],
+                                  double                       size)
+{
+    const gamma_mat_t *mat = walk->mat;
+    double res = 0.0, gap;
+    gamma_vec_t ctr;
+    int axis;
+
+    if (walk->func->dist->axial) {
+        for (axis = 0; axis < 3; axis++) {
+            gap = fmax(lo[axis] - walk->pix.vec[axis],
+                       walk->pix.vec[axis] - (lo[axis] + size));
+            res += gamma_sqr(mat->cols[axis].vec[axis] * fmax(gap, 0.0));
+        }
+        return res;
+    }
+    /* Otherwise the cube lies within a sphere about its center */
+    ctr = gamma_matmul_mv(mat, &(const gamma_vec_t){{
+        lo[0] + 0.5 * size, lo[1] + 0.5 * size, lo[2] + 0.5 * size, 1
+    }});
+    ctr = gamma_vec_sub(&ctr, &walk->origin);
+    gap = sqrt(gamma_vec_dp(&ctr, &ctr)) - size * walk->circ;
+    return gamma_sqr(fmax(gap, 0.0));
+}
+
+
+/** @brief Check whether the minimization may stop at once */
+GAMMA_INLINE bool gamma_cellwalk_done(const struct gamma_cellwalk *walk)
+{
+    return walk->best->val < walk->func->accept;
+}
+
+
+/** @brief Check whether a cell or block may improve on either result of a
+ *      search
+ *  @param walk
+ *      Search state
+ *  @param bound
+ *      A lower bound on the objective within it
+ *  @param dist
+ *      A lower bound on the squared distance to it
+ *  @param iso
+ *      Whether its range of dose may hold the dose to match
+ *  @returns true if it is worth visiting
+ */
+GAMMA_INLINE bool gamma_cellwalk_wants(const struct gamma_cellwalk *walk,
+                                       double                       bound,
+                                       double                       dist,
+                                       bool                         iso)
+{
+    return (bound < walk->best->val && !gamma_cellwalk_done(walk))
+        || (walk->dta && iso && dist < *walk->dta);
+}
+
+
+/** @brief Find the nearest point of the current cell where the dose equals the
+ *      dose to match, as the minimum of the objective with the dose difference
+ *      weighted so heavily that it lies on the isodose surface
+ *  @param walk
+ *      Search state, whose distance to agreement is updated
+ *  @param range
+ *      Range of the corner values, which holds the dose to match
+ *  @param disp
+ *      Physical displacement from the origin to the first corner
+ *  @param start
+ *      Unit cell coordinates to start from
+ */
+static void gamma_cellwalk_iso(struct gamma_cellwalk *walk,
+                               double                 range,
+                               const gamma_vec_t     *disp,
+                               const double           start[3])
+{
+    const gamma_mat_t *mat = walk->mat;
+    struct gamma_cellfunc iso = walk->cell;
+    double u[3] = { start[0], start[1], start[2] }, rdose, dsq;
+    gamma_vec_t pt;
+    size_t i;
+
+    for (i = 0; i < BUFLEN(gamma_csrch_penalties); i++) {
+        /* A flat cell agrees everywhere, so only the distance is left */
+        iso.ratio = range > 0.0
+                  ? gamma_csrch_penalties[i] * walk->circ / range : 0.0;
+        gamma_cell_minimize(&iso, u);
+    }
+    rdose = gamma_interp_eval(&iso.interp,
+                              &(const gamma_vec_t){{ u[0], u[1], u[2], 0 }});
+    if (!(fabs(rdose - iso.dose) <= GAMMA_CSRCH_ISO * range)) {
+        /* Stuck on a local minimum off the surface */
+        return;
+    }
+    pt = gamma_vec_fmadds(&mat->cols[0], u[0], disp);
+    pt = gamma_vec_fmadds(&mat->cols[1], u[1], &pt);
+    pt = gamma_vec_fmadds(&mat->cols[2], u[2], &pt);
+    dsq = gamma_vec_dp(&pt, &pt);
+    if (dsq < *walk->dta) {
+        *walk->dta = dsq;
+    }
+}
+
+
+/** @brief Minimize the objective within a cell, unless its bounds show that
+ *      it cannot improve on the best point, and likewise seek the distance to
+ *      agreement there if it is wanted
+ *  @param walk
+ *      Search state, whose best point and distance to agreement are updated
+ *  @param lat
+ *      Lattice index of the first corner of the cell
+ *  @param bound
+ *      A lower bound already known on the squared distance to the cell
+ */
+static void gamma_cellwalk_visit(struct gamma_cellwalk *walk,
+                                 const gamma_idx_t     *lat,
+                                 double                 bound)
+{
+    const struct gamma_csfunc *func = walk->func;
+    const gamma_mat_t *mat = walk->mat;
+    struct gamma_cellfunc *cell = &walk->cell;
+    const double lo3[3] = { lat->idx[0], lat->idx[1], lat->idx[2] };
+    double start[3], u[3], lo, hi, gap, val, rdose;
+    gamma_vec_t disp, best;
+    bool fit, iso;
+    int axis, c;
+
+    bound = fmax(bound, gamma_cellwalk_dist(walk, lo3, 1.0));
+    if (!gamma_cellwalk_wants(walk, bound, bound, true)) {
+        return;
+    }
+
+    /* The corners bound every value interpolated within the cell */
+    gamma_cell_corners(func->dist, lat, &cell->interp);
+    lo = hi = cell->interp.buf[0];
+    for (c = 1; c < 8; c++) {
+        lo = fmin(lo, cell->interp.buf[c]);
+        hi = fmax(hi, cell->interp.buf[c]);
+    }
+    gap = fmax(fmax(lo - func->dose, func->dose - hi), 0.0);
+    fit = gamma_cellwalk_wants(walk, bound + gamma_sqr(func->ratio * gap),
+                               HUGE_VAL, false);
+    iso = gamma_cellwalk_wants(walk, HUGE_VAL, bound, gap == 0.0);
+    if (!fit && !iso) {
+        return;
+    }
+    gamma_interp_prepare(&cell->interp);
+
+    disp = gamma_matmul_mv(mat, &(const gamma_vec_t){{
+        lo3[0], lo3[1], lo3[2], 1
+    }});
+    disp = gamma_vec_sub(&disp, &walk->origin);
+    cell->cst = gamma_vec_dp(&disp, &disp);
+    for (axis = 0; axis < 3; axis++) {
+        cell->lin[axis] = gamma_vec_dp(&mat->cols[axis], &disp);
+        /* Start from the nearest point of the cell to the origin, exactly so
+           if the lattice is axial */
+        start[axis] = fmin(fmax(walk->pix.vec[axis] - lo3[axis], 0.0), 1.0);
+        u[axis] = start[axis];
+    }
+    if (iso) {
+        gamma_cellwalk_iso(walk, hi - lo, &disp, start);
+    }
+    if (!fit) {
+        return;
+    }
+    gamma_cell_minimize(cell, u);
+
+    /* Evaluate the minimum as the objective of the caller would, rather than
+       by the expanded quadratic, which may cancel */
+    best = gamma_vec_fmadds(&mat->cols[0], u[0], &disp);
+    best = gamma_vec_fmadds(&mat->cols[1], u[1], &best);
+    best = gamma_vec_fmadds(&mat->cols[2], u[2], &best);
+    rdose = gamma_interp_eval(&cell->interp,
+                              &(const gamma_vec_t){{ u[0], u[1], u[2], 0 }});
+    val = gamma_sqr(func->ratio * (rdose - func->dose))
+        + gamma_vec_dp(&best, &best);
+    if (val < walk->best->val) {
+        walk->best->vec = gamma_vec_add(&walk->origin, &best);
+        walk->best->val = val;
+        walk->best->aux = rdose;
+    }
+}
+
+
+void gamma_cell_search(const struct gamma_cells  *cells,
+                       const struct gamma_csfunc *func,
+                       struct gamma_pspair       *init,
+                       double                    *dta)
+{
+    struct gamma_cellwalk walk;
+    gamma_idx_t base, lat;
+    size_t i;
+    int axis;
+
+    gamma_cellwalk_init(&walk, func, init, dta);
+    for (axis = 0; axis < 3; axis++) {
+        base.idx[axis] = (gamma_iscal_t)floor(walk.pix.vec[axis]);
+    }
+    base.idx[3] = 0;
+    for (i = 0; i < cells->len && gamma_cellwalk_wants(&walk,
+                                                       cells->offs[i].val,
+                                                       cells->offs[i].val,
+                                                       true); i++) {
+        lat = gamma_idx_add(&base, &cells->offs[i].lat);
+        gamma_cellwalk_visit(&walk, &lat, cells->offs[i].val);
+    }
+}
+
+
+/** @brief A block of a pyramid waiting to be searched */
+struct gamma_cellblock {
+    gamma_idx_t blk;    /* Block index */
+    double      dist;   /* Bound on the squared distance to the block */
+    double      bound;  /* Bound on the objective within the block */
+    bool        iso;    /* The range of the block holds the dose to match */
+};
+
+
+/** @brief Search the children of a block of a pyramid, most promising first
+ *  @param walk
+ *      Search state
+ *  @param pyr
+ *      Pyramid of the reference dose
+ *  @param rsqr
+ *      Squared search radius
+ *  @param level
+ *      Level of the block, at least one
+ *  @param blk
+ *      Block index
+ */
+static void gamma_branch_descend(struct gamma_cellwalk      *walk,
+                                 const struct gamma_pyramid *pyr,
+                                 double                      rsqr,
+                                 int                         level,
+                                 const gamma_idx_t          *blk)
+{
+    const gamma_idx_t *dims = &pyr->dims[level - 1];
+    const double size = ldexp(1.0, level - 1);
+    const struct gamma_csfunc *func = walk->func;
+    struct gamma_cellblock kids[8], next;
+    double lo[3], dlo, dhi, gap;
+    gamma_idx_t lat;
+    int n = 0, c, k, axis;
+
+    for (c = 0; c < 8; c++) {
+        next.blk = (const gamma_idx_t){{
+            2 * blk->idx[0] + (c & 1),
+            2 * blk->idx[1] + (c >> 1 & 1),
+            2 * blk->idx[2] + (c >> 2),
+            0
+        }};
+        if (next.blk.idx[0] >= dims->idx[0] || next.blk.idx[1] >= dims->idx[1]
+         || next.blk.idx[2] >= dims->idx[2]) {
+            continue;
+        }
+        for (axis = 0; axis < 3; axis++) {
+            lo[axis] = size * next.blk.idx[axis] - 1.0;
+        }
+        next.dist = next.bound = gamma_cellwalk_dist(walk, lo, size);
+        next.iso = true;
+        if (level > 1) {
+            /* Cells are bounded by their corners once visited */
+            gamma_pyramid_at(pyr, level - 1, &next.blk, &dlo, &dhi);
+            gap = fmax(fmax(dlo - func->dose, func->dose - dhi), 0.0);
+            next.bound += gamma_sqr(func->ratio * gap);
+            next.iso = gap == 0.0;
+        }
+        if (!(next.dist <= rsqr)
+         || !gamma_cellwalk_wants(walk, next.bound, next.dist, next.iso)) {
+            continue;
+        }
+        for (k = n++; k > 0 && kids[k - 1].bound > next.bound; k--) {
+            kids[k] = kids[k - 1];
+        }
+        kids[k] = next;
+    }
+
+    for (k = 0; k < n; k++) {
+        if (!gamma_cellwalk_wants(walk, kids[k].bound, kids[k].dist,
+                                  kids[k].iso)) {
+            /* Only a wanted distance to agreement may follow a cut */
+            continue;
+        } else if (level > 1) {
+            gamma_branch_descend(walk, pyr, rsqr, level - 1, &kids[k].blk);
+        } else {
+            lat = gamma_idx_sub(&kids[k].blk, &(const gamma_idx_t){{ 1, 1, 1 }});
+            gamma_cellwalk_visit(walk, &lat, kids[k].dist);
+        }
+    }
+}
+
+
+void gamma_branch_search(const struct gamma_pyramid *pyr,
+                         const struct gamma_csfunc  *func,
+                         gamma_scal_t                radius,
+                         struct gamma_pspair        *init,
+                         double                     *dta)
+{
+    const gamma_idx_t root = { 0 };
+    struct gamma_cellwalk walk;
+
+    gamma_cellwalk_init(&walk, func, init, dta);
+    if (!gamma_cellwalk_done(&walk) || dta) {
+        gamma_branch_descend(&walk, pyr, gamma_sqr(radius), pyr->levels - 1,
+                             &root);
+    }
+}
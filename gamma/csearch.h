@@ -0,0 +1,134 @@
+#pragma once
+
+#ifndef GAMMA_CSEARCH_H
+#define GAMMA_CSEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "distribution.h"
+#include "idx.h"
+#include "mat.h"
+#include "psearch.h"
+#include "pyramid.h"
+
+
+/** @brief A reference lattice cell relative to the cell holding the origin */
+struct gamma_celloff {
+    gamma_idx_t  lat;   /* Lattice offset of the cell's first corner */
+    gamma_scal_t val;   /* Lower bound on the squared distance from any point
+                           of the origin's cell to any point of this one */
+};
+
+
+/** @brief A list of cell offsets, sorted by increasing distance bound */
+struct gamma_cells {
+    size_t                len;  /* Cell count */
+    struct gamma_celloff *offs; /* Cells */
+};
+
+
+/** @brief The gamma objective over a trilinear dose, i.e. the squared distance
+ *      from the origin plus the squared, weighted dose difference
+ */
+struct gamma_csfunc {
+    const struct gamma_distribution *dist;      /* Reference dose */
+    double                           ratio;     /* Weight of the dose
+                                                   difference */
+    double                           dose;      /* Dose to match */
+    double                           accept;    /* Stop upon any value below
+                                                   this (or never if this is
+                                                   -HUGE_VAL) */
+};
+
+
+/** @brief Enumerate the lattice cells that reach within a sphere of any point
+ *      of the cell holding its center
+ *  @param cells
+ *      Cell list. This should not be managing any memory
+ *  @param lattice
+ *      Lattice basis. Only the first three columns are used, and these must be
+ *      displacement vectors (i.e. zero in the last position)
+ *  @param radius
+ *      Radius of the sphere
+ *  @returns true on success, false if @p lattice is singular or memory could
+ *      not be allocated
+ *  @note The origin's own cell comes first, with a bound of zero
+ */
+bool gamma_cells_init(struct gamma_cells *cells,
+                      const gamma_mat_t  *lattice,
+                      gamma_scal_t        radius);
+
+
+/** @brief Release the memory held by a cell list
+ *  @param cells
+ *      Cell list
+ */
+void gamma_cells_destroy(struct gamma_cells *cells);
+
+
+/** @brief Minimize the gamma objective cell by cell, walking a cell list
+ *      outward from a point
+ *  @param cells
+ *      Cell list, built on the lattice of the reference dose
+ *  @param func
+ *      Objective
+ *  @param[in, out] init
+ *      Origin and the objective there, and where the results are written,
+ *      with the reference dose at the result as the by-product
+ *  @param[out] dta
+ *      Receives the squared distance from the origin to the nearest point
+ *      where the reference dose equals the dose to match, or HUGE_VAL if no
+ *      cell in the list holds one, or NULL if it is not wanted. Only a
+ *      distance within the radius of the list is sure to be the nearest
+ *  @note Within a cell the dose is a trilinear polynomial, so the objective is
+ *      a sum of squares of smooth terms whose derivatives are known. Each cell
+ *      is minimized by a few Newton steps projected onto the cell, which
+ *      converge to the minimum of the cell wherever the objective is convex
+ *      there, and to a local minimum otherwise
+ *  @note Cells are skipped when the distance to them, plus the dose
+ *      difference that the range of their corner values allows, is no less
+ *      than the best value found, and the walk stops once the distance bound
+ *      alone is no less than it
+ *  @note The distance to agreement is sought in the same walk, which goes on
+ *      as long as a cell may hold a nearer point of the isodose surface. A
+ *      cell whose corner values straddle the dose holds such a point, and the
+ *      nearest one is found by the same Newton steps with the dose difference
+ *      weighted so heavily that the minimum lies on the surface
+ */
+void gamma_cell_search(const struct gamma_cells  *cells,
+                       const struct gamma_csfunc *func,
+                       struct gamma_pspair       *init,
+                       double                    *dta);
+
+
+/** @brief Minimize the gamma objective globally by branch and bound over a
+ *      min/max pyramid of the reference dose
+ *  @param pyr
+ *      Pyramid of the reference dose
+ *  @param func
+ *      Objective
+ *  @param radius
+ *      Radius of the search, beyond which no block or cell is visited
+ *  @param[in, out] init
+ *      Origin and the objective there, and where the results are written,
+ *      with the reference dose at the result as the by-product
+ *  @param[out] dta
+ *      Receives the squared distance to agreement as `gamma_cell_search` does,
+ *      found within @p radius, or NULL if it is not wanted
+ *  @note Each block is bounded below by its distance from the origin plus the
+ *      dose difference that its range allows, and is discarded unless that
+ *      beats the best value found. The children of a block are searched most
+ *      promising first, and the cells that remain are minimized as by
+ *      `gamma_cell_search`, so that the result is the global minimum within
+ *      @p radius up to the convergence of the cells
+ *  @note Blocks whose range holds the dose to match are also searched while
+ *      they may hold a nearer point of the isodose surface, if it is wanted
+ */
+void gamma_branch_search(const struct gamma_pyramid *pyr,
+                         const struct gamma_csfunc  *func,
+                         gamma_scal_t                radius,
+                         struct gamma_pspair        *init,
+                         double                     *dta);
+
+
+#endif /* GAMMA_CSEARCH_H */
@@ -2,24 +2,111 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <tgmath.h>
+#include "counters.h"
 #include "distribution.h"
 #include "interp.h"
+#include "trace.h"
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#   include <immintrin.h>
+#   define GAMMA_AVX2 1
+#endif
+
+
+/** @brief Check whether an affine matrix is diagonal but for its translation
+ *  @param matr
+ *      Affine matrix
+ *  @returns true if @p matr only scales and translates each axis
+ */
+static bool gamma_distribution_isaxial(const gamma_mat_t *matr)
+{
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 4; j++) {
+            if (i != j && matr->cols[i].vec[j] != 0.0) {
+                return false;
+            }
+        }
+    }
+    return matr->cols[3].vec[3] == 1.0;
+}
 
 
-/** @brief Linearize a multi-index
+/** @brief Invert the affine matrix of a distribution, directly if it is axial
  *  @param dist
- *      Distribution
- *  @param idx
- *      Multi-index
- *  @returns The index into the main data buffer, directly computed
- *  @warning This function does no bounds nor wraparound (overflow) checks
+ *      Distribution with its matrix and axial flag set
+ *  @returns true on success, false if the matrix is singular
  */
-static uint64_t
-gamma_distribution_linearize(const struct gamma_distribution *dist,
-                             const gamma_idx_t               *idx)
+static bool gamma_distribution_invert(struct gamma_distribution *dist)
 {
-    return (uint64_t)idx->idx[0] + (uint64_t)dist->dims.idx[0]
-        * (idx->idx[1] + (uint64_t)dist->dims.idx[1] * idx->idx[2]);
+    int i;
+
+    if (!dist->axial) {
+        dist->inverse = dist->matrix;
+        return gamma_mat_invert(&dist->inverse);
+    }
+    dist->inverse = gamma_mat_identity;
+    for (i = 0; i < 3; i++) {
+        if (!dist->matrix.cols[i].vec[i]) {
+            return false;
+        }
+        dist->inverse.cols[i].vec[i] = 1.0 / dist->matrix.cols[i].vec[i];
+        dist->inverse.cols[3].vec[i] = -dist->matrix.cols[3].vec[i]
+                                     * dist->inverse.cols[i].vec[i];
+    }
+    return true;
+}
+
+
+/** @brief Find the maximum pixel value of a distribution
+ *  @param dist
+ *      Distribution with its pixel data set
+ *  @returns The maximum, or -HUGE_VAL if it is empty
+ */
+static double gamma_distribution_max(const struct gamma_distribution *dist)
+{
+    /* A dense buffer is one run, and otherwise each row is a run */
+    const size_t rows = dist->dense ? 1 : (size_t)dist->dims.idx[1]
+                                                 * dist->dims.idx[2];
+    const size_t cols = dist->dense ? dist->len : (size_t)dist->dims.idx[0];
+    const ptrdiff_t step = dist->strides[0];
+    double res = -HUGE_VAL;
+    size_t r, i;
+
+#define GAMMA_DISTRIBUTION_MAX(type) \
+    for (r = 0; r < rows; r++) { \
+        const type *src = (const type *)dist->data \
+            + gamma_distribution_offset(dist, 0, r % dist->dims.idx[1], \
+                                        r / dist->dims.idx[1]); \
+        if (step == 1) { \
+            for (i = 0; i < cols; i++) { \
+                res = fmax(res, src[i]); \
+            } \
+        } else { \
+            for (i = 0; i < cols; i++) { \
+                res = fmax(res, src[(ptrdiff_t)i * step]); \
+            } \
+        } \
+    }
+
+    switch (dist->storage) {
+    case GAMMA_STORAGE_F64:
+    default:
+        GAMMA_DISTRIBUTION_MAX(double)
+        return res;
+    case GAMMA_STORAGE_F32:
+        GAMMA_DISTRIBUTION_MAX(float)
+        return res;
+    case GAMMA_STORAGE_U16:
+        GAMMA_DISTRIBUTION_MAX(uint16_t)
+        return dist->scale * res;
+    case GAMMA_STORAGE_U32:
+        GAMMA_DISTRIBUTION_MAX(uint32_t)
+        return dist->scale * res;
+    }
+
+#undef GAMMA_DISTRIBUTION_MAX
 }
 
 
@@ -28,21 +115,53 @@ bool gamma_distribution_set(struct gamma_distribution *dist,
                             const gamma_idx_t         *dims,
                             double                    *data)
 {
-    size_t i;
+    return gamma_distribution_set_storage(dist, matr, dims, GAMMA_STORAGE_F64,
+                                          1.0, NULL, data);
+}
+
+
+bool gamma_distribution_set_storage(struct gamma_distribution *dist,
+                                    const gamma_mat_t         *matr,
+                                    const gamma_idx_t         *dims,
+                                    gamma_storage_t            storage,
+                                    double                     scale,
+                                    const ptrdiff_t           *strides,
+                                    void                      *data)
+{
+    double start;
+    int axis;
 
+    for (axis = 0; strides && axis < 3; axis++) {
+        if (strides[axis] < -INT32_MAX || strides[axis] > INT32_MAX) {
+            return false;
+        }
+    }
     dist->matrix = *matr;
-    dist->inverse = *matr;
-    if (!gamma_mat_invert(&dist->inverse)) {
+    dist->axial = gamma_distribution_isaxial(&dist->matrix);
+    if (!gamma_distribution_invert(dist)) {
         return false;
     }
     dist->dims = *dims;
     dist->dims.idx[3] = INT32_MAX;
     dist->len = (size_t)dims->idx[0] * dims->idx[1] * dims->idx[2];
-    dist->max = -HUGE_VAL;
-    for (i = 0; i < dist->len; i++) {
-        dist->max = fmax(dist->max, data[i]);
+    dist->strides[0] = 1;
+    dist->strides[1] = dims->idx[0];
+    dist->strides[2] = (ptrdiff_t)dims->idx[0] * dims->idx[1];
+    dist->dense = true;
+    for (axis = 0; strides && axis < 3; axis++) {
+        dist->dense &= strides[axis] == dist->strides[axis];
+        dist->strides[axis] = strides[axis];
     }
+    if (dist->strides[2] < -INT32_MAX || dist->strides[2] > INT32_MAX) {
+        return false;
+    }
+    dist->storage = storage;
+    dist->scale = storage == GAMMA_STORAGE_U16 || storage == GAMMA_STORAGE_U32
+                ? scale : 1.0;
     dist->data = data;
+    start = gamma_trace_now();
+    dist->max = gamma_distribution_max(dist);
+    gamma_trace_note("distribution_set", start, gamma_trace_now());
     return true;
 }
 
@@ -56,7 +175,9 @@ double gamma_distribution_at(const struct gamma_distribution *dist,
 
     test = gamma_idx_hittest(idx, &zero, &dist->dims);
     if (!gamma_idx_any(&test)) {
-        res = dist->data[gamma_distribution_linearize(dist, idx)];
+        res = gamma_distribution_value(
+            dist, gamma_distribution_offset(dist, idx->idx[0], idx->idx[1],
+                                            idx->idx[2]));
     }
     return res;
 }
@@ -66,14 +187,15 @@ double gamma_distribution_at(const struct gamma_distribution *dist,
  *  @param[in, out] vec
  *      The vector on input and on output to receive the fractional parts
  *  @param[out] idx
- *      The index to receive the integral components, rounded towards zero
+ *      The index to receive the integral components, rounded towards negative
+ *      infinity so that the fractional parts are always in [0, 1)
  */
 static void gamma_distribution_modf(gamma_vec_t *vec, gamma_idx_t *idx)
 {
-    idx->idx[0] = (gamma_iscal_t)vec->vec[0];
-    idx->idx[1] = (gamma_iscal_t)vec->vec[1];
-    idx->idx[2] = (gamma_iscal_t)vec->vec[2];
-    idx->idx[3] = (gamma_iscal_t)vec->vec[3];
+    idx->idx[0] = (gamma_iscal_t)floor(vec->vec[0]);
+    idx->idx[1] = (gamma_iscal_t)floor(vec->vec[1]);
+    idx->idx[2] = (gamma_iscal_t)floor(vec->vec[2]);
+    idx->idx[3] = (gamma_iscal_t)floor(vec->vec[3]);
     vec->vec[0] -= idx->idx[0];
     vec->vec[1] -= idx->idx[1];
     vec->vec[2] -= idx->idx[2];
@@ -86,52 +208,552 @@ static void gamma_distribution_corners(const struct gamma_distribution *dist,
                                        const gamma_idx_t               *org)
 {
     static const gamma_idx_t zero = { 0 };
-    int64_t gather[8] = {
-        gamma_distribution_linearize(dist, org),
-        gather[0] + 1,
-        gather[0] + dist->dims.idx[0],
-        gather[2] + 1,
-        gather[0] + dist->dims.idx[0] * dist->dims.idx[1],
-        gather[4] + 1,
-        gather[4] + dist->dims.idx[0],
-        gather[6] + 1
+    const ptrdiff_t *st = dist->strides;
+    const ptrdiff_t gather[8] = {
+        gamma_distribution_offset(dist, org->idx[0], org->idx[1], org->idx[2]),
+        gather[0] + st[0],
+        gather[0] + st[1],
+        gather[2] + st[0],
+        gather[0] + st[2],
+        gather[4] + st[0],
+        gather[4] + st[1],
+        gather[6] + st[0]
     };
     gamma_idx_t ext, testlo, testhi;
+    gamma_iscal_t oob[8];
+    int c;
 
+    /* Offsets may be negative, so out-of-bounds corners are flagged apart */
     ext = gamma_idx_add(org, &(const gamma_idx_t){{ 1, 1, 1, 0 }});
     testlo = gamma_idx_hittest(org, &zero, &dist->dims);
     testhi = gamma_idx_hittest(&ext, &zero, &dist->dims);
-    gather[0] |= testlo.idx[0] | testlo.idx[1] | testlo.idx[2];
-    gather[1] |= testhi.idx[0] | testlo.idx[1] | testlo.idx[2];
-    gather[2] |= testlo.idx[0] | testhi.idx[1] | testlo.idx[2];
-    gather[3] |= testhi.idx[0] | testhi.idx[1] | testlo.idx[2];
-    gather[4] |= testlo.idx[0] | testlo.idx[1] | testhi.idx[2];
-    gather[5] |= testhi.idx[0] | testlo.idx[1] | testhi.idx[2];
-    gather[6] |= testlo.idx[0] | testhi.idx[1] | testhi.idx[2];
-    gather[7] |= testhi.idx[0] | testhi.idx[1] | testhi.idx[2];
-
-    intr->buf[0] = gather[0] < 0 ? 0.0 : dist->data[gather[0]];
-    intr->buf[1] = gather[1] < 0 ? 0.0 : dist->data[gather[1]];
-    intr->buf[2] = gather[2] < 0 ? 0.0 : dist->data[gather[2]];
-    intr->buf[3] = gather[3] < 0 ? 0.0 : dist->data[gather[3]];
-    intr->buf[4] = gather[4] < 0 ? 0.0 : dist->data[gather[4]];
-    intr->buf[5] = gather[5] < 0 ? 0.0 : dist->data[gather[5]];
-    intr->buf[6] = gather[6] < 0 ? 0.0 : dist->data[gather[6]];
-    intr->buf[7] = gather[7] < 0 ? 0.0 : dist->data[gather[7]];
+    oob[0] = testlo.idx[0] | testlo.idx[1] | testlo.idx[2];
+    oob[1] = testhi.idx[0] | testlo.idx[1] | testlo.idx[2];
+    oob[2] = testlo.idx[0] | testhi.idx[1] | testlo.idx[2];
+    oob[3] = testhi.idx[0] | testhi.idx[1] | testlo.idx[2];
+    oob[4] = testlo.idx[0] | testlo.idx[1] | testhi.idx[2];
+    oob[5] = testhi.idx[0] | testlo.idx[1] | testhi.idx[2];
+    oob[6] = testlo.idx[0] | testhi.idx[1] | testhi.idx[2];
+    oob[7] = testhi.idx[0] | testhi.idx[1] | testhi.idx[2];
+
+    GAMMA_COUNT(oob, !!oob[0] + !!oob[1] + !!oob[2] + !!oob[3]
+                   + !!oob[4] + !!oob[5] + !!oob[6] + !!oob[7]);
+
+    /* One switch over the storage for all eight corners */
+#define GAMMA_DISTRIBUTION_CORNERS(type, scale) \
+    for (c = 0; c < 8; c++) { \
+        intr->buf[c] = oob[c] \
+                     ? 0.0 : (scale) * ((const type *)dist->data)[gather[c]]; \
+    }
+
+    switch (dist->storage) {
+    case GAMMA_STORAGE_F64:
+    default:
+        GAMMA_DISTRIBUTION_CORNERS(double, 1.0)
+        break;
+    case GAMMA_STORAGE_F32:
+        GAMMA_DISTRIBUTION_CORNERS(float, 1.0)
+        break;
+    case GAMMA_STORAGE_U16:
+        GAMMA_DISTRIBUTION_CORNERS(uint16_t, dist->scale)
+        break;
+    case GAMMA_STORAGE_U32:
+        GAMMA_DISTRIBUTION_CORNERS(uint32_t, dist->scale)
+        break;
+    }
+
+#undef GAMMA_DISTRIBUTION_CORNERS
+}
+
+
+/** @brief Transform physical coordinates into pixel coordinates
+ *  @param dist
+ *      Distribution
+ *  @param pos
+ *      Physical coordinates
+ *  @returns The pixel coordinates of @p pos
+ */
+static gamma_vec_t gamma_distribution_pixel(const struct gamma_distribution *dist,
+                                            const gamma_vec_t               *pos)
+{
+    const gamma_mat_t *inv = &dist->inverse;
+
+    if (!dist->axial) {
+        return gamma_matmul_mv(inv, pos);
+    }
+    return (const gamma_vec_t){{
+        inv->cols[0].vec[0] * pos->vec[0] + inv->cols[3].vec[0],
+        inv->cols[1].vec[1] * pos->vec[1] + inv->cols[3].vec[1],
+        inv->cols[2].vec[2] * pos->vec[2] + inv->cols[3].vec[2],
+        pos->vec[3]
+    }};
+}
+
+
+double gamma_distribution_sample(const struct gamma_distribution *dist,
+                                 const gamma_vec_t               *offs)
+{
+    struct gamma_interp interp;
+    gamma_vec_t frac = *offs;
+    gamma_idx_t lat;
+
+    gamma_distribution_modf(&frac, &lat);
+    gamma_distribution_corners(dist, &interp, &lat);
+    return gamma_interp_single(&interp, &frac);
 }
 
 
 double gamma_distribution_interp(const struct gamma_distribution *dist,
                                  const gamma_vec_t               *pos)
 {
-    struct gamma_interp interp;
     gamma_vec_t offs;
+
+    offs = gamma_distribution_pixel(dist, pos);
+    return gamma_distribution_sample(dist, &offs);
+}
+
+
+#if defined(GAMMA_AVX2)
+
+/** @brief Transform four physical coordinates into pixel coordinates along one
+ *      lattice axis
+ *  @param dist
+ *      Distribution
+ *  @param axis
+ *      Lattice axis
+ *  @param x
+ *      First physical components
+ *  @param y
+ *      Second physical components
+ *  @param z
+ *      Third physical components
+ *  @returns The pixel coordinates
+ */
+static __m256d gamma_distribution_axis4(const struct gamma_distribution *dist,
+                                        int                              axis,
+                                        __m256d                          x,
+                                        __m256d                          y,
+                                        __m256d                          z)
+{
+    const gamma_mat_t *inv = &dist->inverse;
+    __m256d res;
+
+    if (dist->axial) {
+        res = axis == 0 ? x : axis == 1 ? y : z;
+        res = _mm256_mul_pd(_mm256_set1_pd(inv->cols[axis].vec[axis]), res);
+        return _mm256_add_pd(res, _mm256_set1_pd(inv->cols[3].vec[axis]));
+    }
+    res = _mm256_mul_pd(_mm256_set1_pd(inv->cols[0].vec[axis]), x);
+    res = _mm256_fmadd_pd(_mm256_set1_pd(inv->cols[1].vec[axis]), y, res);
+    res = _mm256_fmadd_pd(_mm256_set1_pd(inv->cols[2].vec[axis]), z, res);
+    return _mm256_add_pd(res, _mm256_set1_pd(inv->cols[3].vec[axis]));
+}
+
+
+#if defined(GAMMA_COUNTERS)
+
+/** @brief Count the set bits of a four-lane mask */
+static int gamma_distribution_popcount4(int mask)
+{
+    return (mask & 1) + (mask >> 1 & 1) + (mask >> 2 & 1) + (mask >> 3 & 1);
+}
+
+#endif
+
+
+/** @brief Gather four pixel values of any storage type as doubles
+ *  @param dist
+ *      Distribution
+ *  @param idx
+ *      Indices into the main buffer
+ *  @param mask
+ *      Lanes to gather, each all ones or all zeros
+ *  @returns The values, or zero in each lane not gathered
+ */
+static __m256d gamma_distribution_gather4(const struct gamma_distribution *dist,
+                                          __m256i                          idx,
+                                          __m128i                          mask)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i vals, shift;
+    const char *base;
+    __m256i offs;
+
+    switch (dist->storage) {
+    case GAMMA_STORAGE_F64:
+    default:
+        return _mm256_mask_i64gather_pd(
+            _mm256_setzero_pd(), dist->data, idx,
+            _mm256_castsi256_pd(_mm256_cvtepi32_epi64(mask)), sizeof (double));
+    case GAMMA_STORAGE_F32:
+        return _mm256_cvtps_pd(_mm256_mask_i64gather_ps(
+            _mm_setzero_ps(), dist->data, idx, _mm_castsi128_ps(mask),
+            sizeof (float)));
+    case GAMMA_STORAGE_U32:
+        /* Bias into the signed range, which converts exactly */
+        vals = _mm256_mask_i64gather_epi32(zero, dist->data, idx, mask,
+                                           sizeof (uint32_t));
+        vals = _mm_xor_si128(vals, _mm_set1_epi32(INT32_MIN));
+        return _mm256_mul_pd(
+            _mm256_add_pd(_mm256_cvtepi32_pd(vals), _mm256_set1_pd(0x1p31)),
+            _mm256_set1_pd(dist->scale));
+    case GAMMA_STORAGE_U16:
+        /* There is no 16-bit gather, so gather the aligned 32-bit words
+           holding the values, which never cross a page, and shift each value
+           down out of its word */
+        base = (const char *)((uintptr_t)dist->data & ~(uintptr_t)3);
+        offs = _mm256_add_epi64(_mm256_add_epi64(idx, idx),
+                                _mm256_set1_epi64x((uintptr_t)dist->data & 3));
+        shift = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+            _mm256_slli_epi64(_mm256_and_si256(offs, _mm256_set1_epi64x(2)), 3),
+            _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+        offs = _mm256_andnot_si256(_mm256_set1_epi64x(3), offs);
+        vals = _mm256_mask_i64gather_epi32(zero, (const int *)base, offs, mask,
+                                           1);
+        vals = _mm_and_si128(_mm_srlv_epi32(vals, shift),
+                             _mm_set1_epi32(0xffff));
+        return _mm256_mul_pd(_mm256_cvtepi32_pd(vals),
+                             _mm256_set1_pd(dist->scale));
+    }
+}
+
+
+/** @brief Check whether four lattice indices are all the same
+ *  @param lat
+ *      Lattice indices along each axis
+ *  @param idx
+ *      Index to compare against, or NULL to compare against the first lane
+ */
+static bool gamma_distribution_same4(const __m128i      lat[3],
+                                     const gamma_idx_t *idx)
+{
+    __m128i same = _mm_set1_epi32(-1), cmp;
+    int axis;
+
+    for (axis = 0; axis < 3; axis++) {
+        cmp = idx ? _mm_set1_epi32(idx->idx[axis])
+                  : _mm_shuffle_epi32(lat[axis], 0);
+        same = _mm_and_si128(same, _mm_cmpeq_epi32(lat[axis], cmp));
+    }
+    return _mm_movemask_ps(_mm_castsi128_ps(same)) == 0xf;
+}
+
+
+/** @brief Reduce the corner values of four cells, as `gamma_interp_single`
+ *  @param vals
+ *      Corner values, which are overwritten
+ *  @param frac
+ *      Unit pixel offsets into the cells
+ *  @returns The four interpolated values
+ */
+static __m256d gamma_distribution_lerp4(__m256d       vals[8],
+                                        const __m256d frac[3])
+{
+    int c;
+
+    /* As lerps along z, y, then x */
+    for (c = 0; c < 4; c++) {
+        vals[c] = _mm256_fmadd_pd(_mm256_sub_pd(vals[c + 4], vals[c]),
+                                  frac[2], vals[c]);
+    }
+    for (c = 0; c < 2; c++) {
+        vals[c] = _mm256_fmadd_pd(_mm256_sub_pd(vals[c + 2], vals[c]),
+                                  frac[1], vals[c]);
+    }
+    return _mm256_fmadd_pd(_mm256_sub_pd(vals[1], vals[0]), frac[0], vals[0]);
+}
+
+
+/** @brief Interpolate four values at pixel coordinates
+ *  @param dist
+ *      Dose distribution
+ *  @param cell
+ *      Cached cell to read the corners from if all four points lie in it,
+ *      and to replace if all four lie in another, or NULL
+ *  @param offs
+ *      Pixel coordinates along each lattice axis
+ *  @returns The four interpolated values, with zero wherever a corner was out
+ *      of bounds
+ */
+static __m256d gamma_distribution_sample4(const struct gamma_distribution *dist,
+                                          struct gamma_cell               *cell,
+                                          const __m256d                    offs[3])
+{
+    const __m128i neg1 = _mm_set1_epi32(-1), neg2 = _mm_set1_epi32(-2);
+    const __m256i step[3] = {
+        _mm256_set1_epi64x(dist->strides[0]),
+        _mm256_set1_epi64x(dist->strides[1]),
+        _mm256_set1_epi64x(dist->strides[2]),
+    };
+    __m256d frac[3], vals[8];
+    __m128i lat[3], lo[3], hi[3], dim;
+    __m128i mask;
+    __m256i base, gather;
+    int axis, c;
+
+    for (axis = 0; axis < 3; axis++) {
+        frac[axis] = _mm256_floor_pd(offs[axis]);
+        lat[axis] = _mm256_cvttpd_epi32(frac[axis]);
+        frac[axis] = _mm256_sub_pd(offs[axis], frac[axis]);
+    }
+    if (cell && cell->valid && gamma_distribution_same4(lat, &cell->lat)) {
+        for (c = 0; c < 8; c++) {
+            vals[c] = _mm256_broadcast_sd(&cell->interp.buf[c]);
+        }
+        return gamma_distribution_lerp4(vals, frac);
+    }
+
+    for (axis = 0; axis < 3; axis++) {
+        dim = _mm_set1_epi32(dist->dims.idx[axis]);
+        lo[axis] = _mm_and_si128(_mm_cmpgt_epi32(lat[axis], neg1),
+                                 _mm_cmplt_epi32(lat[axis], dim));
+        hi[axis] = _mm_and_si128(_mm_cmpgt_epi32(lat[axis], neg2),
+                                 _mm_cmplt_epi32(lat[axis],
+                                                 _mm_add_epi32(dim, neg1)));
+    }
+
+    /* The strides fit 32 bits, so each product is a signed 32-bit multiply */
+    base = _mm256_mul_epi32(_mm256_cvtepi32_epi64(lat[0]), step[0]);
+    base = _mm256_add_epi64(base, _mm256_mul_epi32(_mm256_cvtepi32_epi64(lat[1]),
+                                                   step[1]));
+    base = _mm256_add_epi64(base, _mm256_mul_epi32(_mm256_cvtepi32_epi64(lat[2]),
+                                                   step[2]));
+
+    for (c = 0; c < 8; c++) {
+        gather = base;
+        gather = (c & 1) ? _mm256_add_epi64(gather, step[0]) : gather;
+        gather = (c & 2) ? _mm256_add_epi64(gather, step[1]) : gather;
+        gather = (c & 4) ? _mm256_add_epi64(gather, step[2]) : gather;
+        mask = _mm_and_si128(_mm_and_si128((c & 1) ? hi[0] : lo[0],
+                                           (c & 2) ? hi[1] : lo[1]),
+                             (c & 4) ? hi[2] : lo[2]);
+        GAMMA_COUNT(oob, 4 - gamma_distribution_popcount4(
+                                 _mm_movemask_ps(_mm_castsi128_ps(mask))));
+        vals[c] = gamma_distribution_gather4(dist, gather, mask);
+    }
+
+    if (cell && gamma_distribution_same4(lat, NULL)) {
+        for (c = 0; c < 8; c++) {
+            cell->interp.buf[c] = _mm256_cvtsd_f64(vals[c]);
+        }
+        for (axis = 0; axis < 3; axis++) {
+            cell->lat.idx[axis] = _mm_cvtsi128_si32(lat[axis]);
+        }
+        cell->valid = true;
+    }
+    return gamma_distribution_lerp4(vals, frac);
+}
+
+#endif /* GAMMA_AVX2 */
+
+
+/** @brief Interpolate a value at pixel coordinates through a cached cell, as
+ *      `gamma_distribution_sample`
+ *  @param dist
+ *      Dose distribution
+ *  @param cell
+ *      Cached cell to read the corners from if the point lies in it, and to
+ *      replace otherwise
+ *  @param offs
+ *      Pixel coordinates
+ *  @returns The interpolated value
+ */
+static double gamma_distribution_sample_cell(const struct gamma_distribution *dist,
+                                             struct gamma_cell               *cell,
+                                             const gamma_vec_t               *offs)
+{
+    gamma_vec_t frac = *offs;
     gamma_idx_t lat;
 
-    offs = gamma_matmul_mv(&dist->inverse, pos);
-    gamma_distribution_modf(&offs, &lat);
-    gamma_distribution_corners(dist, &interp, &lat);
-    return gamma_interp_single(&interp, &offs);
+    gamma_distribution_modf(&frac, &lat);
+    if (!cell->valid || lat.idx[0] != cell->lat.idx[0]
+     || lat.idx[1] != cell->lat.idx[1] || lat.idx[2] != cell->lat.idx[2]) {
+        gamma_distribution_corners(dist, &cell->interp, &lat);
+        cell->lat = lat;
+        cell->valid = true;
+    }
+    return gamma_interp_single(&cell->interp, &frac);
+}
+
+
+/** @brief Interpolate many values at once at either physical or pixel
+ *      coordinates
+ *  @param dist
+ *      Dose distribution
+ *  @param cell
+ *      Cached cell to interpolate through, or NULL
+ *  @param len
+ *      Point count
+ *  @param pos
+ *      Coordinates as a structure of arrays
+ *  @param pixel
+ *      true if @p pos are pixel coordinates, false if they are physical
+ *  @param[out] res
+ *      Receives the @p len dose values
+ */
+static void gamma_distribution_lookupn(const struct gamma_distribution *dist,
+                                       struct gamma_cell               *cell,
+                                       size_t                           len,
+                                       const gamma_scal_t *const        pos[3],
+                                       bool                             pixel,
+                                       double                          *res)
+{
+    gamma_vec_t vec;
+    size_t i = 0;
+
+#if defined(GAMMA_AVX2)
+    __m256d x, y, z, offs[3];
+    int axis;
+
+    for (; i + 4 <= len; i += 4) {
+        x = _mm256_loadu_pd(pos[0] + i);
+        y = _mm256_loadu_pd(pos[1] + i);
+        z = _mm256_loadu_pd(pos[2] + i);
+        for (axis = 0; axis < 3; axis++) {
+            offs[axis] = pixel ? (axis == 0 ? x : axis == 1 ? y : z)
+                               : gamma_distribution_axis4(dist, axis, x, y, z);
+        }
+        _mm256_storeu_pd(res + i, gamma_distribution_sample4(dist, cell, offs));
+    }
+#endif
+    for (; i < len; i++) {
+        vec = (const gamma_vec_t){{ pos[0][i], pos[1][i], pos[2][i], 1 }};
+        if (cell) {
+            vec = pixel ? vec : gamma_distribution_pixel(dist, &vec);
+            res[i] = gamma_distribution_sample_cell(dist, cell, &vec);
+        } else {
+            res[i] = pixel ? gamma_distribution_sample(dist, &vec)
+                           : gamma_distribution_interp(dist, &vec);
+        }
+    }
+}
+
+
+void gamma_distribution_interpn(const struct gamma_distribution *dist,
+                                size_t                           len,
+                                const gamma_scal_t *const        pos[3],
+                                double                          *res)
+{
+    gamma_distribution_lookupn(dist, NULL, len, pos, false, res);
+}
+
+
+void gamma_distribution_interpn_cell(const struct gamma_distribution *dist,
+                                     struct gamma_cell               *cell,
+                                     size_t                           len,
+                                     const gamma_scal_t *const        pos[3],
+                                     double                          *res)
+{
+    gamma_distribution_lookupn(dist, cell, len, pos, false, res);
+}
+
+
+void gamma_distribution_samplen(const struct gamma_distribution *dist,
+                                size_t                           len,
+                                const gamma_scal_t *const        offs[3],
+                                double                          *res)
+{
+    gamma_distribution_lookupn(dist, NULL, len, offs, true, res);
+}
+
+
+/** @brief Find the range of lattice indices along an axis within a ball
+ *  @param dist
+ *      Distribution
+ *  @param ctr
+ *      Center of the ball in pixel coordinates
+ *  @param radius
+ *      Radius of the ball in physical units
+ *  @param axis
+ *      Lattice axis
+ *  @param[out] first
+ *      Receives the first index, clamped to the distribution
+ *  @param[out] last
+ *      Receives the last index, clamped to the distribution
+ *  @returns true if the ball also reaches outside of the distribution
+ */
+static bool gamma_distribution_span(const struct gamma_distribution *dist,
+                                    const gamma_vec_t               *ctr,
+                                    gamma_scal_t                     radius,
+                                    int                              axis,
+                                    gamma_iscal_t                   *first,
+                                    gamma_iscal_t                   *last)
+{
+    const gamma_vec_t row = {{
+        dist->inverse.cols[0].vec[axis],
+        dist->inverse.cols[1].vec[axis],
+        dist->inverse.cols[2].vec[axis],
+        0
+    }};
+    const gamma_scal_t ext = radius * sqrt(gamma_vec_dp(&row, &row));
+    const gamma_scal_t lo = floor(ctr->vec[axis] - ext);
+    const gamma_scal_t hi = ceil(ctr->vec[axis] + ext);
+    const gamma_scal_t top = dist->dims.idx[axis] - 1;
+
+    *first = (gamma_iscal_t)fmin(fmax(lo, 0.0), top + 1);
+    *last = (gamma_iscal_t)fmax(fmin(hi, top), -1.0);
+    return lo < 0.0 || hi > top;
+}
+
+
+void gamma_distribution_bounds(const struct gamma_distribution *dist,
+                               const gamma_vec_t               *pos,
+                               gamma_scal_t                     radius,
+                               double                          *lo,
+                               double                          *hi)
+{
+    gamma_iscal_t first[3], last[3], i, j, k;
+    gamma_vec_t ctr;
+    bool outside;
+    ptrdiff_t n;
+
+    ctr = gamma_distribution_pixel(dist, pos);
+    outside = gamma_distribution_span(dist, &ctr, radius, 0, &first[0], &last[0]);
+    outside |= gamma_distribution_span(dist, &ctr, radius, 1, &first[1], &last[1]);
+    outside |= gamma_distribution_span(dist, &ctr, radius, 2, &first[2], &last[2]);
+    *lo = outside ? 0.0 : HUGE_VAL;
+    *hi = outside ? 0.0 : -HUGE_VAL;
+    for (k = first[2]; k <= last[2]; k++) {
+        for (j = first[1]; j <= last[1]; j++) {
+            n = gamma_distribution_offset(dist, first[0], j, k);
+            for (i = first[0]; i <= last[0]; i++, n += dist->strides[0]) {
+                *lo = fmin(*lo, gamma_distribution_value(dist, n));
+                *hi = fmax(*hi, gamma_distribution_value(dist, n));
+            }
+        }
+    }
+}
+
+
+/** @brief Find a row, or a part of one
+ *  @param dist
+ *      Distribution
+ *  @param[out] row
+ *      Receives the row
+ *  @param first
+ *      First column of the row
+ *  @param last
+ *      One past the last column of the row
+ *  @param j
+ *      Index of the row along the second lattice axis
+ *  @param k
+ *      Index of the row along the third lattice axis
+ */
+static void gamma_distribution_row(const struct gamma_distribution *dist,
+                                   struct gamma_distribution_row   *row,
+                                   gamma_iscal_t                    first,
+                                   gamma_iscal_t                    last,
+                                   gamma_iscal_t                    j,
+                                   gamma_iscal_t                    k)
+{
+    row->lat = (const gamma_idx_t){{ first, j, k, 0 }};
+    row->start = (const gamma_vec_t){{ 0, j, k, 1 }};
+    row->start = gamma_matmul_mv(&dist->matrix, &row->start);
+    row->step = dist->matrix.cols[0];
+    row->len = (size_t)(last - first);
+    row->idx = first + dist->dims.idx[0] * (j + (size_t)dist->dims.idx[1] * k);
+    row->offs = gamma_distribution_offset(dist, first, j, k);
+    row->dist = dist;
 }
 
 
@@ -139,21 +761,100 @@ void gamma_distribution_foreach(const struct gamma_distribution *dist,
                                 gamma_distribution_iterfn_t     *func,
                                 void                            *data)
 {
-    gamma_iscal_t i, j, k;
+    struct gamma_distribution_row row;
+    gamma_iscal_t j, k;
     gamma_vec_t pos;
-    size_t n = 0;
+    gamma_idx_t lat;
+    size_t i;
+
+    for (k = 0; k < dist->dims.idx[2]; k++) {
+        for (j = 0; j < dist->dims.idx[1]; j++) {
+            gamma_distribution_row(dist, &row, 0, dist->dims.idx[0], j, k);
+            lat = row.lat;
+            for (i = 0; i < row.len; i++, lat.idx[0]++) {
+                pos = gamma_distribution_row_pos(&row, i);
+                func(&pos, &lat, gamma_distribution_row_dose(&row, i), row.idx + i,
+                     data);
+            }
+        }
+    }
+}
+
+
+void gamma_distribution_foreach_row(const struct gamma_distribution *dist,
+                                    gamma_distribution_rowfn_t      *func,
+                                    void                            *data)
+{
+    const gamma_idx_t zero = { 0 };
+
+    gamma_distribution_foreach_box(dist, &zero, &dist->dims, func, data);
+}
+
+
+void gamma_distribution_foreach_box(const struct gamma_distribution *dist,
+                                    const gamma_idx_t               *lo,
+                                    const gamma_idx_t               *hi,
+                                    gamma_distribution_rowfn_t      *func,
+                                    void                            *data)
+{
+    struct gamma_distribution_row row;
+    gamma_iscal_t j, k;
+
+    for (k = lo->idx[2]; k < hi->idx[2]; k++) {
+        for (j = lo->idx[1]; j < hi->idx[1]; j++) {
+            gamma_distribution_row(dist, &row, lo->idx[0], hi->idx[0], j, k);
+            func(&row, data);
+        }
+    }
+}
+
+
+gamma_vec_t gamma_distribution_pos(const struct gamma_distribution *dist,
+                                   size_t                           idx)
+{
+    const size_t rows = idx / dist->dims.idx[0];
+    struct gamma_distribution_row row;
+
+    gamma_distribution_row(dist, &row, 0, dist->dims.idx[0],
+                           (gamma_iscal_t)(rows % dist->dims.idx[1]),
+                           (gamma_iscal_t)(rows / dist->dims.idx[1]));
+    return gamma_distribution_row_pos(&row, idx % dist->dims.idx[0]);
+}
+
+
+bool gamma_distribution_crop(const struct gamma_distribution *dist,
+                             double                           thrsh,
+                             gamma_idx_t                     *lo,
+                             gamma_idx_t                     *hi)
+{
+    gamma_iscal_t lo0 = INT32_MAX, lo1 = INT32_MAX, lo2 = INT32_MAX;
+    gamma_iscal_t hi0 = 0, hi1 = 0, hi2 = 0;
+    gamma_iscal_t i, j, k, first, last;
+    ptrdiff_t base;
 
-#if defined(_OPENMP) && _OPENMP
-#   pragma omp parallel for private(pos, n) collapse(3)
-#endif
     for (k = 0; k < dist->dims.idx[2]; k++) {
         for (j = 0; j < dist->dims.idx[1]; j++) {
+            base = gamma_distribution_offset(dist, 0, j, k);
+            first = -1;
+            last = -1;
             for (i = 0; i < dist->dims.idx[0]; i++) {
-                pos = (const gamma_vec_t){{ i, j, k, 1 }};
-                pos = gamma_matmul_mv(&dist->matrix, &pos);
-                n = i + dist->dims.idx[0] * (j + dist->dims.idx[1] * k);
-                func(&pos, dist->data[n], n, data);
+                if (gamma_distribution_value(dist, base + i * dist->strides[0])
+                    >= thrsh) {
+                    first = first < 0 ? i : first;
+                    last = i;
+                }
+            }
+            if (first >= 0) {
+                lo0 = first < lo0 ? first : lo0;
+                hi0 = last + 1 > hi0 ? last + 1 : hi0;
+                lo1 = j < lo1 ? j : lo1;
+                hi1 = j + 1 > hi1 ? j + 1 : hi1;
+                lo2 = k < lo2 ? k : lo2;
+                hi2 = k + 1 > hi2 ? k + 1 : hi2;
             }
         }
     }
+    *lo = (const gamma_idx_t){{ lo0, lo1, lo2, 0 }};
+    *hi = (const gamma_idx_t){{ hi0, hi1, hi2, 1 }};
+    return lo0 < hi0;
 }
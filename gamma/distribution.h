@@ -4,22 +4,41 @@
 #define GAMMA_DISTRIBUTION_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "common.h"
 #include "mat.h"
 #include "idx.h"
+#include "interp.h"
 
 EXTERN_C_BEGIN
 
 
+/** @brief Storage types of pixel data */
+typedef enum gamma_storage {
+    GAMMA_STORAGE_F64,  /* double */
+    GAMMA_STORAGE_F32,  /* float */
+    GAMMA_STORAGE_U16,  /* uint16_t, in units of the scale */
+    GAMMA_STORAGE_U32,  /* uint32_t, in units of the scale */
+} gamma_storage_t;
+
+
 /** @brief All of the information needed for a dose distribution embedded in R3
  */
 struct gamma_distribution {
-    gamma_mat_t matrix;     /* Pixel-to-physical affine transformation */
-    gamma_mat_t inverse;    /* Physical-to-pixelspace inverse transform */
-    gamma_idx_t dims;       /* Pixel dimensions */
-    size_t      len;        /* Pixel count */
-    double      max;        /* Maximum pixel value */
-    double     *data;       /* Pixel data */
+    gamma_mat_t     matrix;     /* Pixel-to-physical affine transformation */
+    gamma_mat_t     inverse;    /* Physical-to-pixelspace inverse transform */
+    bool            axial;      /* The transformations only scale and translate
+                                   each axis independently */
+    gamma_idx_t     dims;       /* Pixel dimensions */
+    size_t          len;        /* Pixel count */
+    double          max;        /* Maximum pixel value */
+    gamma_storage_t storage;    /* Storage type of the pixel data */
+    double          scale;      /* Dose per unit of integer storage */
+    ptrdiff_t       strides[3]; /* Elements from each pixel to the next along
+                                   each axis, which may be negative */
+    bool            dense;      /* The strides are those of a dense buffer
+                                   whose first axis varies fastest */
+    void           *data;       /* Pixel zero */
 };
 
 
@@ -34,6 +53,9 @@ struct gamma_distribution {
  *  @param data
  *      Pixel data
  *  @returns true on success, false if @p matr is singular
+ *  @note If @p matr is diagonal but for its translation, then its inverse is
+ *      found directly and the distribution is flagged axial, so that lookups
+ *      can scale and offset each axis on its own
  *  @note Each pointer may address the relevant member in @p dist without any
  *      pernicious effects
  */
@@ -43,6 +65,90 @@ bool gamma_distribution_set(struct gamma_distribution *dist,
                             double                    *data);
 
 
+/** @brief Initialize the distribution over pixel data of any storage type and
+ *      layout, as `gamma_distribution_set` does over a dense buffer of doubles
+ *  @param dist
+ *      Distribution
+ *  @param matr
+ *      Affine matrix
+ *  @param dims
+ *      Pixel dimensions
+ *  @param storage
+ *      Storage type of @p data
+ *  @param scale
+ *      Dose per unit of integer storage, which must be positive. It is
+ *      ignored for floating storage
+ *  @param strides
+ *      Elements from each pixel to the next along each axis, which may be
+ *      negative and whose magnitudes must fit a pixel index, or NULL if the
+ *      buffer is dense with its first axis varying fastest
+ *  @param data
+ *      Pixel zero, which must be aligned for the storage type
+ *  @returns true on success, false if @p matr is singular or a stride is out
+ *      of range
+ *  @note Every lookup converts values to double as it reads them, so that a
+ *      compact type cuts the memory traffic of the reference gathers without
+ *      changing how the results are computed
+ *  @note Any layout works, e.g. a C-ordered array, a Fortran-ordered one or a
+ *      view sliced from either, but the scans of the distribution run along
+ *      its first axis, so it is fastest if that axis has the smallest stride
+ */
+bool gamma_distribution_set_storage(struct gamma_distribution *dist,
+                                    const gamma_mat_t         *matr,
+                                    const gamma_idx_t         *dims,
+                                    gamma_storage_t            storage,
+                                    double                     scale,
+                                    const ptrdiff_t           *strides,
+                                    void                      *data);
+
+
+/** @brief Find the element offset of a pixel from pixel zero
+ *  @param dist
+ *      Distribution
+ *  @param i
+ *      Index along the first axis
+ *  @param j
+ *      Index along the second axis
+ *  @param k
+ *      Index along the third axis
+ *  @returns The offset, in elements of the storage type
+ *  @warning This function does no bounds checks
+ */
+GAMMA_INLINE ptrdiff_t
+gamma_distribution_offset(const struct gamma_distribution *dist,
+                          ptrdiff_t                        i,
+                          ptrdiff_t                        j,
+                          ptrdiff_t                        k)
+{
+    return i * dist->strides[0] + j * dist->strides[1] + k * dist->strides[2];
+}
+
+
+/** @brief Read a pixel value
+ *  @param dist
+ *      Distribution
+ *  @param offs
+ *      Element offset of the pixel, as from `gamma_distribution_offset`,
+ *      which must be in bounds
+ *  @returns The dose value of the pixel
+ */
+GAMMA_INLINE double
+gamma_distribution_value(const struct gamma_distribution *dist, ptrdiff_t offs)
+{
+    switch (dist->storage) {
+    case GAMMA_STORAGE_F32:
+        return ((const float *)dist->data)[offs];
+    case GAMMA_STORAGE_U16:
+        return dist->scale * ((const uint16_t *)dist->data)[offs];
+    case GAMMA_STORAGE_U32:
+        return dist->scale * ((const uint32_t *)dist->data)[offs];
+    case GAMMA_STORAGE_F64:
+    default:
+        return ((const double *)dist->data)[offs];
+    }
+}
+
+
 /** @brief Get a value
  *  @param dist
  *      Distribution
@@ -66,18 +172,128 @@ double gamma_distribution_interp(const struct gamma_distribution *dist,
                                  const gamma_vec_t               *pos);
 
 
+/** @brief Interpolate a value at pixel coordinates
+ *  @param dist
+ *      Dose distribution
+ *  @param offs
+ *      Real-valued pixel coordinates to interpolate data from, e.g. as found by
+ *      a transformation composed ahead of time
+ *  @returns The dose value at @p offs or zero if it was out of bounds. This
+ *      function does not fail
+ */
+double gamma_distribution_sample(const struct gamma_distribution *dist,
+                                 const gamma_vec_t               *offs);
+
+
+/** @brief Interpolate many values at once. This uses vector gathers when they
+ *      are available and is otherwise equivalent to calling
+ *      `gamma_distribution_interp` for each point
+ *  @param dist
+ *      Dose distribution
+ *  @param len
+ *      Point count
+ *  @param pos
+ *      Physical coordinates as a structure of arrays, i.e. three arrays each
+ *      holding @p len values of one component
+ *  @param[out] res
+ *      Receives the @p len dose values, or zero for any point out of bounds
+ */
+void gamma_distribution_interpn(const struct gamma_distribution *dist,
+                                size_t                           len,
+                                const gamma_scal_t *const        pos[3],
+                                double                          *res);
+
+
+/** @brief A cached lattice cell, which keeps the corner values that a local
+ *      search would otherwise gather again and again
+ */
+struct gamma_cell {
+    struct gamma_interp interp; /* Corner values */
+    gamma_idx_t         lat;    /* Lattice index of the first corner */
+    bool                valid;  /* The corners are set */
+};
+
+
+/** @brief Interpolate many values at once through a cached cell. Groups of
+ *      points that all lie in the cell are evaluated without any gathers, and
+ *      a group that all lies in another cell replaces it
+ *  @param dist
+ *      Dose distribution
+ *  @param[in, out] cell
+ *      Cached cell, whose `valid` must be false at first
+ *  @param len
+ *      Point count
+ *  @param pos
+ *      Physical coordinates as a structure of arrays
+ *  @param[out] res
+ *      Receives the @p len dose values, or zero for any point out of bounds
+ *  @note The cached corners are reduced exactly as fresh ones would be, so the
+ *      values are those of `gamma_distribution_interpn`, whatever the cell
+ *      held. With vector gathers a group of four is cached only if all four
+ *      lie in one cell, and without them each point is
+ */
+void gamma_distribution_interpn_cell(const struct gamma_distribution *dist,
+                                     struct gamma_cell               *cell,
+                                     size_t                           len,
+                                     const gamma_scal_t *const        pos[3],
+                                     double                          *res);
+
+
+/** @brief Interpolate many values at pixel coordinates at once. This is to
+ *      `gamma_distribution_sample` as `gamma_distribution_interpn` is to
+ *      `gamma_distribution_interp`
+ *  @param dist
+ *      Dose distribution
+ *  @param len
+ *      Point count
+ *  @param offs
+ *      Pixel coordinates as a structure of arrays
+ *  @param[out] res
+ *      Receives the @p len dose values, or zero for any point out of bounds
+ */
+void gamma_distribution_samplen(const struct gamma_distribution *dist,
+                                size_t                           len,
+                                const gamma_scal_t *const        offs[3],
+                                double                          *res);
+
+
+/** @brief Bound the interpolated values within a ball
+ *  @param dist
+ *      Dose distribution
+ *  @param pos
+ *      Physical coordinates of the center of the ball
+ *  @param radius
+ *      Radius of the ball in physical units
+ *  @param[out] lo
+ *      Receives a lower bound on every value interpolated within the ball
+ *  @param[out] hi
+ *      Receives an upper bound on every value interpolated within the ball
+ *  @note The bounds are the extreme values of the lattice points enclosing the
+ *      ball, so their cost grows with the cube of @p radius in pixels
+ */
+void gamma_distribution_bounds(const struct gamma_distribution *dist,
+                               const gamma_vec_t               *pos,
+                               gamma_scal_t                     radius,
+                               double                          *lo,
+                               double                          *hi);
+
+
 /** @brief Iterator callback
  *  @param pos
  *      Physical coordinates of this dose value
+ *  @param lat
+ *      Pixel coordinates of this dose value
  *  @param dose
  *      This dose value
  *  @param idx
- *      The index of this dose value in the main buffer
+ *      The index of this dose value in a dense buffer of the distribution,
+ *      whose first axis varies fastest
  *  @param data
  *      Your callback data
  *  @return true to continue, false to stop iterating
  */
 typedef void gamma_distribution_iterfn_t(const gamma_vec_t *pos,
+                                         const gamma_idx_t *lat,
                                          double             dose,
                                          size_t             idx,
                                          void              *data);
@@ -96,6 +312,135 @@ void gamma_distribution_foreach(const struct gamma_distribution *dist,
                                 void                            *data);
 
 
+/** @brief A single row of a distribution, i.e. a run of voxels along the first
+ *      lattice axis
+ */
+struct gamma_distribution_row {
+    gamma_vec_t                      start; /* Physical coordinates of column
+                                               zero of the row, whether or not
+                                               the row includes it */
+    gamma_vec_t                      step;  /* Physical displacement from one
+                                               voxel to the next, i.e. the
+                                               first column of the affine
+                                               matrix */
+    gamma_idx_t                      lat;   /* Pixel coordinates of the first
+                                               voxel */
+    size_t                           len;   /* Voxel count */
+    size_t                           idx;   /* Index of the first voxel in a
+                                               dense buffer of the
+                                               distribution, e.g. of results */
+    ptrdiff_t                        offs;  /* Element offset of the first
+                                               voxel in the pixel data */
+    const struct gamma_distribution *dist;  /* Distribution of the row */
+};
+
+
+/** @brief Find the physical coordinates of a voxel in a row
+ *  @param row
+ *      Row
+ *  @param i
+ *      Voxel offset into @p row
+ *  @returns The physical coordinates
+ */
+GAMMA_INLINE gamma_vec_t
+gamma_distribution_row_pos(const struct gamma_distribution_row *row, size_t i)
+{
+    return gamma_vec_fmadds(&row->step, (gamma_scal_t)(row->lat.idx[0] + i),
+                            &row->start);
+}
+
+
+/** @brief Read the dose value of a voxel in a row
+ *  @param row
+ *      Row
+ *  @param i
+ *      Voxel offset into @p row
+ *  @returns The dose value
+ */
+GAMMA_INLINE double
+gamma_distribution_row_dose(const struct gamma_distribution_row *row, size_t i)
+{
+    return gamma_distribution_value(
+        row->dist, row->offs + (ptrdiff_t)i * row->dist->strides[0]);
+}
+
+
+/** @brief Row iterator callback
+ *  @param row
+ *      The row
+ *  @param data
+ *      Your callback data
+ */
+typedef void gamma_distribution_rowfn_t(const struct gamma_distribution_row *row,
+                                        void                                *data);
+
+
+/** @brief Iterate over a distribution a row at a time. Each row start is found
+ *      once, and the voxels within it are reached by stepping along the first
+ *      matrix column
+ *  @param dist
+ *      Distribution
+ *  @param func
+ *      Row iterator function
+ *  @param data
+ *      Iterator function data
+ */
+void gamma_distribution_foreach_row(const struct gamma_distribution *dist,
+                                    gamma_distribution_rowfn_t      *func,
+                                    void                            *data);
+
+
+/** @brief Iterate over the rows of a box within a distribution, as
+ *      `gamma_distribution_foreach_row` does over the whole of it
+ *  @param dist
+ *      Distribution
+ *  @param lo
+ *      First pixel of the box
+ *  @param hi
+ *      One past the last pixel of the box along each axis. The box must lie
+ *      within the distribution
+ *  @param func
+ *      Row iterator function
+ *  @param data
+ *      Iterator function data
+ */
+void gamma_distribution_foreach_box(const struct gamma_distribution *dist,
+                                    const gamma_idx_t               *lo,
+                                    const gamma_idx_t               *hi,
+                                    gamma_distribution_rowfn_t      *func,
+                                    void                            *data);
+
+
+/** @brief Find the physical coordinates of a voxel exactly as the row
+ *      iterators do
+ *  @param dist
+ *      Distribution
+ *  @param idx
+ *      Index of the voxel in a dense buffer of the distribution
+ *  @returns The physical coordinates of voxel @p idx
+ */
+gamma_vec_t gamma_distribution_pos(const struct gamma_distribution *dist,
+                                   size_t                           idx);
+
+
+/** @brief Find the bounding box of the values at or above a threshold
+ *  @param dist
+ *      Distribution
+ *  @param thrsh
+ *      Threshold
+ *  @param[out] lo
+ *      Receives the first pixel of the box
+ *  @param[out] hi
+ *      Receives one past the last pixel of the box along each axis
+ *  @returns true if any value is at or above @p thrsh, false if the box is
+ *      empty, in which case @p lo and @p hi are undefined
+ */
+bool gamma_distribution_crop(const struct gamma_distribution *dist,
+                             double                           thrsh,
+                             gamma_idx_t                     *lo,
+                             gamma_idx_t                     *hi);
+
+
 EXTERN_C_END
 
 #endif /* GAMMA_DISTRIBUTION_H */
@@ -0,0 +1,124 @@
+#include <stdalign.h>
+#include <stdlib.h>
+#include <tgmath.h>
+#include "esearch.h"
+
+
+/** @brief Compare two offsets by squared norm, for qsort
+ *  @param a
+ *      Offset
+ *  @param b
+ *      Offset
+ *  @returns The ordering of @p a with respect to @p b
+ */
+static int gamma_offsets_compare(const void *a, const void *b)
+{
+    const struct gamma_pspair *lhs = a, *rhs = b;
+
+    return (lhs->val > rhs->val) - (lhs->val < rhs->val);
+}
+
+
+/** @brief Find the largest lattice coefficient reachable within a sphere
+ *  @param inverse
+ *      Inverse of the lattice basis
+ *  @param row
+ *      The coefficient's row in @p inverse
+ *  @param radius
+ *      Sphere radius
+ *  @returns The coefficient bound. By Cauchy-Schwarz, a displacement of norm
+ *      @p radius never has a coefficient larger than this
+ */
+static int gamma_offsets_bound(const gamma_mat_t *inverse,
+                               int                row,
+                               gamma_scal_t       radius)
+{
+    const gamma_vec_t rvec = {{
+        inverse->cols[0].vec[row],
+        inverse->cols[1].vec[row],
+        inverse->cols[2].vec[row],
+        0
+    }};
+
+    return (int)floor(radius * sqrt(gamma_vec_dp(&rvec, &rvec)));
+}
+
+
+bool gamma_offsets_init(struct gamma_offsets *offs,
+                        const gamma_mat_t    *lattice,
+                        gamma_scal_t          radius,
+                        int                   subdiv)
+{
+    const gamma_scal_t rsqr = gamma_sqr(radius);
+    gamma_mat_t basis, inverse;
+    int bound[3], i, j, k;
+    gamma_vec_t disp;
+    size_t cap;
+
+    offs->len = 0;
+    offs->offs = NULL;
+    subdiv = subdiv < 1 ? 1 : subdiv;
+    basis.cols[0] = gamma_vec_divs(&lattice->cols[0], subdiv);
+    basis.cols[1] = gamma_vec_divs(&lattice->cols[1], subdiv);
+    basis.cols[2] = gamma_vec_divs(&lattice->cols[2], subdiv);
+    basis.cols[3] = gamma_mat_identity.cols[3];
+    inverse = basis;
+    if (!gamma_mat_invert(&inverse)) {
+        return false;
+    }
+    bound[0] = gamma_offsets_bound(&inverse, 0, radius);
+    bound[1] = gamma_offsets_bound(&inverse, 1, radius);
+    bound[2] = gamma_offsets_bound(&inverse, 2, radius);
+
+    cap = (size_t)(2 * bound[0] + 1) * (2 * bound[1] + 1) * (2 * bound[2] + 1);
+    offs->offs = gamma_aligned_alloc(alignof (struct gamma_pspair),
+                                     sizeof *offs->offs * cap);
+    if (!offs->offs) {
+        return false;
+    }
+    for (k = -bound[2]; k <= bound[2]; k++) {
+        for (j = -bound[1]; j <= bound[1]; j++) {
+            for (i = -bound[0]; i <= bound[0]; i++) {
+                disp = gamma_vec_muls(&basis.cols[0], i);
+                disp = gamma_vec_fmadds(&basis.cols[1], j, &disp);
+                disp = gamma_vec_fmadds(&basis.cols[2], k, &disp);
+                offs->offs[offs->len].vec = disp;
+                offs->offs[offs->len].val = gamma_vec_dp(&disp, &disp);
+                offs->len += (i || j || k) && offs->offs[offs->len].val <= rsqr;
+            }
+        }
+    }
+    qsort(offs->offs, offs->len, sizeof *offs->offs, gamma_offsets_compare);
+    return true;
+}
+
+
+void gamma_offsets_destroy(struct gamma_offsets *offs)
+{
+    gamma_aligned_free(offs->offs);
+    offs->offs = NULL;
+    offs->len = 0;
+}
+
+
+void gamma_exhaustive_search(const struct gamma_offsets *offs,
+                             const struct gamma_psfunc  *func,
+                             struct gamma_pspair        *init)
+{
+    const gamma_vec_t origin = init->vec;
+    gamma_vec_t test;
+    gamma_scal_t val;
+    double aux;
+    size_t i;
+
+    for (i = 0; i < offs->len && offs->offs[i].val < init->val
+                             && !(init->val < func->accept); i++) {
+        test = gamma_vec_add(&origin, &offs->offs[i].vec);
+        val = func->func(&test, &aux, func->data);
+        if (val < init->val) {
+            init->vec = test;
+            init->val = val;
+            init->aux = aux;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef GAMMA_ESEARCH_H
+#define GAMMA_ESEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "mat.h"
+#include "psearch.h"
+
+
+/** @brief A list of displacement vectors, sorted by increasing norm */
+struct gamma_offsets {
+    size_t               len;   /* Offset count */
+    struct gamma_pspair *offs;  /* Displacements and their squared norms */
+};
+
+
+/** @brief Enumerate all lattice displacements within a sphere
+ *  @param offs
+ *      Offset list. This should not be managing any memory
+ *  @param lattice
+ *      Lattice basis. Only the first three columns are used, and these must be
+ *      displacement vectors (i.e. zero in the last position)
+ *  @param radius
+ *      Radius of the sphere
+ *  @param subdiv
+ *      Subdivisions of each lattice basis vector. Values less than one are
+ *      treated as one
+ *  @returns true on success, false if @p lattice is singular or memory could
+ *      not be allocated
+ *  @note The zero displacement is not included in the list
+ */
+bool gamma_offsets_init(struct gamma_offsets *offs,
+                        const gamma_mat_t    *lattice,
+                        gamma_scal_t          radius,
+                        int                   subdiv);
+
+
+/** @brief Release the memory held by an offset list
+ *  @param offs
+ *      Offset list
+ */
+void gamma_offsets_destroy(struct gamma_offsets *offs);
+
+
+/** @brief Minimize a function by walking an offset list outward from a point
+ *  @param offs
+ *      Offset list
+ *  @param func
+ *      Function to be minimized. The function must be bounded below by the
+ *      squared norm of the displacement. The bases are ignored
+ *  @param[in, out] init
+ *      Initial coordinates, function value and by-product, and where the
+ *      results are written
+ *  @note The walk stops as soon as the squared norm of the displacement alone
+ *      is no less than the best value found, so the result is the global
+ *      minimum over the offset list
+ */
+void gamma_exhaustive_search(const struct gamma_offsets *offs,
+                             const struct gamma_psfunc  *func,
+                             struct gamma_pspair        *init);
+
+
+#endif /* GAMMA_ESEARCH_H */
@@ -1,26 +1,38 @@
 #include <assert.h>
+#include <stdalign.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <tgmath.h>
 #include "gamma.h"
+#include "csearch.h"
+#include "esearch.h"
+#include "pool.h"
 #include "psearch.h"
+#include "trace.h"
 
-#if defined(_OPENMP) && _OPENMP
-#   include <threads.h>
-#   define ADD_MUTEX(name)  mtx_t name
-#   define MTX_INIT(mtx)    mtx_init(mtx, mtx_plain)
-#   define MTX_DESTROY(mtx) mtx_destroy(mtx)
-#   define MTX_LOCK(mtx)    mtx_lock(mtx)
-#   define MTX_UNLOCK(mtx)  mtx_unlock(mtx)
 
-#else
-#   define ADD_MUTEX(name)  int _##name
-#   define MTX_INIT(mtx)
-#   define MTX_DESTROY(mtx)
-#   define MTX_LOCK(mtx)
-#   define MTX_UNLOCK(mtx)
+/** @brief Voxels of a row handled at once, bounding stack buffers */
+#define GAMMA_ROW_CHUNK 64
 
-#endif
+
+/** @brief Active voxels handled by each task of the main loop */
+#define GAMMA_BLOCK 256
+
+
+/** @brief A warm-started pattern search begins this many shrinks in, i.e. with
+ *      a stencil of DTA / 2^GAMMA_WARM_SHRINKS, so that it ends on the same
+ *      resolution as a cold search
+ */
+#define GAMMA_WARM_SHRINKS 2
+
+
+/** @brief The best displacement found at the previous voxel of a row */
+struct gamma_warm {
+    gamma_vec_t disp;   /* Displacement of the minimum from its origin */
+    bool        valid;  /* The displacement may seed the next search */
+};
 
 
 struct gamma_objective {
@@ -28,6 +40,68 @@ struct gamma_objective {
     double                           ratio;     /* Criteria ratio */
     double                           mdose;     /* (Normalized) measured dose */
     gamma_vec_t                      origin;    /* Measured dose origin */
+    struct gamma_cell                cell;      /* Reference cell the search
+                                                   last probed */
+};
+
+
+/** @brief The walk of one criterion at the current voxel of a sweep */
+struct gamma_sweep {
+    struct gamma_objective obj;     /* Objective */
+    struct gamma_pspair    best;    /* Best point found so far */
+    double                 accept;  /* Acceptance value of the search */
+    bool                   open;    /* The walk has not stopped yet */
+};
+
+
+/** @brief Partial results of a single thread for one criterion, padded out to
+ *      a cache line so that threads never contend for them
+ */
+struct gamma_tally {
+    alignas (64) struct gamma_accumulator acc;  /* Point statistics */
+    long                                  pass; /* Passing points */
+    struct gamma_warm                     warm; /* Seed of the next search */
+    struct gamma_sweep                    sweep; /* Walk at the current voxel */
+    double                                value; /* Gamma at the current voxel,
+                                                    or NaN below threshold */
+    gamma_vec_t                           match; /* Best match at the current
+                                                    voxel, or NaN if none was
+                                                    searched for */
+    double                                dose; /* Reference dose at the
+                                                   match */
+    double                                dta;  /* Distance to agreement at
+                                                   the current voxel */
+#if defined(GAMMA_COUNTERS)
+    struct gamma_counters                 counters; /* Hot-path counters, only
+                                                       kept by the first
+                                                       criterion */
+#endif
+};
+
+
+#if defined(GAMMA_COUNTERS)
+
+thread_local struct gamma_counters gamma_counters_local;
+
+#endif
+
+
+/** @brief A measured dose voxel above threshold in either distribution */
+struct gamma_voxel {
+    size_t idx;     /* Index in a dense buffer of the measured dose */
+    double rdose;   /* Reference dose at the voxel */
+    double mdose;   /* Measured dose at the voxel */
+};
+
+
+/** @brief The compacted list of active voxels */
+struct gamma_active {
+    gamma_idx_t         lo;     /* First pixel of the box of active voxels */
+    gamma_idx_t         hi;     /* One past the last pixel of the box */
+    size_t             *rows;   /* Active voxel count, later the offset into
+                                   the list, of each row of the box */
+    struct gamma_voxel *vox;    /* Active voxels in buffer order */
+    size_t              len;    /* Active voxel count */
 };
 
 
@@ -54,151 +128,1522 @@ static double gamma_objective_value(const struct gamma_objective *obj,
  *  @note Optimizer callback
  *  @param pos
  *      Coordinates
+ *  @param[out] rdose
+ *      Receives the reference dose at @p pos
  *  @param data
  *      Objective
  *  @returns The value of the distance-gamma objective
  */
-static double gamma_objective_evaluate(const gamma_vec_t *pos, void *data)
+static double gamma_objective_evaluate(const gamma_vec_t *pos,
+                                       double            *rdose,
+                                       void              *data)
 {
     const struct gamma_objective *obj = data;
     gamma_vec_t diff;
 
+    GAMMA_COUNT(evals, 1);
     diff = gamma_vec_sub(pos, &obj->origin);
-    return gamma_objective_value(obj,
-                                 gamma_distribution_interp(obj->ref, pos),
-                                 &diff);
+    *rdose = gamma_distribution_interp(obj->ref, pos);
+    return gamma_objective_value(obj, *rdose, &diff);
 }
 
 
+/** @brief Evaluate the objective function at many points
+ *  @note Optimizer batch callback
+ *  @param len
+ *      Point count
+ *  @param pos
+ *      Coordinates
+ *  @param[out] res
+ *      Receives the values of the distance-gamma objective
+ *  @param[out] dose
+ *      Receives the reference dose at each point
+ *  @param data
+ *      Objective
+ */
+static void gamma_objective_evaluaten(size_t             len,
+                                      const gamma_vec_t *pos,
+                                      double            *res,
+                                      double            *dose,
+                                      void              *data)
+{
+    enum { CHUNK = 2 * GAMMA_PSRCH_MAXDIMS };
+    struct gamma_objective *obj = data;
+    gamma_scal_t x[CHUNK], y[CHUNK], z[CHUNK];
+    const gamma_scal_t *const soa[3] = { x, y, z };
+    double rdose[CHUNK];
+    size_t i, j, n, pad;
+    gamma_vec_t diff;
+
+    GAMMA_COUNT(evals, len);
+    for (i = 0; i < len; i += n) {
+        n = len - i < CHUNK ? len - i : CHUNK;
+        for (j = 0; j < n; j++) {
+            x[j] = pos[i + j].vec[0];
+            y[j] = pos[i + j].vec[1];
+            z[j] = pos[i + j].vec[2];
+        }
+        /* Pad to whole vectors, which is cheaper than a scalar remainder */
+        for (pad = (n + 3) & ~(size_t)3; j < pad; j++) {
+            x[j] = x[0];
+            y[j] = y[0];
+            z[j] = z[0];
+        }
+        /* Stencils soon shrink within one cell, and then probe it alone */
+        gamma_distribution_interpn_cell(obj->ref, &obj->cell, pad, soa, rdose);
+        for (j = 0; j < n; j++) {
+            diff = gamma_vec_sub(&pos[i + j], &obj->origin);
+            res[i + j] = gamma_objective_value(obj, rdose[j], &diff);
+            dose[i + j] = rdose[j];
+        }
+    }
+}
+
+
+/** @brief How the measured lattice lies on the reference lattice */
+enum gamma_grid {
+    GAMMA_GRID_GENERAL,     /* Any affine relation */
+    GAMMA_GRID_AXIAL,       /* Each axis is scaled and offset on its own */
+    GAMMA_GRID_COINCIDENT,  /* The lattices are the same */
+};
+
+
+/** @brief One criterion of a run */
+struct gamma_criterion {
+    const struct gamma_params *parms;   /* Gamma parameters */
+    struct gamma_results      *res;     /* Results */
+    double                     rthrsh;  /* Reference dose threshold */
+    double                     mthrsh;  /* Measured dose threshold */
+    size_t                     reach;   /* Exhaustive search offsets, or cell
+                                           search cells, within the search
+                                           radius */
+};
+
+
 /** @brief The full alphabet of parameters */
 struct gamma {
-    const struct gamma_params       *parms;     /* Gamma parameters */
+    const struct gamma_criterion    *crit;      /* Criteria */
+    size_t                           count;     /* Criterion count */
     const struct gamma_options      *opts;      /* Gamma options */
     const struct gamma_distribution *ref;       /* Reference dose */
     const struct gamma_distribution *meas;      /* Measured dose */
-    struct gamma_results            *res;       /* Results */
-    double                           rthrsh;    /* Reference dose threshold */
-    double                           mthrsh;    /* Measured dose threshold */
-    ADD_MUTEX(mtx);
+    double                           rthrsh;    /* Lowest reference dose
+                                                   threshold of any criterion */
+    double                           mthrsh;    /* Lowest measured dose
+                                                   threshold of any criterion */
+    bool                             sweep;     /* Walk the offsets once for
+                                                   every criterion, which only
+                                                   the exhaustive search
+                                                   does */
+    enum gamma_grid                  grid;      /* Relation of the lattices */
+    gamma_mat_t                      lattice;   /* Measured pixel to reference
+                                                   pixel transform */
+    struct gamma_offsets             offs;      /* Exhaustive search offsets */
+    struct gamma_cells               cells;     /* Cell search cells */
+    struct gamma_pyramid             pyr;       /* Min/max pyramid of the
+                                                   reference dose, built for
+                                                   the branch search and for
+                                                   pass-only runs */
+    struct gamma_active              act;       /* Active voxels */
+    struct gamma_tally              *tally;     /* Partial results of each
+                                                   thread, criteria fastest */
+    int                              threads;   /* Thread count */
+    struct gamma_trace               trace;     /* Phase timing */
 };
 
 
-/** @brief Do pointwise gamma
+/** @brief Classify the relation of the measured lattice to the reference
+ *      lattice and compose the transformation between them
+ *  @param ref
+ *      Reference dose
+ *  @param meas
+ *      Measured dose
+ *  @param[out] lattice
+ *      Receives the measured pixel to reference pixel transform
+ *  @returns The relation of the lattices
+ */
+static enum gamma_grid gamma_grid_classify(const struct gamma_distribution *ref,
+                                           const struct gamma_distribution *meas,
+                                           gamma_mat_t                     *lattice)
+{
+    int i, j;
+
+    *lattice = meas->matrix;
+    gamma_matmul_mm(&ref->inverse, lattice);
+    if (!ref->axial || !meas->axial) {
+        return GAMMA_GRID_GENERAL;
+    }
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            if (ref->matrix.cols[i].vec[j] != meas->matrix.cols[i].vec[j]) {
+                return GAMMA_GRID_AXIAL;
+            }
+        }
+    }
+    return GAMMA_GRID_COINCIDENT;
+}
+
+
+/** @brief Look up the reference dose along part of a measured dose row
+ *  @param gamma
+ *      Gamma context
+ *  @param row
+ *      Measured dose row
+ *  @param first
+ *      First voxel of the row to look up
+ *  @param len
+ *      Voxel count, at most `GAMMA_ROW_CHUNK`
+ *  @param[out] rdose
+ *      Receives the reference dose at each voxel
+ */
+static void gamma_reference_row(const struct gamma                  *gamma,
+                                const struct gamma_distribution_row *row,
+                                size_t                               first,
+                                size_t                               len,
+                                double                              *rdose)
+{
+    const gamma_mat_t *map = &gamma->lattice;
+    gamma_scal_t x[GAMMA_ROW_CHUNK], y[GAMMA_ROW_CHUNK], z[GAMMA_ROW_CHUNK];
+    const gamma_scal_t *const soa[3] = { x, y, z };
+    gamma_idx_t lat = row->lat;
+    gamma_vec_t pos;
+    size_t i;
+
+    assert(len <= GAMMA_ROW_CHUNK);
+    switch (gamma->grid) {
+    case GAMMA_GRID_COINCIDENT:
+        for (i = 0; i < len; i++) {
+            lat.idx[0] = row->lat.idx[0] + (gamma_iscal_t)(first + i);
+            rdose[i] = gamma_distribution_at(gamma->ref, &lat);
+        }
+        break;
+    case GAMMA_GRID_AXIAL:
+        for (i = 0; i < len; i++) {
+            x[i] = map->cols[0].vec[0] * (gamma_scal_t)(lat.idx[0] + first + i)
+                 + map->cols[3].vec[0];
+            y[i] = map->cols[1].vec[1] * lat.idx[1] + map->cols[3].vec[1];
+            z[i] = map->cols[2].vec[2] * lat.idx[2] + map->cols[3].vec[2];
+        }
+        gamma_distribution_samplen(gamma->ref, len, soa, rdose);
+        break;
+    case GAMMA_GRID_GENERAL:
+    default:
+        for (i = 0; i < len; i++) {
+            pos = gamma_distribution_row_pos(row, first + i);
+            x[i] = pos.vec[0];
+            y[i] = pos.vec[1];
+            z[i] = pos.vec[2];
+        }
+        gamma_distribution_interpn(gamma->ref, len, soa, rdose);
+        break;
+    }
+}
+
+
+/** @brief Check whether a measured dose voxel is above threshold
+ *  @param rthrsh
+ *      Reference dose threshold
+ *  @param mthrsh
+ *      Measured dose threshold
+ *  @param rdose
+ *      Reference dose at the voxel
+ *  @param mdose
+ *      Measured dose at the voxel
+ *  @returns true if gamma must be computed at the voxel
+ */
+static bool gamma_isactive(double rthrsh,
+                           double mthrsh,
+                           double rdose,
+                           double mdose)
+{
+    return !(rdose < rthrsh && mdose < mthrsh);
+}
+
+
+/** @brief Find the radius of the global search of a criterion
+ *  @param params
+ *      Gamma parameters
+ *  @param options
+ *      Extra gamma options
+ *  @returns The radius in physical units
+ */
+static double gamma_radius(const struct gamma_params  *params,
+                           const struct gamma_options *options)
+{
+    return options->pass_only ? params->dta : options->radius * params->dta;
+}
+
+
+/** @brief Cheaply bound the objective from below within DTA of its origin
+ *  @param gamma
+ *      Gamma context
+ *  @param crit
+ *      Criterion
+ *  @param obj
+ *      Objective function
+ *  @returns A lower bound of the objective over the DTA ball
+ */
+static double gamma_objective_bound(const struct gamma           *gamma,
+                                    const struct gamma_criterion *crit,
+                                    const struct gamma_objective *obj)
+{
+    double lo, hi, gap;
+
+    if (gamma->pyr.levels) {
+        /* At most eight blocks, however wide the ball */
+        gamma_pyramid_bounds(&gamma->pyr, gamma->ref, &obj->origin,
+                             crit->parms->dta, &lo, &hi);
+    } else {
+        gamma_distribution_bounds(gamma->ref, &obj->origin, crit->parms->dta,
+                                  &lo, &hi);
+    }
+    gap = fmax(lo - obj->mdose, obj->mdose - hi);
+    return gap > 0.0 ? gamma_sqr(obj->ratio * gap) : 0.0;
+}
+
+
+/** @brief Set up the objective of a criterion at an active voxel, and settle
+ *      the voxel at once if no search could change its outcome
+ *  @param gamma
+ *      Gamma context
+ *  @param crit
+ *      Criterion
+ *  @param pos
+ *      Measured dose physical coordinates
+ *  @param rdose
+ *      Reference dose value at @p pos
+ *  @param mdose
+ *      Measured dose value
+ *  @param[out] obj
+ *      Objective function
+ *  @param[out] pair
+ *      Receives @p pos and the objective there
+ *  @param[out] accept
+ *      Receives the value below which a search may stop
+ *  @returns The objective value the voxel settles on, or a NaN if it must be
+ *      searched
+ */
+static double gamma_pointwise_init(const struct gamma           *gamma,
+                                   const struct gamma_criterion *crit,
+                                   const gamma_vec_t            *pos,
+                                   double                        rdose,
+                                   double                        mdose,
+                                   struct gamma_objective       *obj,
+                                   struct gamma_pspair          *pair,
+                                   double                       *accept)
+{
+    const struct gamma_params *parms = crit->parms;
+    double dnorm, bound;
+
+    switch (parms->norm) {
+    case GAMMA_NORM_GLOBAL:
+    default:
+        dnorm = gamma->meas->max;
+        break;
+    case GAMMA_NORM_LOCAL:
+        dnorm = mdose;
+        break;
+    case GAMMA_NORM_ABSOLUTE:
+        dnorm = 1.0;
+        break;
+    }
+    obj->ref = gamma->ref;
+    obj->ratio = parms->dta / parms->diff;
+    obj->ratio /= dnorm;
+    obj->mdose = mdose;
+    obj->origin = *pos;
+    obj->cell.valid = false;
+    if (parms->rel) {
+        /* Normalize the measured dose value to the reference dose's range */
+        obj->mdose *= gamma->ref->max / gamma->meas->max;
+    }
+    *accept = gamma->opts->pass_only ? gamma_sqr(parms->dta) : -HUGE_VAL;
+
+    pair->vec = *pos;
+    pair->val = gamma_objective_value(obj, rdose, &(const gamma_vec_t){ 0 });
+    pair->aux = rdose;
+    if (pair->val < *accept) {
+        return pair->val;
+    } else if (gamma->opts->pass_only) {
+        /* Give up if no point in the DTA ball could possibly pass */
+        bound = gamma_objective_bound(gamma, crit, obj);
+        if (!(bound < *accept)) {
+            return bound;
+        }
+    }
+    return NAN;
+}
+
+
+/** @brief Do pointwise gamma at an active voxel
  *  @param gamma
  *      Gamma context
+ *  @param crit
+ *      Criterion
  *  @param pos
  *      Measured dose physical coordinates
+ *  @param rdose
+ *      Reference dose value at @p pos
  *  @param mdose
  *      Measured dose value
- *  @returns The gamma value at this point
+ *  @param[in, out] warm
+ *      The best displacement at the previous voxel, which is replaced by the
+ *      one found here. Only used if warm starts are enabled
+ *  @param[out] match
+ *      Receives the best match, or NaN if the voxel failed without a search
+ *  @param[out] dose
+ *      Receives the reference dose the search found at the best match, or NaN
+ *      if there is none
+ *  @param[out] agree
+ *      Receives the distance to agreement if the criterion maps it, or
+ *      infinity if none lies within the search radius
+ *  @returns The gamma value at this point. In pass-only mode, this is only
+ *      guaranteed to be on the correct side of one
  */
-static double gamma_pointwise(const struct gamma *gamma,
-                              const gamma_vec_t  *pos,
-                              double              mdose)
+static double gamma_pointwise(const struct gamma           *gamma,
+                              const struct gamma_criterion *crit,
+                              const gamma_vec_t            *pos,
+                              double                        rdose,
+                              double                        mdose,
+                              struct gamma_warm            *warm,
+                              gamma_vec_t                  *match,
+                              double                       *dose,
+                              double                       *agree)
 {
     const gamma_vec_t bases[] = {
         {{ 1, 0, 0, 0 }},
         {{ 0, 1, 0, 0 }},
         {{ 0, 0, 1, 0 }},
     };
-    struct gamma_objective obj = {
-        .ref    = gamma->ref,
-        .ratio  = gamma->parms->dta / gamma->parms->diff,
-        .mdose  = mdose,
-        .origin = *pos,
+    const double dta = crit->parms->dta;
+    struct gamma_objective obj;
+    struct gamma_psfunc func = {
+        .func   = gamma_objective_evaluate,
+        .batch  = gamma_objective_evaluaten,
+        .data   = &obj,
+        .dims   = BUFLEN(bases),
+        .bases  = bases,
     };
-    const struct gamma_psfunc func = {
-        .func  = gamma_objective_evaluate,
-        .data  = &obj,
-        .dims  = BUFLEN(bases),
-        .bases = bases
+    const struct gamma_offsets offs = {
+        .len  = crit->reach,
+        .offs = gamma->offs.offs,
     };
-    struct gamma_pspair pair;
-    double dnorm, rdose;
+    struct gamma_csfunc cfunc;
+    struct gamma_cells cells;
+    struct gamma_pspair pair, seed;
+    double settled, dsq, *iso = crit->res->dta ? &dsq : NULL;
 
-    /* Check if this point is even above threshold */
-    rdose = gamma_distribution_interp(gamma->ref, pos);
-    if (rdose < gamma->rthrsh && mdose < gamma->mthrsh) {
-        return GAMMA_SIG;
+    settled = gamma_pointwise_init(gamma, crit, pos, rdose, mdose,
+                                   &obj, &pair, &func.accept);
+    if (!isnan(settled) && !iso) {
+        /* The distance to agreement is only found by searching */
+        /* A bound below the value without displacement matched nothing */
+        *match = settled == pair.val ? pair.vec
+                                     : (const gamma_vec_t){{ NAN, NAN, NAN }};
+        *dose = settled == pair.val ? pair.aux : NAN;
+        warm->valid = false;
+        return sqrt(settled) / dta;
     }
 
-    switch (gamma->parms->norm) {
-    case GAMMA_NORM_GLOBAL:
+    switch (gamma->opts->search) {
+    case GAMMA_SEARCH_PATTERN:
     default:
-        dnorm = gamma->meas->max;
+        if (warm->valid) {
+            /* Neighbours usually match at almost the same displacement, so
+               start there on a finer stencil if it beats no displacement */
+            seed.vec = gamma_vec_add(pos, &warm->disp);
+            seed.val = func.func(&seed.vec, &seed.aux, func.data);
+            warm->valid = seed.val < pair.val;
+        }
+        if (warm->valid) {
+            pair = seed;
+            gamma_pattern_search(&func, &pair, ldexp(dta, -GAMMA_WARM_SHRINKS),
+                                 gamma->opts->shrinks - GAMMA_WARM_SHRINKS);
+        } else {
+            gamma_pattern_search(&func, &pair, dta, gamma->opts->shrinks);
+        }
+        warm->disp = gamma_vec_sub(&pair.vec, pos);
+        warm->valid = gamma->opts->warm;
         break;
-    case GAMMA_NORM_LOCAL:
-        dnorm = mdose;
+    case GAMMA_SEARCH_EXHAUSTIVE:
+        /* The radius of the criterion bounds a prefix of the shared list */
+        gamma_exhaustive_search(&offs, &func, &pair);
         break;
-    case GAMMA_NORM_ABSOLUTE:
-        dnorm = 1.0;
+    case GAMMA_SEARCH_CELLS:
+        cfunc = (const struct gamma_csfunc){
+            .dist   = obj.ref,
+            .ratio  = obj.ratio,
+            .dose   = obj.mdose,
+            .accept = func.accept,
+        };
+        cells = (const struct gamma_cells){
+            .len  = crit->reach,
+            .offs = gamma->cells.offs,
+        };
+        gamma_cell_search(&cells, &cfunc, &pair, iso);
+        break;
+    case GAMMA_SEARCH_BRANCH:
+        cfunc = (const struct gamma_csfunc){
+            .dist   = obj.ref,
+            .ratio  = obj.ratio,
+            .dose   = obj.mdose,
+            .accept = func.accept,
+        };
+        gamma_branch_search(&gamma->pyr, &cfunc,
+                            gamma_radius(crit->parms, gamma->opts), &pair, iso);
         break;
     }
-    obj.ratio /= dnorm;
+    /* Each engine keeps the reference dose at its result as the by-product */
+    *match = pair.vec;
+    *dose = pair.aux;
+    if (iso) {
+        /* Beyond the radius a nearer point may lie outside the search */
+        *agree = dsq <= gamma_sqr(gamma_radius(crit->parms, gamma->opts))
+             ? sqrt(dsq) : HUGE_VAL;
+    }
+    return sqrt(pair.val) / dta;
+}
 
-    if (gamma->parms->rel) {
-        /* Normalize the measured dose value to the reference dose's range */
-        obj.mdose *= gamma->ref->max / gamma->meas->max;
+
+/** @brief Do pointwise gamma for every criterion at an active voxel at once, by
+ *      one exhaustive walk over the offset list that interpolates each sample
+ *      only once, however many criteria still need it
+ *  @param gamma
+ *      Gamma context
+ *  @param tally
+ *      Partial results of the worker for each criterion, whose walks are used
+ *  @param pos
+ *      Measured dose physical coordinates
+ *  @param vox
+ *      Active voxel, whose gamma value for each criterion is written to the
+ *      partial results, or a NaN for a criterion under whose threshold it is
+ *  @note Every criterion sees the same offsets in the same order, and the same
+ *      samples, as a search of its own would, so the values are the same
+ */
+static void gamma_pointwise_sweep(const struct gamma       *gamma,
+                                  struct gamma_tally       *tally,
+                                  const gamma_vec_t        *pos,
+                                  const struct gamma_voxel *vox)
+{
+    const struct gamma_pspair *offs = gamma->offs.offs;
+    const struct gamma_criterion *crit;
+    struct gamma_sweep *sweep;
+    size_t c, i, open = 0, len = 0;
+    gamma_vec_t test, diff;
+    double rdose, val;
+    bool sampled;
+
+    for (c = 0; c < gamma->count; c++) {
+        crit = &gamma->crit[c];
+        sweep = &tally[c].sweep;
+        sweep->open = false;
+        tally[c].value = NAN;
+        if (!gamma_isactive(crit->rthrsh, crit->mthrsh,
+                            vox->rdose, vox->mdose)) {
+            continue;
+        }
+        val = gamma_pointwise_init(gamma, crit, pos, vox->rdose, vox->mdose,
+                                   &sweep->obj, &sweep->best, &sweep->accept);
+        tally[c].match = sweep->best.vec;
+        tally[c].dose = sweep->best.aux;
+        if (!isnan(val)) {
+            tally[c].value = sqrt(val) / crit->parms->dta;
+            if (val != sweep->best.val) {
+                tally[c].match = (const gamma_vec_t){{ NAN, NAN, NAN }};
+                tally[c].dose = NAN;
+            }
+            continue;
+        }
+        sweep->open = true;
+        len = crit->reach > len ? crit->reach : len;
+        open++;
     }
 
-    pair.vec = *pos;
-    pair.val = gamma_objective_value(&obj, rdose, &(const gamma_vec_t){ 0 });
-    gamma_pattern_search(&func, &pair, gamma->parms->dta, gamma->opts->shrinks);
-    return sqrt(pair.val) / gamma->parms->dta;
+    /* The walk of each criterion stops as gamma_exhaustive_search would */
+    for (i = 0; i < len && open; i++) {
+        test = gamma_vec_add(pos, &offs[i].vec);
+        sampled = false;
+        for (c = 0; c < gamma->count; c++) {
+            sweep = &tally[c].sweep;
+            if (!sweep->open) {
+                continue;
+            } else if (i >= gamma->crit[c].reach
+                    || !(offs[i].val < sweep->best.val)
+                    || sweep->best.val < sweep->accept) {
+                tally[c].value = sqrt(sweep->best.val)
+                               / gamma->crit[c].parms->dta;
+                sweep->open = false;
+                open--;
+                continue;
+            } else if (!sampled) {
+                GAMMA_COUNT(evals, 1);
+                rdose = gamma_distribution_interp(gamma->ref, &test);
+                diff = gamma_vec_sub(&test, pos);
+                sampled = true;
+            }
+            val = gamma_objective_value(&sweep->obj, rdose, &diff);
+            if (val < sweep->best.val) {
+                sweep->best.vec = tally[c].match = test;
+                sweep->best.val = val;
+                sweep->best.aux = tally[c].dose = rdose;
+            }
+        }
+    }
+    for (c = 0; c < gamma->count; c++) {
+        sweep = &tally[c].sweep;
+        if (sweep->open) {
+            tally[c].value = sqrt(sweep->best.val) / gamma->crit[c].parms->dta;
+        }
+    }
+}
+
+
+/** @brief Move the counters of the calling thread into the partial results of
+ *      a worker, at the end of each task
+ *  @param gamma
+ *      Gamma context
+ *  @param worker
+ *      Index of the worker thread
+ */
+static void gamma_tally_count(struct gamma *gamma, int worker)
+{
+#if defined(GAMMA_COUNTERS)
+    gamma_counters_merge(&gamma->tally[(size_t)worker * gamma->count].counters,
+                         &gamma_counters_local);
+    gamma_counters_local = (const struct gamma_counters){ 0 };
+#else
+    (void)gamma;
+    (void)worker;
+#endif
+}
+
+
+/** @brief Bound the measured dose pixels that may see the reference dose at or
+ *      above threshold
+ *  @param ref
+ *      Reference dose
+ *  @param meas
+ *      Measured dose
+ *  @param[in, out] lo
+ *      The first reference dose pixel above threshold on input, and on output
+ *      the first measured dose pixel that may interpolate it
+ *  @param[in, out] hi
+ *      One past the last reference dose pixel on input, and one past the last
+ *      measured dose pixel on output
+ *  @returns true if the measured dose box is not empty
+ */
+static bool gamma_active_map(const struct gamma_distribution *ref,
+                             const struct gamma_distribution *meas,
+                             gamma_idx_t                     *lo,
+                             gamma_idx_t                     *hi)
+{
+    gamma_vec_t corner, min, max;
+    gamma_mat_t map = ref->matrix;
+    bool res = true;
+    int c, axis;
+
+    /* Every point interpolating a pixel of the box lies within one pixel of it
+       towards the origin, since its cell is named by its lower corner */
+    gamma_matmul_mm(&meas->inverse, &map);
+    for (c = 0; c < 8; c++) {
+        corner = (const gamma_vec_t){{
+            (c & 1) ? hi->idx[0] : lo->idx[0] - 1,
+            (c & 2) ? hi->idx[1] : lo->idx[1] - 1,
+            (c & 4) ? hi->idx[2] : lo->idx[2] - 1,
+            1
+        }};
+        corner = gamma_matmul_mv(&map, &corner);
+        for (axis = 0; axis < 3; axis++) {
+            min.vec[axis] = c ? fmin(min.vec[axis], corner.vec[axis])
+                              : corner.vec[axis];
+            max.vec[axis] = c ? fmax(max.vec[axis], corner.vec[axis])
+                              : corner.vec[axis];
+        }
+    }
+    for (axis = 0; axis < 3; axis++) {
+        lo->idx[axis] = (gamma_iscal_t)fmin(fmax(floor(min.vec[axis]), 0.0),
+                                            meas->dims.idx[axis]);
+        hi->idx[axis] = (gamma_iscal_t)fmax(fmin(ceil(max.vec[axis]) + 1.0,
+                                                 meas->dims.idx[axis]), 0.0);
+        res = res && lo->idx[axis] < hi->idx[axis];
+    }
+    return res;
+}
+
+
+/** @brief Find the box of measured dose pixels that holds every active voxel
+ *  @param gamma
+ *      Gamma context
+ *  @param[out] lo
+ *      Receives the first pixel of the box
+ *  @param[out] hi
+ *      Receives one past the last pixel of the box
+ *  @returns true if the box is not empty
+ */
+static bool gamma_active_box(const struct gamma *gamma,
+                             gamma_idx_t        *lo,
+                             gamma_idx_t        *hi)
+{
+    gamma_idx_t rlo, rhi;
+    bool meas, ref;
+    int axis;
+
+    if (!(gamma->rthrsh > 0.0)) {
+        /* Even the zero outside of the reference dose is above threshold */
+        *lo = (const gamma_idx_t){ 0 };
+        *hi = gamma->meas->dims;
+        return true;
+    }
+    meas = gamma_distribution_crop(gamma->meas, gamma->mthrsh, lo, hi);
+    ref = gamma_distribution_crop(gamma->ref, gamma->rthrsh, &rlo, &rhi)
+       && gamma_active_map(gamma->ref, gamma->meas, &rlo, &rhi);
+    for (axis = 0; ref && axis < 3; axis++) {
+        lo->idx[axis] = meas && lo->idx[axis] < rlo.idx[axis] ? lo->idx[axis]
+                                                              : rlo.idx[axis];
+        hi->idx[axis] = meas && hi->idx[axis] > rhi.idx[axis] ? hi->idx[axis]
+                                                              : rhi.idx[axis];
+    }
+    return meas || ref;
 }
 
 
-/** @brief Iterator callback
+/** @brief Find the active voxels of a row of the active box
+ *  @param gamma
+ *      Gamma context
+ *  @param row
+ *      Row of the measured dose
+ *  @param collect
+ *      If true, append the active voxels to their place in the list, otherwise
+ *      only count them
+ */
+static void gamma_active_scan(struct gamma                        *gamma,
+                              const struct gamma_distribution_row *row,
+                              bool                                 collect)
+{
+    struct gamma_active *act = &gamma->act;
+    const size_t r = (row->lat.idx[1] - act->lo.idx[1])
+        + (size_t)(act->hi.idx[1] - act->lo.idx[1])
+        * (row->lat.idx[2] - act->lo.idx[2]);
+    struct gamma_voxel *vox = collect ? act->vox + act->rows[r] : NULL;
+    double rdose[GAMMA_ROW_CHUNK], mdose;
+    size_t i, j, n, count = 0;
+
+    for (i = 0; i < row->len; i += n) {
+        n = row->len - i < GAMMA_ROW_CHUNK ? row->len - i : GAMMA_ROW_CHUNK;
+        gamma_reference_row(gamma, row, i, n, rdose);
+        for (j = 0; j < n; j++) {
+            mdose = gamma_distribution_row_dose(row, i + j);
+            if (!gamma_isactive(gamma->rthrsh, gamma->mthrsh,
+                                rdose[j], mdose)) {
+                continue;
+            } else if (collect) {
+                vox[count].idx = row->idx + i + j;
+                vox[count].rdose = rdose[j];
+                vox[count].mdose = mdose;
+            }
+            count++;
+        }
+    }
+    if (!collect) {
+        act->rows[r] = count;
+    }
+}
+
+
+/** @brief Row iterator callback counting active voxels */
+static void gamma_active_count(const struct gamma_distribution_row *row,
+                               void                                *data)
+{
+    gamma_active_scan(data, row, false);
+}
+
+
+/** @brief Row iterator callback collecting active voxels */
+static void gamma_active_collect(const struct gamma_distribution_row *row,
+                                 void                                *data)
+{
+    gamma_active_scan(data, row, true);
+}
+
+
+/** @brief Iterate over one plane of the active box
+ *  @param gamma
+ *      Gamma context
+ *  @param plane
+ *      Plane offset into the box along the third lattice axis
+ *  @param func
+ *      Row iterator function
+ */
+static void gamma_active_plane(struct gamma               *gamma,
+                               size_t                      plane,
+                               gamma_distribution_rowfn_t *func)
+{
+    gamma_idx_t lo = gamma->act.lo, hi = gamma->act.hi;
+
+    lo.idx[2] += (gamma_iscal_t)plane;
+    hi.idx[2] = lo.idx[2] + 1;
+    gamma_distribution_foreach_box(gamma->meas, &lo, &hi, func, gamma);
+}
+
+
+/** @brief Pool task counting the active voxels of a plane */
+static void gamma_active_count_task(size_t task, int worker, void *data)
+{
+    struct gamma *gamma = data;
+    const double start = gamma_trace_start(&gamma->trace);
+
+    gamma_active_plane(gamma, task, gamma_active_count);
+    gamma_tally_count(gamma, worker);
+    gamma_trace_add(&gamma->trace, worker, "threshold_count", start, task);
+}
+
+
+/** @brief Pool task collecting the active voxels of a plane */
+static void gamma_active_collect_task(size_t task, int worker, void *data)
+{
+    struct gamma *gamma = data;
+    const double start = gamma_trace_start(&gamma->trace);
+
+    gamma_active_plane(gamma, task, gamma_active_collect);
+    gamma_tally_count(gamma, worker);
+    gamma_trace_add(&gamma->trace, worker, "threshold_collect", start, task);
+}
+
+
+/** @brief Compact the active voxels of the measured dose into a list, in two
+ *      passes over the box holding them: one counting the voxels of each row
+ *      and one writing them out
+ *  @param gamma
+ *      Gamma context
+ *  @returns true on success, false on allocation failure
+ */
+static bool gamma_active_init(struct gamma *gamma)
+{
+    struct gamma_active *act = &gamma->act;
+    size_t rows, planes, i, n;
+
+    act->rows = NULL;
+    act->vox = NULL;
+    act->len = 0;
+    if (!gamma_active_box(gamma, &act->lo, &act->hi)) {
+        return true;
+    }
+    planes = (size_t)(act->hi.idx[2] - act->lo.idx[2]);
+    rows = (size_t)(act->hi.idx[1] - act->lo.idx[1]) * planes;
+    act->rows = malloc(sizeof *act->rows * rows);
+    if (!act->rows) {
+        return false;
+    }
+    gamma_pool_run(gamma->threads, planes, gamma_active_count_task, gamma);
+    for (i = 0; i < rows; i++) {
+        n = act->rows[i];
+        act->rows[i] = act->len;
+        act->len += n;
+    }
+    act->vox = malloc(sizeof *act->vox * (act->len ? act->len : 1));
+    if (act->vox) {
+        gamma_pool_run(gamma->threads, planes, gamma_active_collect_task,
+                       gamma);
+    }
+    free(act->rows);
+    act->rows = NULL;
+    return act->vox != NULL;
+}
+
+
+/** @brief Write the diagnostic maps of a voxel
+ *  @param gamma
+ *      Gamma context
+ *  @param crit
+ *      Criterion
+ *  @param tally
+ *      Partial results of the worker for @p crit, holding the match, the
+ *      reference dose there and the distance to agreement
  *  @param pos
- *      Physical coordinates of this position in the measured dose
- *  @param dose
- *      The dose value
- *  @param data
- *      The gamma context pointer
- *  @returns true
+ *      Measured dose physical coordinates
+ *  @param vox
+ *      Active voxel
+ */
+static void gamma_tally_maps(const struct gamma           *gamma,
+                             const struct gamma_criterion *crit,
+                             const struct gamma_tally     *tally,
+                             const gamma_vec_t            *pos,
+                             const struct gamma_voxel     *vox)
+{
+    struct gamma_results *res = crit->res;
+    const gamma_vec_t disp = gamma_vec_sub(&tally->match, pos);
+    double mdose = vox->mdose;
+    int axis;
+
+    for (axis = 0; res->disp && axis < 3; axis++) {
+        res->disp[3 * vox->idx + axis] = disp.vec[axis];
+    }
+    if (res->ddiff) {
+        if (crit->parms->rel) {
+            mdose *= gamma->ref->max / gamma->meas->max;
+        }
+        res->ddiff[vox->idx] = tally->dose - mdose;
+    }
+    if (res->dta) {
+        res->dta[vox->idx] = tally->dta;
+    }
+}
+
+
+/** @brief Add the gamma value of a voxel to the partial results of a criterion
+ *  @param gamma
+ *      Gamma context
+ *  @param crit
+ *      Criterion
+ *  @param tally
+ *      Partial results of the worker for @p crit, holding the value
+ *  @param pos
+ *      Measured dose physical coordinates
+ *  @param vox
+ *      Active voxel
+ */
+static void gamma_tally_add(const struct gamma           *gamma,
+                            const struct gamma_criterion *crit,
+                            struct gamma_tally           *tally,
+                            const gamma_vec_t            *pos,
+                            const struct gamma_voxel     *vox)
+{
+    double value = tally->value;
+
+    if (isnan(value)) {
+        /* Below the threshold of this criterion, if not of another */
+        return;
+    } else if (gamma->opts->pass_only) {
+        value = value < 1.0;
+    }
+    tally->pass += gamma->opts->pass_only ? value : value < 1.0;
+    gamma_accumulator_add(&tally->acc, value);
+    if (crit->res->dist) {
+        crit->res->dist[vox->idx] = value;
+    }
+    if (crit->res->disp || crit->res->ddiff || crit->res->dta) {
+        gamma_tally_maps(gamma, crit, tally, pos, vox);
+    }
+}
+
+
+/** @brief Compute gamma over a block of the active voxel list
+ *  @param gamma
+ *      Gamma context
+ *  @param worker
+ *      Index of the worker thread
+ *  @param first
+ *      First active voxel of the block
+ *  @param last
+ *      One past the last active voxel of the block
+ */
+static void gamma_active_block(struct gamma *gamma,
+                               int           worker,
+                               size_t        first,
+                               size_t        last)
+{
+    const struct gamma_voxel *vox = gamma->act.vox;
+    const struct gamma_criterion *crit = gamma->crit;
+    const size_t cols = (size_t)gamma->meas->dims.idx[0];
+    struct gamma_tally *tally = &gamma->tally[(size_t)worker * gamma->count];
+    gamma_vec_t pos;
+    size_t i, c;
+#if defined(GAMMA_COUNTERS)
+    long long evals;
+#endif
+
+    for (c = 0; c < gamma->count; c++) {
+        tally[c].warm.valid = false;
+    }
+    for (i = first; i < last; i++) {
+        if (i > first && (vox[i].idx != vox[i - 1].idx + 1
+                       || vox[i].idx % cols == 0)) {
+            /* Only the previous voxel of the same row is a good seed */
+            for (c = 0; c < gamma->count; c++) {
+                tally[c].warm.valid = false;
+            }
+        }
+        pos = gamma_distribution_pos(gamma->meas, vox[i].idx);
+#if defined(GAMMA_COUNTERS)
+        evals = gamma_counters_local.evals;
+#endif
+        if (gamma->sweep) {
+            gamma_pointwise_sweep(gamma, tally, &pos, &vox[i]);
+        } else {
+            for (c = 0; c < gamma->count; c++) {
+                if (gamma_isactive(crit[c].rthrsh, crit[c].mthrsh,
+                                   vox[i].rdose, vox[i].mdose)) {
+                    tally[c].value = gamma_pointwise(gamma, &crit[c], &pos,
+                                                     vox[i].rdose, vox[i].mdose,
+                                                     &tally[c].warm,
+                                                     &tally[c].match,
+                                                     &tally[c].dose,
+                                                     &tally[c].dta);
+                } else {
+                    /* A run of this criterion alone would skip the voxel, so
+                       its neighbours are no longer in the same run of voxels */
+                    tally[c].value = NAN;
+                    tally[c].warm.valid = false;
+                }
+            }
+        }
+#if defined(GAMMA_COUNTERS)
+        evals = gamma_counters_local.evals - evals;
+        gamma_counters_local.hist[gamma_counters_bin(evals)]++;
+#endif
+        for (c = 0; c < gamma->count; c++) {
+            gamma_tally_add(gamma, &crit[c], &tally[c], &pos, &vox[i]);
+        }
+    }
+}
+
+
+/** @brief Pool task computing gamma over a block of the active voxel list,
+ *      so that threads steal blocks from one another and uneven searches
+ *      balance out
  */
-static void gamma_iterator(const gamma_vec_t *pos,
-                           double             dose,
-                           size_t             idx,
-                           void              *data)
+static void gamma_active_task(size_t task, int worker, void *data)
 {
     struct gamma *gamma = data;
-    double value;
+    const size_t first = task * GAMMA_BLOCK;
+    const double start = gamma_trace_start(&gamma->trace);
+
+    gamma_active_block(gamma, worker, first,
+                       gamma->act.len - first < GAMMA_BLOCK
+                           ? gamma->act.len : first + GAMMA_BLOCK);
+    gamma_tally_count(gamma, worker);
+    gamma_trace_add(&gamma->trace, worker, "gamma_block", start, task);
+}
+
 
-    value = gamma_pointwise(gamma, pos, dose);
-    if (value != GAMMA_SIG) {
-        MTX_LOCK(&gamma->mtx);
-        gamma->res->pass += value < 1.0;
-        gamma_statistics_add(&gamma->res->stats, value);
-        MTX_UNLOCK(&gamma->mtx);
+/** @brief Set up the criteria of a run
+ *  @param[in, out] gamma
+ *      Gamma context, whose criteria are written and whose lowest thresholds
+ *      are set
+ *  @param crit
+ *      Criteria
+ *  @param params
+ *      Gamma parameters of each criterion
+ *  @param res
+ *      Results of each criterion
+ */
+static void gamma_criteria_init(struct gamma              *gamma,
+                                struct gamma_criterion    *crit,
+                                const struct gamma_params *params,
+                                struct gamma_results      *res)
+{
+    size_t c;
+
+    gamma->crit = crit;
+    gamma->rthrsh = gamma->mthrsh = HUGE_VAL;
+    for (c = 0; c < gamma->count; c++) {
+        crit[c].parms = &params[c];
+        crit[c].res = &res[c];
+        crit[c].rthrsh = params[c].thrsh * gamma->ref->max;
+        crit[c].mthrsh = params[c].thrsh * gamma->meas->max;
+        crit[c].reach = 0;
+        gamma->rthrsh = fmin(gamma->rthrsh, crit[c].rthrsh);
+        gamma->mthrsh = fmin(gamma->mthrsh, crit[c].mthrsh);
     }
-    if (gamma->res->dist) {
-        gamma->res->dist[idx] = value;
+}
+
+
+/** @brief List the exhaustive search offsets out to the widest radius of any
+ *      criterion, and find the prefix of the list within the radius of each
+ *  @param gamma
+ *      Gamma context
+ *  @param crit
+ *      Criteria, whose reach is set
+ *  @returns true on success, false on allocation failure
+ */
+static bool gamma_criteria_offsets(struct gamma           *gamma,
+                                   struct gamma_criterion *crit)
+{
+    gamma_scal_t radius = 0.0, rsqr;
+    size_t c, n;
+
+    for (c = 0; c < gamma->count; c++) {
+        radius = fmax(radius, gamma_radius(crit[c].parms, gamma->opts));
+    }
+    if (!gamma_offsets_init(&gamma->offs, &gamma->meas->matrix, radius,
+                            (int)gamma->opts->subdiv)) {
+        return false;
     }
+    for (c = 0; c < gamma->count; c++) {
+        /* The same test that gamma_offsets_init filters by */
+        rsqr = gamma_radius(crit[c].parms, gamma->opts);
+        rsqr = gamma_sqr(rsqr);
+        for (n = gamma->offs.len; n && !(gamma->offs.offs[n - 1].val <= rsqr);
+             n--) {
+            continue;
+        }
+        crit[c].reach = n;
+    }
+    return true;
 }
 
 
-void gamma_compute(const struct gamma_params       *params,
-                   const struct gamma_options      *options,
-                   const struct gamma_distribution *ref,
-                   const struct gamma_distribution *meas,
-                   struct gamma_results            *res)
+/** @brief List the reference cells that the cell search may visit out to the
+ *      widest radius of any criterion, and find the prefix of the list within
+ *      the radius of each
+ *  @param gamma
+ *      Gamma context
+ *  @param crit
+ *      Criteria, whose reach is set
+ *  @returns true on success, false if the reference lattice is degenerate or
+ *      on allocation failure
+ */
+static bool gamma_criteria_cells(struct gamma           *gamma,
+                                 struct gamma_criterion *crit)
+{
+    gamma_scal_t radius = 0.0, rsqr;
+    size_t c, n;
+
+    for (c = 0; c < gamma->count; c++) {
+        radius = fmax(radius, gamma_radius(crit[c].parms, gamma->opts));
+    }
+    if (!gamma_cells_init(&gamma->cells, &gamma->ref->matrix, radius)) {
+        return false;
+    }
+    for (c = 0; c < gamma->count; c++) {
+        /* The same test that gamma_cells_init filters by */
+        rsqr = gamma_radius(crit[c].parms, gamma->opts);
+        rsqr = gamma_sqr(rsqr);
+        for (n = gamma->cells.len; n && !(gamma->cells.offs[n - 1].val <= rsqr);
+             n--) {
+            continue;
+        }
+        crit[c].reach = n;
+    }
+    return true;
+}
+
+
+/** @brief Compute gamma for one or more criteria, adding the results to running
+ *      totals
+ *  @param params
+ *      Gamma parameters of each criterion
+ *  @param count
+ *      Criterion count, at least one
+ *  @param options
+ *      Extra gamma options
+ *  @param ref
+ *      Reference distribution
+ *  @param meas
+ *      Measured distribution
+ *  @param[in, out] res
+ *      Results of each criterion, whose pass counts and counters are added to
+ *      and whose distributions, if any, are written
+ *  @param[in, out] acc
+ *      Accumulators of each criterion that the point statistics are merged
+ *      into
+ *  @returns true on success, false on allocation failure
+ *  @note The criteria share the traversal, the threshold pass and the
+ *      reference dose at each voxel, and an exhaustive search walks the
+ *      offsets once for all of them
+ */
+static bool gamma_run(const struct gamma_params       *params,
+                      size_t                           count,
+                      const struct gamma_options      *options,
+                      const struct gamma_distribution *ref,
+                      const struct gamma_distribution *meas,
+                      struct gamma_results            *res,
+                      struct gamma_accumulator        *acc)
 {
     struct gamma gamma = {
-        .parms  = params,
+        .count  = count,
         .opts   = options,
         .ref    = ref,
         .meas   = meas,
-        .res    = res,
-        .rthrsh = params->thrsh * ref->max,
-        .mthrsh = params->thrsh * meas->max,
+        .sweep  = options->search == GAMMA_SEARCH_EXHAUSTIVE && count > 1,
     };
+    const int threads = gamma_pool_threads(options->threads);
+    struct gamma_criterion *crit;
+#if defined(GAMMA_COUNTERS)
+    struct gamma_counters counters = { 0 };
+#endif
+    double run, phase;
+    size_t n, c;
+    bool ok = false;
+    int i;
+
+    /* Everything released at the end is safe to release zero-initialized */
+    crit = malloc(sizeof *crit * count);
+    gamma.tally = gamma_aligned_alloc(alignof (struct gamma_tally),
+                                      sizeof *gamma.tally * threads * count);
+    if (!crit || !gamma.tally
+     || !gamma_trace_begin(&gamma.trace, options->trace, threads)) {
+        goto done;
+    }
+    run = phase = gamma_trace_start(&gamma.trace);
+    gamma_criteria_init(&gamma, crit, params, res);
+    if (options->search == GAMMA_SEARCH_EXHAUSTIVE
+     && !gamma_criteria_offsets(&gamma, crit)) {
+        goto done;
+    }
+    if (options->search == GAMMA_SEARCH_CELLS
+     && !gamma_criteria_cells(&gamma, crit)) {
+        goto done;
+    }
+    /* The branch search walks the pyramid, and pass-only runs bound every
+       voxel's DTA ball with it before searching */
+    if ((options->search == GAMMA_SEARCH_BRANCH || options->pass_only)
+     && !gamma_pyramid_init(&gamma.pyr, ref)) {
+        goto done;
+    }
+    gamma.grid = gamma_grid_classify(ref, meas, &gamma.lattice);
+    gamma.threads = threads;
+    for (n = 0; n < (size_t)threads * count; n++) {
+        gamma.tally[n].acc = gamma_accumulator_init();
+        gamma.tally[n].pass = 0;
+#if defined(GAMMA_COUNTERS)
+        gamma.tally[n].counters = (const struct gamma_counters){ 0 };
+#endif
+    }
+#if defined(GAMMA_COUNTERS)
+    /* The calling thread may have counted lookups of its own before */
+    gamma_counters_local = (const struct gamma_counters){ 0 };
+#endif
+
+    for (c = 0; c < count; c++) {
+        /* Everything outside of the active list is below threshold */
+        for (n = 0; res[c].dist && n < meas->len; n++) {
+            res[c].dist[n] = GAMMA_SIG;
+        }
+        for (n = 0; res[c].disp && n < 3 * meas->len; n++) {
+            res[c].disp[n] = NAN;
+        }
+        for (n = 0; res[c].ddiff && n < meas->len; n++) {
+            res[c].ddiff[n] = NAN;
+        }
+        for (n = 0; res[c].dta && n < meas->len; n++) {
+            res[c].dta[n] = NAN;
+        }
+    }
+    gamma_trace_add(&gamma.trace, 0, "prepare", phase, SIZE_MAX);
 
-    MTX_INIT(&gamma.mtx);
+    phase = gamma_trace_start(&gamma.trace);
+    if (!gamma_active_init(&gamma)) {
+        goto done;
+    }
+    gamma_trace_add(&gamma.trace, 0, "threshold", phase, SIZE_MAX);
+
+    phase = gamma_trace_start(&gamma.trace);
+    gamma_pool_run(threads, (gamma.act.len + GAMMA_BLOCK - 1) / GAMMA_BLOCK,
+                   gamma_active_task, &gamma);
+    gamma_trace_add(&gamma.trace, 0, "gamma_loop", phase, SIZE_MAX);
+
+    phase = gamma_trace_start(&gamma.trace);
+    for (i = 0; i < threads; i++) {
+        for (c = 0; c < count; c++) {
+            gamma_accumulator_merge(&acc[c], &gamma.tally[i * count + c].acc);
+            res[c].pass += gamma.tally[i * count + c].pass;
+        }
+#if defined(GAMMA_COUNTERS)
+        gamma_counters_merge(&counters, &gamma.tally[i * count].counters);
+#endif
+    }
+#if defined(GAMMA_COUNTERS)
+    counters.skipped += (long long)(meas->len - gamma.act.len);
+    for (c = 0; c < count; c++) {
+        /* The criteria share their work, so each reports all of it */
+        gamma_counters_merge(&res[c].counters, &counters);
+    }
+#endif
+    gamma_trace_add(&gamma.trace, 0, "reduce", phase, SIZE_MAX);
+    gamma_trace_add(&gamma.trace, 0, "gamma_compute", run, SIZE_MAX);
+    ok = true;
+
+done:
+    /* A trace that cannot be written does not fail the run */
+    gamma_trace_end(&gamma.trace);
+    free(gamma.act.vox);
+    gamma_offsets_destroy(&gamma.offs);
+    gamma_cells_destroy(&gamma.cells);
+    gamma_pyramid_destroy(&gamma.pyr);
+    free(crit);
+    gamma_aligned_free(gamma.tally);
+    return ok;
+}
+
+
+bool gamma_compute(const struct gamma_params       *params,
+                   const struct gamma_options      *options,
+                   const struct gamma_distribution *ref,
+                   const struct gamma_distribution *meas,
+                   struct gamma_results            *res)
+{
+    return gamma_compute_sweep(params, 1, options, ref, meas, res);
+}
+
+
+bool gamma_compute_sweep(const struct gamma_params       *params,
+                         size_t                           count,
+                         const struct gamma_options      *options,
+                         const struct gamma_distribution *ref,
+                         const struct gamma_distribution *meas,
+                         struct gamma_results            *res)
+{
+    struct gamma_accumulator *acc;
+    size_t c;
+    bool ok;
+
+    if (!count) {
+        return true;
+    }
+    for (c = 0; c < count; c++) {
+        /* Only the cell walks can find the distance to agreement */
+        if (res[c].dta && options->search != GAMMA_SEARCH_CELLS
+                       && options->search != GAMMA_SEARCH_BRANCH) {
+            return false;
+        }
+    }
+    acc = malloc(sizeof *acc * count);
+    if (!acc) {
+        return false;
+    }
+    for (c = 0; c < count; c++) {
+        acc[c] = gamma_accumulator_init();
+        res[c].pass = 0;
+        res[c].counters = (const struct gamma_counters){ 0 };
+    }
+    ok = gamma_run(params, count, options, ref, meas, res, acc);
+    for (c = 0; ok && c < count; c++) {
+        res[c].stats = gamma_accumulator_finish(&acc[c]);
+    }
+    free(acc);
+    return ok;
+}
+
+
+/** @brief Planes of a streamed distribution held in memory */
+struct gamma_window {
+    struct gamma_distribution dist;     /* The planes, as a distribution */
+    double                   *buf;      /* Plane buffer */
+    size_t                    first;    /* First plane held */
+    size_t                    count;    /* Planes held */
+    size_t                    cap;      /* Plane capacity */
+};
+
+
+/** @brief Allocate a window
+ *  @param[out] win
+ *      Window
+ *  @param src
+ *      Streamed distribution
+ *  @param cap
+ *      Plane capacity
+ *  @returns true on success, false on allocation failure
+ */
+static bool gamma_window_init(struct gamma_window       *win,
+                              const struct gamma_source *src,
+                              size_t                     cap)
+{
+    const size_t plane = (size_t)src->dims.idx[0] * src->dims.idx[1];
+
+    win->first = win->count = 0;
+    win->cap = cap;
+    win->buf = malloc(sizeof *win->buf * (cap * plane + 1));
+    return win->buf != NULL;
+}
+
+
+/** @brief Hold a range of planes in a window, reading only those not already
+ *      held
+ *  @param win
+ *      Window
+ *  @param src
+ *      Streamed distribution
+ *  @param first
+ *      First plane
+ *  @param count
+ *      Plane count, at most the capacity of @p win
+ *  @returns true on success, false if the reader failed or the matrix of
+ *      @p src is singular
+ */
+static bool gamma_window_load(struct gamma_window       *win,
+                              const struct gamma_source *src,
+                              size_t                     first,
+                              size_t                     count)
+{
+    const size_t plane = (size_t)src->dims.idx[0] * src->dims.idx[1];
+    const size_t last = first + count;
+    size_t olo, ohi;
+    gamma_mat_t matr = src->matrix;
+    gamma_idx_t dims = src->dims;
+
+    assert(count <= win->cap);
+    olo = win->first > first ? win->first : first;
+    ohi = win->first + win->count < last ? win->first + win->count : last;
+    if (olo < ohi) {
+        /* Slide the planes held by both windows into place */
+        memmove(win->buf + (olo - first) * plane,
+                win->buf + (olo - win->first) * plane,
+                sizeof *win->buf * (ohi - olo) * plane);
+        if ((first < olo && !src->read(first, olo - first, win->buf, src->data))
+         || (ohi < last && !src->read(ohi, last - ohi,
+                                      win->buf + (ohi - first) * plane,
+                                      src->data))) {
+            return false;
+        }
+    } else if (count && !src->read(first, count, win->buf, src->data)) {
+        return false;
+    }
+    win->first = first;
+    win->count = count;
+
+    matr.cols[3] = gamma_vec_fmadds(&matr.cols[2], (gamma_scal_t)first,
+                                    &matr.cols[3]);
+    dims.idx[2] = (gamma_iscal_t)count;
+    if (!gamma_distribution_set(&win->dist, &matr, &dims, win->buf)) {
+        return false;
+    }
+    /* Thresholds and normalization see the whole distribution */
+    win->dist.max = src->max;
+    return true;
+}
+
+
+/** @brief Find the reference planes in reach of a slab of measured planes
+ *  @param ref
+ *      Streamed reference distribution
+ *  @param meas
+ *      Streamed measured distribution
+ *  @param map
+ *      Measured pixel to reference pixel transform
+ *  @param ext
+ *      Reach along the third reference axis, in reference pixels
+ *  @param z0
+ *      First measured plane
+ *  @param z1
+ *      One past the last measured plane
+ *  @param[out] first
+ *      Receives the first reference plane in reach
+ *  @param[out] last
+ *      Receives one past the last reference plane in reach
+ */
+static void gamma_stream_reach(const struct gamma_source *ref,
+                               const struct gamma_source *meas,
+                               const gamma_mat_t         *map,
+                               double                     ext,
+                               size_t                     z0,
+                               size_t                     z1,
+                               size_t                    *first,
+                               size_t                    *last)
+{
+    const double planes = ref->dims.idx[2];
+    gamma_vec_t corner;
+    double lo = HUGE_VAL, hi = -HUGE_VAL;
+    int c;
+
+    for (c = 0; c < 8; c++) {
+        corner = (const gamma_vec_t){{
+            (c & 1) ? meas->dims.idx[0] - 1 : 0,
+            (c & 2) ? meas->dims.idx[1] - 1 : 0,
+            (c & 4) ? (gamma_scal_t)(z1 - 1) : (gamma_scal_t)z0,
+            1
+        }};
+        corner = gamma_matmul_mv(map, &corner);
+        lo = fmin(lo, corner.vec[2]);
+        hi = fmax(hi, corner.vec[2]);
+    }
+    /* A point interpolates the plane below it and the one above */
+    lo = fmin(fmax(floor(lo - ext), 0.0), planes);
+    hi = fmin(fmax(floor(hi + ext) + 2.0, lo), planes);
+    *first = (size_t)lo;
+    *last = (size_t)hi;
+}
+
+
+bool gamma_source_scan(struct gamma_source *src, size_t slab)
+{
+    const size_t plane = (size_t)src->dims.idx[0] * src->dims.idx[1];
+    const size_t planes = (size_t)src->dims.idx[2];
+    double *buf;
+    size_t z, n, i;
+    bool ok = slab > 0;
+
+    buf = malloc(sizeof *buf * ((slab < planes ? slab : planes) * plane + 1));
+    ok = ok && buf;
+    src->max = -HUGE_VAL;
+    for (z = 0; ok && z < planes; z += n) {
+        n = planes - z < slab ? planes - z : slab;
+        ok = src->read(z, n, buf, src->data);
+        for (i = 0; ok && i < n * plane; i++) {
+            src->max = fmax(src->max, buf[i]);
+        }
+    }
+    free(buf);
+    return ok;
+}
+
+
+bool gamma_compute_stream(const struct gamma_params  *params,
+                          const struct gamma_options *options,
+                          const struct gamma_source  *ref,
+                          const struct gamma_source  *meas,
+                          size_t                      slab,
+                          gamma_write_t              *write,
+                          void                       *data,
+                          struct gamma_results       *res)
+{
+    const double reach = gamma_radius(params, options);
+    const size_t planes = (size_t)meas->dims.idx[2];
+    const size_t plane = (size_t)meas->dims.idx[0] * meas->dims.idx[1];
+    struct gamma_accumulator acc = gamma_accumulator_init();
+    struct gamma_window rwin = { .buf = NULL }, mwin = { .buf = NULL };
+    double *const dist = res->dist, *const disp = res->disp;
+    double *const ddiff = res->ddiff, *const dta = res->dta;
+    gamma_mat_t map = meas->matrix, rinv = ref->matrix;
+    size_t z, n, first, last, cap = 0;
+    double ext;
+    bool ok;
+
+    if (!slab || !gamma_mat_invert(&rinv)) {
+        return false;
+    }
+    gamma_matmul_mm(&rinv, &map);
+    ext = reach * sqrt(gamma_sqr(rinv.cols[0].vec[2])
+                     + gamma_sqr(rinv.cols[1].vec[2])
+                     + gamma_sqr(rinv.cols[2].vec[2]));
+    if (options->search == GAMMA_SEARCH_CELLS
+     || options->search == GAMMA_SEARCH_BRANCH) {
+        /* A cell in reach may extend a plane beyond the sphere */
+        ext += 1.0;
+    }
+
+    /* Size the reference window for the slab with the widest reach */
+    for (z = 0; z < planes; z += n) {
+        n = planes - z < slab ? planes - z : slab;
+        gamma_stream_reach(ref, meas, &map, ext, z, z + n, &first, &last);
+        cap = last - first > cap ? last - first : cap;
+    }
+    n = planes < slab ? planes : slab;
+    ok = gamma_window_init(&rwin, ref, cap) && gamma_window_init(&mwin, meas, n);
+    res->dist = res->disp = res->ddiff = res->dta = NULL;
+    if (ok && write) {
+        res->dist = malloc(sizeof *res->dist * (n * plane + 1));
+        ok = res->dist != NULL;
+    }
 
-    res->stats = gamma_statistics_init();
     res->pass = 0;
-    gamma_distribution_foreach(meas, gamma_iterator, &gamma);
+    res->counters = (const struct gamma_counters){ 0 };
+    for (z = 0; ok && z < planes; z += n) {
+        n = planes - z < slab ? planes - z : slab;
+        gamma_stream_reach(ref, meas, &map, ext, z, z + n, &first, &last);
+        ok = gamma_window_load(&rwin, ref, first, last - first)
+          && gamma_window_load(&mwin, meas, z, n)
+          && gamma_run(params, 1, options, &rwin.dist, &mwin.dist, res, &acc)
+          && (!write || write(z, n, res->dist, data));
+    }
+    res->stats = gamma_accumulator_finish(&acc);
 
-    MTX_DESTROY(&gamma.mtx);
+    free(res->dist);
+    res->dist = dist;
+    res->disp = disp;
+    res->ddiff = ddiff;
+    res->dta = dta;
+    free(rwin.buf);
+    free(mwin.buf);
+    return ok;
 }
@@ -4,7 +4,9 @@
 #define GAMMA_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "common.h"
+#include "counters.h"
 #include "distribution.h"
 #include "statistics.h"
 
@@ -25,6 +27,17 @@ typedef enum gamma_normalization {
 } gamma_norm_t;
 
 
+/** @brief Search engines used to minimize the gamma objective at each point */
+typedef enum gamma_search {
+    GAMMA_SEARCH_PATTERN,       /* Local pattern search over a shrinking stencil */
+    GAMMA_SEARCH_EXHAUSTIVE,    /* Global search over sorted lattice offsets */
+    GAMMA_SEARCH_CELLS,         /* Newton minimization within each reference
+                                   cell in reach, nearest first */
+    GAMMA_SEARCH_BRANCH,        /* Branch and bound over a min/max pyramid of
+                                   the reference, then as CELLS */
+} gamma_search_t;
+
+
 /** @brief Primary gamma parameters */
 struct gamma_params {
     double       diff;  /* %difference criterion as a proportion (e.g. 0.03) */
@@ -37,18 +50,59 @@ struct gamma_params {
 
 /** @brief Extra options not traditionally considered gamma parameters */
 struct gamma_options {
-    bool pass_only;     /* Terminate immediately upon finding a pass */
-    long shrinks;       /* Pattern search stencil shrink limit */
+    bool           pass_only;   /* Terminate immediately upon finding a pass */
+    long           shrinks;     /* Pattern search stencil shrink limit */
+    bool           warm;        /* Seed each pattern search with the best
+                                   displacement of the previous voxel */
+    gamma_search_t search;      /* Search engine */
+    long           subdiv;      /* Exhaustive search subdivisions per voxel */
+    double         radius;      /* Exhaustive and cell search radius in units
+                                   of DTA */
+    long           threads;     /* Worker threads, or zero for one per
+                                   processor */
+    const char    *trace;       /* File to append a Chrome trace of the run's
+                                   phases to, or NULL to use the file named by
+                                   the environment variable GAMMA_TRACE, if
+                                   any. A trace that cannot be written does
+                                   not fail the run */
 };
 
 
-/** @brief Results buffer. Only the pointer must be set by you, and if it is, it
- *      must address a buffer at least the size of the measured dose buffer
+/** @brief Results buffer. Only the pointers must be set by you, and those that
+ *      are set must address buffers at least the size of the measured dose
+ *      buffer (three times the size for the displacements)
+ *  @note In pass-only mode, the distribution is a pass mask (one where the point
+ *      passes, zero where it fails) and the statistics describe that mask, so
+ *      that the mean is the pass rate
+ *  @note The diagnostic maps describe the best match of each voxel, i.e. the
+ *      point where the search found the minimum of the gamma objective, and
+ *      are NaN below threshold. In pass-only mode the match is the first point
+ *      found to pass, and voxels that fail without a search are NaN too
+ *  @note The distance to agreement map is found in the same walk as gamma by
+ *      the cell and branch searches, which then search every voxel, even in
+ *      pass-only mode. The other searches cannot find it, and a run that asks
+ *      them for it fails
  */
 struct gamma_results {
     struct gamma_statistics stats;      /* Point statistics */
     long                    pass;       /* Total passing points */
     double                 *dist;       /* The gamma distribution, if nonnull */
+    double                 *disp;       /* Physical displacement from each
+                                           voxel to its best match, three per
+                                           voxel, if nonnull. Its norm is the
+                                           distance to the match, not a pure
+                                           distance to agreement */
+    double                 *ddiff;      /* Reference dose at the best match
+                                           less the measured dose (normalized
+                                           in relative mode), if nonnull */
+    double                 *dta;        /* Physical distance from each voxel
+                                           to the nearest point where the
+                                           reference dose equals the measured
+                                           dose (normalized in relative mode),
+                                           or infinity if none lies within
+                                           the search radius, if nonnull */
+    struct gamma_counters   counters;   /* Hot-path counters, which are zero
+                                           unless built with GAMMA_COUNTERS */
 };
 
 
@@ -63,14 +117,153 @@ struct gamma_results {
  *      Test distribution
  *  @param[out] res
  *      Results buffer
+ *  @returns true on success, false if memory could not be allocated, the
+ *      measured dose lattice is degenerate, or a distance to agreement map is
+ *      asked of a search other than the cell or branch search
  */
-void gamma_compute(const struct gamma_params       *params,
+bool gamma_compute(const struct gamma_params       *params,
                    const struct gamma_options      *options,
                    const struct gamma_distribution *ref,
                    const struct gamma_distribution *meas,
                    struct gamma_results            *res);
 
 
+/** @brief Compute gamma index statistics for several criteria in one pass,
+ *      e.g. the 3%/3 mm, 3%/2 mm, 2%/2 mm and 1%/1 mm pass rates of a report
+ *  @param params
+ *      Gamma parameters of each criterion
+ *  @param count
+ *      Criterion count
+ *  @param options
+ *      Extra gamma options, shared by every criterion
+ *  @param ref
+ *      Reference/baseline distribution
+ *  @param meas
+ *      Test distribution
+ *  @param[out] res
+ *      Results buffer of each criterion, each with a distribution pointer of
+ *      its own
+ *  @returns true on success, false if memory could not be allocated, the
+ *      measured dose lattice is degenerate, or a distance to agreement map is
+ *      asked of a search other than the cell or branch search
+ *  @note The results are those of `gamma_compute` for each criterion alone.
+ *      The criteria share the traversal, the threshold pass and the
+ *      reference dose at each voxel. The exhaustive search walks the offsets
+ *      out to the widest radius once for all of them, so that each sample is
+ *      interpolated once
+ *  @note The saving applies only with the exhaustive search, not with the
+ *      default pattern search. The pattern, cell and branch searches follow
+ *      the DTA of each criterion with their own stencils or cells and search
+ *      once for each from scratch, and most of their time goes to the
+ *      objective and the Newton steps rather than to gathering samples. A
+ *      sweep of four criteria thus costs about four single runs under the
+ *      pattern and cell searches and 3.6 under the branch search, against
+ *      1.4 under the exhaustive search
+ *  @note The counters of each result count the work of the whole sweep
+ */
+bool gamma_compute_sweep(const struct gamma_params       *params,
+                         size_t                           count,
+                         const struct gamma_options      *options,
+                         const struct gamma_distribution *ref,
+                         const struct gamma_distribution *meas,
+                         struct gamma_results            *res);
+
+
+/** @brief Read planes of a streamed distribution
+ *  @param first
+ *      First plane, i.e. pixel index along the third axis
+ *  @param count
+ *      Plane count
+ *  @param[out] buf
+ *      Receives the @p count planes in the same order as a whole distribution
+ *      buffer, starting from plane @p first
+ *  @param data
+ *      Your callback data
+ *  @returns true on success, false to abort the computation
+ */
+typedef bool gamma_read_t(size_t first, size_t count, double *buf, void *data);
+
+
+/** @brief Receive planes of a streamed gamma distribution
+ *  @param first
+ *      First plane of the measured distribution
+ *  @param count
+ *      Plane count
+ *  @param dist
+ *      The gamma distribution of the @p count planes, which is only valid
+ *      during the call
+ *  @param data
+ *      Your callback data
+ *  @returns true on success, false to abort the computation
+ */
+typedef bool gamma_write_t(size_t        first,
+                           size_t        count,
+                           const double *dist,
+                           void         *data);
+
+
+/** @brief A distribution streamed plane by plane along its third axis */
+struct gamma_source {
+    gamma_mat_t   matrix;   /* Pixel-to-physical affine transformation */
+    gamma_idx_t   dims;     /* Pixel dimensions */
+    double        max;      /* Maximum pixel value of the whole distribution,
+                               e.g. as found by `gamma_source_scan` */
+    gamma_read_t *read;     /* Plane reader */
+    void         *data;     /* Plane reader data */
+};
+
+
+/** @brief Find the maximum of a streamed distribution in one pass
+ *  @param[in, out] src
+ *      Distribution, whose maximum is set
+ *  @param slab
+ *      Planes to read at once
+ *  @returns true on success, false on allocation failure or if the reader
+ *      failed
+ */
+bool gamma_source_scan(struct gamma_source *src, size_t slab);
+
+
+/** @brief Compute gamma index statistics for two streamed distributions,
+ *      holding only a slab of the measured distribution and the planes of the
+ *      reference distribution within reach of it in memory at once. Each slab
+ *      of the gamma distribution is passed to @p write as it is finished
+ *  @param params
+ *      Gamma parameters
+ *  @param options
+ *      Extra gamma options. The reference planes in reach of a measured voxel
+ *      are those within `radius` DTAs (one DTA in pass-only mode) of it, for
+ *      either search
+ *  @param ref
+ *      Reference distribution
+ *  @param meas
+ *      Measured distribution
+ *  @param slab
+ *      Measured planes per slab
+ *  @param write
+ *      Gamma distribution callback, or NULL if only statistics are needed
+ *  @param data
+ *      Callback data for @p write
+ *  @param[out] res
+ *      Results. The distribution pointer and the diagnostic maps are ignored
+ *  @returns true on success, false on allocation failure, if a callback
+ *      failed, or if either distribution's matrix is singular
+ *  @note Peak memory is bounded by the slab size and the reach, not by the
+ *      size of the distributions. Lookups of the reference dose beyond reach
+ *      see zero dose as they would outside of the distribution, so the results
+ *      agree with `gamma_compute` wherever the searches stay within reach,
+ *      which is always so for the exhaustive search
+ */
+bool gamma_compute_stream(const struct gamma_params  *params,
+                          const struct gamma_options *options,
+                          const struct gamma_source  *ref,
+                          const struct gamma_source  *meas,
+                          size_t                      slab,
+                          gamma_write_t              *write,
+                          void                       *data,
+                          struct gamma_results       *res);
+
+
 EXTERN_C_END
 
 #endif /* GAMMA_H */
@@ -17,9 +17,36 @@ class Parameters:
 
 
 class Options:
-    def __init__(self, pass_only: bool = False, pattern_shrinks: int = 6):
+    def __init__(self,
+                 pass_only:       bool  = False,
+                 pattern_shrinks: int   = 6,
+                 warm_start:      bool  = False,
+                 search:          str   = "PATTERN",
+                 subdivisions:    int   = 4,
+                 radius:          float = 2.0,
+                 threads:         int   = 0,
+                 trace:           str   = None,
+                 diagnostics:     bool  = False,
+                 dta_map:         bool  = False):
         self.pass_only = pass_only
         self.pattern_shrinks = pattern_shrinks
+        self.warm_start = warm_start
+        # PATTERN, EXHAUSTIVE, CELLS to minimize within each reference cell
+        # in reach by Newton steps, or BRANCH to do so only in the cells that
+        # a min/max pyramid of the reference cannot rule out
+        self.search = search
+        self.subdivisions = subdivisions
+        self.radius = radius
+        self.threads = threads
+        # Chrome trace file to append to, else $GAMMA_TRACE if set
+        self.trace = trace
+        # Also map the best match of each voxel into Results.disp and ddiff in
+        # the same pass
+        self.diagnostics = diagnostics
+        # Also map the distance to agreement of each voxel into Results.dta,
+        # which only the CELLS and BRANCH searches find in the same pass. Any
+        # other search raises ValueError
+        self.dta_map = dta_map
 
 
 class Distribution:
@@ -27,6 +54,12 @@ class Distribution:
         self.matrix = numpy.identity(3, dtype=numpy.double)
         self.origin = numpy.zeros((3, 1), dtype=numpy.double)
         self.spacing = numpy.ones((3, 1), dtype=numpy.double)
+        # Dose per unit of uint16 or uint32 data. Data may also be double or
+        # float32, which is read as it is
+        self.scale = 1.0
+        # Three-dimensional, axis i along column i of the matrix, in any
+        # memory layout: C or Fortran order, or a strided view, is read as it
+        # is without a copy
         self.data: numpy.ndarray = None
 
 
@@ -39,12 +72,77 @@ class Results:
         self.mean = 0.0
         self.msqr = 0.0
         self.dist: numpy.ndarray = None
+        # Physical displacement to the best match of each voxel along a last
+        # axis of three, and the reference dose there less the measured dose,
+        # both NaN below threshold. None unless Options.diagnostics. The norm
+        # of disp is the distance to the match, which is not a pure DTA
+        self.disp: numpy.ndarray = None
+        self.ddiff: numpy.ndarray = None
+        # Distance from each voxel to the nearest point where the reference
+        # dose equals the measured dose, infinite if none lies within the
+        # search radius and NaN below threshold. None unless Options.dta_map
+        self.dta: numpy.ndarray = None
+        # Hot-path counters, or None unless built with GAMMA_COUNTERS defined
+        self.counters: dict = None
 
 
 def compute(params:  Parameters,
             options: Options,
             ref:     Distribution,
             meas:    Distribution):
+    # Runs without the GIL, so other Python threads go on meanwhile
     res = Results()
     cgamma.compute(params, options, ref, meas, res)
     return res
+
+
+def compute_sweep(params:  list,
+                  options: Options,
+                  ref:     Distribution,
+                  meas:    Distribution) -> list:
+    # One pass over several criteria, e.g. 3%/3 mm down to 1%/1 mm, with the
+    # results of compute for each. Only the EXHAUSTIVE search shares its
+    # samples between criteria and so costs well under one run per criterion;
+    # PATTERN (the default), CELLS and BRANCH search each criterion from
+    # scratch and cost about as much as separate runs
+    params = list(params)
+    res = [Results() for _ in params]
+    cgamma.compute_sweep(params, options, ref, meas, res)
+    return res
+
+
+class Future:
+    # The results of a computation running in the background
+    def __init__(self, task, res: Results):
+        self._task = task
+        self._res = res
+
+    def done(self) -> bool:
+        return self._task.done()
+
+    def result(self, timeout: float = None) -> Results:
+        # Waits up to timeout seconds, or for as long as it takes if None
+        if not self._task.wait(timeout):
+            raise TimeoutError("Gamma computation still running")
+        return self._res
+
+
+def compute_async(params:  Parameters,
+                  options: Options,
+                  ref:     Distribution,
+                  meas:    Distribution) -> Future:
+    # Starts the computation on a native thread, which drives the thread pool,
+    # and returns at once. The dose arrays are held until it finishes, but must
+    # not be written to meanwhile
+    res = Results()
+    return Future(cgamma.compute_async(params, options, ref, meas, res), res)
+
+
+def load(path: str) -> Distribution:
+    # Memory-maps a MetaImage (.mha/.mhd) or raw NRRD dose volume. The data
+    # array addresses the mapping itself if the file holds aligned doubles,
+    # float32, uint16 or uint32 in native byte order, and the file stays mapped
+    # for as long as it lives
+    dist = Distribution()
+    cgamma.load(path, dist)
+    return dist
@@ -0,0 +1,839 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#   define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+
+/** @brief Longest header line read, including its terminator */
+#define GAMMA_IMAGE_LINE 1024
+
+
+/** @brief Voxel types */
+enum gamma_image_type {
+    GAMMA_IMAGE_NONE,
+    GAMMA_IMAGE_U8,
+    GAMMA_IMAGE_I8,
+    GAMMA_IMAGE_U16,
+    GAMMA_IMAGE_I16,
+    GAMMA_IMAGE_U32,
+    GAMMA_IMAGE_I32,
+    GAMMA_IMAGE_F32,
+    GAMMA_IMAGE_F64,
+};
+
+
+/** @brief Size in bytes of each voxel type */
+static const size_t gamma_image_sizes[] = {
+    [GAMMA_IMAGE_NONE] = 0,
+    [GAMMA_IMAGE_U8]   = 1,
+    [GAMMA_IMAGE_I8]   = 1,
+    [GAMMA_IMAGE_U16]  = 2,
+    [GAMMA_IMAGE_I16]  = 2,
+    [GAMMA_IMAGE_U32]  = 4,
+    [GAMMA_IMAGE_I32]  = 4,
+    [GAMMA_IMAGE_F32]  = 4,
+    [GAMMA_IMAGE_F64]  = 8,
+};
+
+
+/** @brief A name of a voxel type in either format */
+struct gamma_image_typename {
+    const char            *name;
+    enum gamma_image_type  type;
+};
+
+
+static const struct gamma_image_typename gamma_image_meta_types[] = {
+    { "MET_UCHAR",  GAMMA_IMAGE_U8 },
+    { "MET_CHAR",   GAMMA_IMAGE_I8 },
+    { "MET_USHORT", GAMMA_IMAGE_U16 },
+    { "MET_SHORT",  GAMMA_IMAGE_I16 },
+    { "MET_UINT",   GAMMA_IMAGE_U32 },
+    { "MET_INT",    GAMMA_IMAGE_I32 },
+    { "MET_FLOAT",  GAMMA_IMAGE_F32 },
+    { "MET_DOUBLE", GAMMA_IMAGE_F64 },
+};
+
+
+static const struct gamma_image_typename gamma_image_nrrd_types[] = {
+    { "uchar",              GAMMA_IMAGE_U8 },
+    { "unsigned char",      GAMMA_IMAGE_U8 },
+    { "uint8",              GAMMA_IMAGE_U8 },
+    { "uint8_t",            GAMMA_IMAGE_U8 },
+    { "signed char",        GAMMA_IMAGE_I8 },
+    { "int8",               GAMMA_IMAGE_I8 },
+    { "int8_t",             GAMMA_IMAGE_I8 },
+    { "ushort",             GAMMA_IMAGE_U16 },
+    { "unsigned short",     GAMMA_IMAGE_U16 },
+    { "unsigned short int", GAMMA_IMAGE_U16 },
+    { "uint16",             GAMMA_IMAGE_U16 },
+    { "uint16_t",           GAMMA_IMAGE_U16 },
+    { "short",              GAMMA_IMAGE_I16 },
+    { "short int",          GAMMA_IMAGE_I16 },
+    { "signed short",       GAMMA_IMAGE_I16 },
+    { "signed short int",   GAMMA_IMAGE_I16 },
+    { "int16",              GAMMA_IMAGE_I16 },
+    { "int16_t",            GAMMA_IMAGE_I16 },
+    { "uint",               GAMMA_IMAGE_U32 },
+    { "unsigned int",       GAMMA_IMAGE_U32 },
+    { "uint32",             GAMMA_IMAGE_U32 },
+    { "uint32_t",           GAMMA_IMAGE_U32 },
+    { "int",                GAMMA_IMAGE_I32 },
+    { "signed int",         GAMMA_IMAGE_I32 },
+    { "int32",              GAMMA_IMAGE_I32 },
+    { "int32_t",            GAMMA_IMAGE_I32 },
+    { "float",              GAMMA_IMAGE_F32 },
+    { "double",             GAMMA_IMAGE_F64 },
+};
+
+
+/** @brief The fields of a header that locate and describe the voxels */
+struct gamma_image_header {
+    double                dir[3][3];    /* Unit direction of each axis */
+    double                spacing[3];   /* Spacing along each axis */
+    double                origin[3];    /* Physical position of voxel zero */
+    gamma_idx_t           dims;         /* Pixel dimensions */
+    enum gamma_image_type type;         /* Voxel type */
+    bool                  msb;          /* Voxels are big-endian */
+    bool                  ras;          /* The space is right-anterior-superior
+                                           rather than left-posterior-superior */
+    bool                  local;        /* The voxels follow the header in its
+                                           own file */
+    long long             skip;         /* Bytes before the voxels, or -1 if
+                                           they end the file */
+    long                  lines;        /* Lines before the skipped bytes */
+    char                  file[GAMMA_IMAGE_LINE]; /* Detached voxel file */
+};
+
+
+/** @brief Map a whole file
+ *  @param path
+ *      File
+ *  @param[out] size
+ *      Receives the file size
+ *  @returns The mapping, or NULL if the file could not be mapped or is empty
+ */
+static void *gamma_image_map(const char *path, size_t *size)
+{
+    void *res = NULL;
+#if defined(_WIN32)
+    HANDLE file, mapping;
+    LARGE_INTEGER len;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    if (GetFileSizeEx(file, &len) && len.QuadPart > 0
+     && (unsigned long long)len.QuadPart <= SIZE_MAX) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (mapping) {
+            res = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        *size = (size_t)len.QuadPart;
+    }
+    CloseHandle(file);
+#else
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!fstat(fd, &st) && st.st_size > 0
+     && (off_t)(size_t)st.st_size == st.st_size) {
+        res = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE, fd, 0);
+        res = res != MAP_FAILED ? res : NULL;
+        *size = (size_t)st.st_size;
+    }
+    close(fd);
+#endif
+    return res;
+}
+
+
+/** @brief Release a mapping from `gamma_image_map` */
+static void gamma_image_unmap(void *map, size_t size)
+{
+#if defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(map);
+#else
+    munmap(map, size);
+#endif
+}
+
+
+/** @brief Read a line of a header
+ *  @param[in, out] pos
+ *      Read position, which is moved past the line
+ *  @param end
+ *      End of the header file
+ *  @param[out] line
+ *      Receives the line without its terminator, truncated if it is too long
+ *  @returns 1 if a line was read, 0 at the end of the file, or -1 if the line
+ *      was truncated
+ */
+static int gamma_image_line(const char **pos,
+                            const char  *end,
+                            char         line[GAMMA_IMAGE_LINE])
+{
+    const char *eol;
+    size_t len;
+    int res = 1;
+
+    if (*pos == end) {
+        return 0;
+    }
+    eol = memchr(*pos, '\n', (size_t)(end - *pos));
+    eol = eol ? eol : end;
+    len = (size_t)(eol - *pos);
+    if (len >= GAMMA_IMAGE_LINE) {
+        len = GAMMA_IMAGE_LINE - 1;
+        res = -1;
+    }
+    memcpy(line, *pos, len);
+    line[len] = '\0';
+    if (len && line[len - 1] == '\r') {
+        line[len - 1] = '\0';
+    }
+    *pos = eol < end ? eol + 1 : end;
+    return res;
+}
+
+
+/** @brief Trim whitespace from both ends of a string in place */
+static char *gamma_image_trim(char *str)
+{
+    char *end;
+
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+
+/** @brief Split a header line into its key and value
+ *  @param line
+ *      Line, which is split in place
+ *  @param sep
+ *      Separator between the key and the value
+ *  @param[out] key
+ *      Receives the trimmed key
+ *  @param[out] val
+ *      Receives the trimmed value
+ *  @returns true on success, false if @p sep is not in @p line
+ */
+static bool gamma_image_split(char        *line,
+                              const char  *sep,
+                              char       **key,
+                              char       **val)
+{
+    char *mid;
+
+    mid = strstr(line, sep);
+    if (!mid) {
+        return false;
+    }
+    *mid = '\0';
+    *key = gamma_image_trim(line);
+    *val = gamma_image_trim(mid + strlen(sep));
+    return true;
+}
+
+
+/** @brief Compare strings, ignoring case */
+static bool gamma_image_is(const char *a, const char *b)
+{
+    while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+        a++;
+        b++;
+    }
+    return !*a && !*b;
+}
+
+
+/** @brief Parse a list of numbers, separated by any whitespace, commas or
+ *      parentheses as in a NRRD vector
+ *  @param str
+ *      String
+ *  @param len
+ *      Number count
+ *  @param[out] res
+ *      Receives the numbers
+ *  @returns true if @p str holds exactly @p len numbers
+ */
+static bool gamma_image_numbers(const char *str, size_t len, double res[])
+{
+    const char *const sep = " \t(),";
+    char *end;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        str += strspn(str, sep);
+        res[i] = strtod(str, &end);
+        if (end == str) {
+            return false;
+        }
+        str = end;
+    }
+    str += strspn(str, sep);
+    return !*str;
+}
+
+
+/** @brief Parse pixel dimensions, each of which must fit a pixel index */
+static bool gamma_image_dims(const char *str, gamma_idx_t *dims)
+{
+    double buf[3];
+    int i;
+
+    if (!gamma_image_numbers(str, 3, buf)) {
+        return false;
+    }
+    for (i = 0; i < 3; i++) {
+        if (!(buf[i] >= 1.0 && buf[i] < INT32_MAX) || buf[i] != (int32_t)buf[i]) {
+            return false;
+        }
+        dims->idx[i] = (int32_t)buf[i];
+    }
+    dims->idx[3] = 1;
+    return true;
+}
+
+
+/** @brief Parse a single integer */
+static bool gamma_image_integer(char *str, long long *res)
+{
+    char *end;
+
+    *res = strtoll(str, &end, 10);
+    return end != str && !*gamma_image_trim(end);
+}
+
+
+/** @brief Parse a MetaImage boolean */
+static bool gamma_image_bool(const char *str, bool *res)
+{
+    *res = gamma_image_is(str, "True");
+    return *res || gamma_image_is(str, "False");
+}
+
+
+/** @brief Look up a voxel type by name */
+static enum gamma_image_type
+gamma_image_type(const struct gamma_image_typename *names,
+                 size_t                             len,
+                 const char                        *name)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (gamma_image_is(name, names[i].name)) {
+            return names[i].type;
+        }
+    }
+    return GAMMA_IMAGE_NONE;
+}
+
+
+/** @brief Name a detached voxel file, which may not be one of the file lists
+ *      or patterns that either format allows
+ */
+static bool gamma_image_file(struct gamma_image_header *hdr, const char *name)
+{
+    if (!*name || strchr(name, '%') || gamma_image_is(name, "LIST")
+     || !strncmp(name, "LIST ", 5)) {
+        return false;
+    }
+    strcpy(hdr->file, name);
+    return true;
+}
+
+
+/** @brief Parse a MetaImage header, which ends with its `ElementDataFile`
+ *  @param[out] hdr
+ *      Header, holding its defaults
+ *  @param[in, out] pos
+ *      Position of the second line, which is moved past the header
+ *  @param end
+ *      End of the header file
+ *  @param line
+ *      The first line
+ *  @returns true on success, false if the header is malformed or unsupported
+ */
+static bool gamma_image_meta(struct gamma_image_header *hdr,
+                             const char               **pos,
+                             const char                *end,
+                             char                       line[GAMMA_IMAGE_LINE])
+{
+    double buf[9];
+    long long n;
+    char *key, *val;
+    bool flag, ok;
+    int i, state = 1;
+
+    for (; state == 1; state = gamma_image_line(pos, end, line)) {
+        if (!gamma_image_split(line, "=", &key, &val)) {
+            if (*gamma_image_trim(line)) {
+                return false;
+            }
+            continue;
+        }
+        ok = true;
+        if (gamma_image_is(key, "ObjectType")) {
+            ok = gamma_image_is(val, "Image");
+        } else if (gamma_image_is(key, "NDims")) {
+            ok = gamma_image_integer(val, &n) && n == 3;
+        } else if (gamma_image_is(key, "DimSize")) {
+            ok = gamma_image_dims(val, &hdr->dims);
+        } else if (gamma_image_is(key, "ElementSpacing")) {
+            ok = gamma_image_numbers(val, 3, hdr->spacing);
+        } else if (gamma_image_is(key, "Offset")
+                || gamma_image_is(key, "Position")
+                || gamma_image_is(key, "Origin")) {
+            ok = gamma_image_numbers(val, 3, hdr->origin);
+        } else if (gamma_image_is(key, "TransformMatrix")
+                || gamma_image_is(key, "Rotation")
+                || gamma_image_is(key, "Orientation")) {
+            ok = gamma_image_numbers(val, 9, buf);
+            for (i = 0; i < 9; i++) {
+                hdr->dir[i / 3][i % 3] = buf[i];
+            }
+        } else if (gamma_image_is(key, "ElementType")) {
+            hdr->type = gamma_image_type(gamma_image_meta_types,
+                                         BUFLEN(gamma_image_meta_types), val);
+            ok = hdr->type != GAMMA_IMAGE_NONE;
+        } else if (gamma_image_is(key, "ElementByteOrderMSB")
+                || gamma_image_is(key, "BinaryDataByteOrderMSB")) {
+            ok = gamma_image_bool(val, &hdr->msb);
+        } else if (gamma_image_is(key, "CompressedData")) {
+            ok = gamma_image_bool(val, &flag) && !flag;
+        } else if (gamma_image_is(key, "BinaryData")) {
+            ok = gamma_image_bool(val, &flag) && flag;
+        } else if (gamma_image_is(key, "ElementNumberOfChannels")) {
+            ok = gamma_image_integer(val, &n) && n == 1;
+        } else if (gamma_image_is(key, "HeaderSize")) {
+            ok = gamma_image_integer(val, &hdr->skip) && hdr->skip >= -1;
+        } else if (gamma_image_is(key, "ElementDataFile")) {
+            hdr->local = gamma_image_is(val, "LOCAL");
+            return hdr->local || gamma_image_file(hdr, val);
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return false;
+}
+
+
+/** @brief Parse a NRRD header, which ends with a blank line if the voxels are
+ *      attached, or else may end with its file
+ *  @param[out] hdr
+ *      Header, holding its defaults
+ *  @param[in, out] pos
+ *      Position of the second line, which is moved past the header
+ *  @param end
+ *      End of the header file
+ *  @param line
+ *      Line buffer
+ *  @returns true on success, false if the header is malformed or unsupported
+ */
+static bool gamma_image_nrrd(struct gamma_image_header *hdr,
+                             const char               **pos,
+                             const char                *end,
+                             char                       line[GAMMA_IMAGE_LINE])
+{
+    double buf[9];
+    long long n;
+    char *key, *val;
+    bool dirs = false, ok;
+    int i, state;
+
+    while ((state = gamma_image_line(pos, end, line))) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (state < 0) {
+            return false;
+        }
+        if (!line[0]) {
+            hdr->local = !hdr->file[0];
+            break;
+        }
+        if (strstr(line, ":=")) {
+            continue;
+        }
+        if (!gamma_image_split(line, ": ", &key, &val)) {
+            return false;
+        }
+        ok = true;
+        if (gamma_image_is(key, "dimension")
+         || gamma_image_is(key, "space dimension")) {
+            ok = gamma_image_integer(val, &n) && n == 3;
+        } else if (gamma_image_is(key, "type")) {
+            hdr->type = gamma_image_type(gamma_image_nrrd_types,
+                                         BUFLEN(gamma_image_nrrd_types), val);
+            ok = hdr->type != GAMMA_IMAGE_NONE;
+        } else if (gamma_image_is(key, "sizes")) {
+            ok = gamma_image_dims(val, &hdr->dims);
+        } else if (gamma_image_is(key, "endian")) {
+            hdr->msb = gamma_image_is(val, "big");
+            ok = hdr->msb || gamma_image_is(val, "little");
+        } else if (gamma_image_is(key, "encoding")) {
+            ok = gamma_image_is(val, "raw");
+        } else if (gamma_image_is(key, "space")) {
+            hdr->ras = gamma_image_is(val, "right-anterior-superior")
+                    || gamma_image_is(val, "RAS");
+        } else if (gamma_image_is(key, "space directions")) {
+            ok = gamma_image_numbers(val, 9, buf);
+            for (i = 0; i < 9; i++) {
+                hdr->dir[i / 3][i % 3] = buf[i];
+            }
+            dirs = true;
+        } else if (gamma_image_is(key, "space origin")) {
+            ok = gamma_image_numbers(val, 3, hdr->origin);
+        } else if (gamma_image_is(key, "spacings")) {
+            ok = gamma_image_numbers(val, 3, hdr->spacing);
+        } else if (gamma_image_is(key, "byte skip")) {
+            ok = gamma_image_integer(val, &hdr->skip) && hdr->skip >= -1;
+        } else if (gamma_image_is(key, "line skip")) {
+            ok = gamma_image_integer(val, &n) && n >= 0 && n <= LONG_MAX;
+            hdr->lines = (long)n;
+        } else if (gamma_image_is(key, "data file")
+                || gamma_image_is(key, "datafile")) {
+            ok = gamma_image_file(hdr, val);
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    if (dirs) {
+        /* The directions are scaled by the spacing already */
+        for (i = 0; i < 3; i++) {
+            hdr->spacing[i] = 1.0;
+        }
+    }
+    return hdr->local || hdr->file[0];
+}
+
+
+/** @brief Parse a header of either format
+ *  @param[out] hdr
+ *      Header
+ *  @param[in, out] pos
+ *      Start of the header file, which is moved past the header
+ *  @param end
+ *      End of the header file
+ *  @returns true on success, false if the header is malformed or unsupported
+ */
+static bool gamma_image_header(struct gamma_image_header *hdr,
+                               const char               **pos,
+                               const char                *end)
+{
+    char line[GAMMA_IMAGE_LINE];
+    bool ok;
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            hdr->dir[i][j] = i == j;
+        }
+        hdr->spacing[i] = 1.0;
+        hdr->origin[i] = 0.0;
+    }
+    hdr->dims = (gamma_idx_t){ { 0 } };
+    hdr->type = GAMMA_IMAGE_NONE;
+    hdr->msb = false;
+    hdr->ras = false;
+    hdr->local = false;
+    hdr->skip = 0;
+    hdr->lines = 0;
+    hdr->file[0] = '\0';
+    if (gamma_image_line(pos, end, line) != 1) {
+        return false;
+    }
+    ok = !strncmp(line, "NRRD", 4) ? gamma_image_nrrd(hdr, pos, end, line)
+                                   : gamma_image_meta(hdr, pos, end, line);
+    return ok && hdr->type != GAMMA_IMAGE_NONE && hdr->dims.idx[0];
+}
+
+
+/** @brief Build the affine matrix of a header */
+static gamma_mat_t gamma_image_matrix(const struct gamma_image_header *hdr)
+{
+    const double flip = hdr->ras ? -1.0 : 1.0;
+    gamma_mat_t res;
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            res.cols[i].vec[j] = hdr->dir[i][j] * hdr->spacing[i];
+        }
+        res.cols[i].vec[0] *= flip;
+        res.cols[i].vec[1] *= flip;
+        res.cols[i].vec[3] = 0.0;
+        res.cols[3].vec[i] = hdr->origin[i];
+    }
+    res.cols[3].vec[0] *= flip;
+    res.cols[3].vec[1] *= flip;
+    res.cols[3].vec[3] = 1.0;
+    return res;
+}
+
+
+/** @brief Find a detached voxel file, which is relative to the directory of
+ *      its header unless it is absolute
+ *  @returns The path, which you must free, or NULL on allocation failure
+ */
+static char *gamma_image_path(const char *header, const char *file)
+{
+    const char *sep;
+    size_t dir = 0;
+    char *res;
+
+    sep = strrchr(header, '/');
+#if defined(_WIN32)
+    if (strrchr(header, '\\') > sep) {
+        sep = strrchr(header, '\\');
+    }
+    if (file[0] == '\\' || (isalpha((unsigned char)file[0]) && file[1] == ':')) {
+        sep = NULL;
+    }
+#endif
+    if (sep && file[0] != '/') {
+        dir = (size_t)(sep - header) + 1;
+    }
+    res = malloc(dir + strlen(file) + 1);
+    if (res) {
+        memcpy(res, header, dir);
+        strcpy(res + dir, file);
+    }
+    return res;
+}
+
+
+/** @brief Check whether this machine is big-endian */
+static bool gamma_image_native_msb(void)
+{
+    const uint16_t one = 1;
+    unsigned char low;
+
+    memcpy(&low, &one, 1);
+    return !low;
+}
+
+
+/** @brief Convert a voxel to a double
+ *  @param src
+ *      Voxel bytes
+ *  @param type
+ *      Voxel type
+ *  @param swap
+ *      The voxel is in the other byte order
+ */
+static double gamma_image_value(const unsigned char  *src,
+                                enum gamma_image_type type,
+                                bool                  swap)
+{
+    const size_t size = gamma_image_sizes[type];
+    unsigned char buf[8];
+    union {
+        uint8_t  u8;
+        int8_t   i8;
+        uint16_t u16;
+        int16_t  i16;
+        uint32_t u32;
+        int32_t  i32;
+        float    f32;
+        double   f64;
+    } val;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        buf[i] = src[swap ? size - 1 - i : i];
+    }
+    memcpy(&val, buf, size);
+    switch (type) {
+    case GAMMA_IMAGE_U8:  return val.u8;
+    case GAMMA_IMAGE_I8:  return val.i8;
+    case GAMMA_IMAGE_U16: return val.u16;
+    case GAMMA_IMAGE_I16: return val.i16;
+    case GAMMA_IMAGE_U32: return val.u32;
+    case GAMMA_IMAGE_I32: return val.i32;
+    case GAMMA_IMAGE_F32: return val.f32;
+    case GAMMA_IMAGE_F64: return val.f64;
+    default:              return 0.0;
+    }
+}
+
+
+/** @brief Find the storage type that holds a voxel type as it is, if any
+ *  @param type
+ *      Voxel type
+ *  @param[out] storage
+ *      Receives the storage type
+ *  @returns true if @p type is a storage type, false if it must be converted
+ */
+static bool gamma_image_storage(enum gamma_image_type type,
+                                gamma_storage_t      *storage)
+{
+    switch (type) {
+    case GAMMA_IMAGE_U16:
+        *storage = GAMMA_STORAGE_U16;
+        return true;
+    case GAMMA_IMAGE_U32:
+        *storage = GAMMA_STORAGE_U32;
+        return true;
+    case GAMMA_IMAGE_F32:
+        *storage = GAMMA_STORAGE_F32;
+        return true;
+    case GAMMA_IMAGE_F64:
+        *storage = GAMMA_STORAGE_F64;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/** @brief Locate the voxels within the mapping of their file
+ *  @param hdr
+ *      Header
+ *  @param map
+ *      Mapping
+ *  @param size
+ *      Mapping size
+ *  @param base
+ *      Offset of the end of the header, if the voxels are attached, else zero
+ *  @param bytes
+ *      Size of the voxels in bytes
+ *  @param[out] offs
+ *      Receives the offset of the voxels
+ *  @returns true on success, false if the file is too short
+ */
+static bool gamma_image_locate(const struct gamma_image_header *hdr,
+                               const char                      *map,
+                               size_t                           size,
+                               size_t                           base,
+                               size_t                           bytes,
+                               size_t                          *offs)
+{
+    const char *eol;
+    long i;
+
+    for (i = 0; i < hdr->lines; i++) {
+        eol = base < size ? memchr(map + base, '\n', size - base) : NULL;
+        if (!eol) {
+            return false;
+        }
+        base = (size_t)(eol - map) + 1;
+    }
+    if (hdr->skip < 0) {
+        *offs = size - bytes;
+        return bytes <= size && *offs >= base;
+    }
+    if ((unsigned long long)hdr->skip > size - base) {
+        return false;
+    }
+    *offs = base + (size_t)hdr->skip;
+    return bytes <= size - *offs;
+}
+
+
+bool gamma_image_open(struct gamma_image *img, const char *path)
+{
+    struct gamma_image_header hdr;
+    const char *pos, *end;
+    gamma_storage_t storage;
+    gamma_mat_t matrix;
+    size_t len, size, bytes, offs, i;
+    char *file;
+    void *map;
+    bool ok, swap;
+
+    img->map = gamma_image_map(path, &img->size);
+    img->buf = NULL;
+    if (!img->map) {
+        return false;
+    }
+    pos = img->map;
+    end = pos + img->size;
+    if (!gamma_image_header(&hdr, &pos, end)) {
+        gamma_image_unmap(img->map, img->size);
+        return false;
+    }
+    offs = hdr.local ? (size_t)(pos - (const char *)img->map) : 0;
+    if (!hdr.local) {
+        gamma_image_unmap(img->map, img->size);
+        file = gamma_image_path(path, hdr.file);
+        img->map = file ? gamma_image_map(file, &img->size) : NULL;
+        free(file);
+        if (!img->map) {
+            return false;
+        }
+    }
+
+    map = img->map;
+    len = (size_t)hdr.dims.idx[0] * hdr.dims.idx[1] * hdr.dims.idx[2];
+    size = gamma_image_sizes[hdr.type];
+    bytes = len * size;
+    swap = hdr.msb != gamma_image_native_msb();
+    ok = bytes / size == len
+      && gamma_image_locate(&hdr, map, img->size, offs, bytes, &offs);
+    if (ok && (!gamma_image_storage(hdr.type, &storage) || offs % size || swap)) {
+        storage = GAMMA_STORAGE_F64;
+        img->buf = malloc(sizeof *img->buf * len + 1);
+        ok = img->buf != NULL;
+        for (i = 0; ok && i < len; i++) {
+            img->buf[i] = gamma_image_value(
+                (const unsigned char *)map + offs + i * size, hdr.type, swap);
+        }
+        gamma_image_unmap(img->map, img->size);
+        img->map = NULL;
+    }
+
+    matrix = gamma_image_matrix(&hdr);
+    ok = ok && gamma_distribution_set_storage(
+        &img->dist, &matrix, &hdr.dims, storage, 1.0, NULL,
+        img->buf ? (void *)img->buf : (char *)map + offs);
+    if (!ok) {
+        gamma_image_close(img);
+    }
+    return ok;
+}
+
+
+void gamma_image_close(struct gamma_image *img)
+{
+    if (img->map) {
+        gamma_image_unmap(img->map, img->size);
+    }
+    free(img->buf);
+    img->map = NULL;
+    img->buf = NULL;
+}
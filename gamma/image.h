@@ -0,0 +1,65 @@
+#pragma once
+
+/** @file Dose volumes loaded from MetaImage (.mha, or .mhd with a detached raw
+ *      file) and NRRD raw files. The file is memory-mapped, and if its voxels
+ *      are native-endian doubles then the distribution addresses the mapping
+ *      directly, so that loading reads only the header and pages are faulted
+ *      in as the computation reaches them. Voxels stored as floats or as 16-
+ *      or 32-bit unsigned integers are addressed directly too, in storage of
+ *      their own type
+ */
+
+#ifndef GAMMA_IMAGE_H
+#define GAMMA_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "common.h"
+#include "distribution.h"
+
+EXTERN_C_BEGIN
+
+
+/** @brief A dose volume loaded from a file */
+struct gamma_image {
+    struct gamma_distribution dist;     /* The distribution */
+    void                     *map;      /* Mapping of the voxel data file, or
+                                           NULL if the voxels were converted */
+    size_t                    size;     /* Mapping size in bytes */
+    double                   *buf;      /* Voxels converted to doubles, or NULL
+                                           if the distribution addresses the
+                                           mapping */
+};
+
+
+/** @brief Load a dose volume
+ *  @param[out] img
+ *      Image
+ *  @param path
+ *      MetaImage or NRRD header file, told apart by its first line
+ *  @returns true on success, false if the file could not be mapped, its header
+ *      is malformed or describes anything but an uncompressed scalar 3D image,
+ *      the file is too short, or memory could not be allocated
+ *  @note The affine matrix is built from the origin, spacing and direction of
+ *      the header. NRRD volumes in a right-anterior-superior space are turned
+ *      into left-posterior-superior, the space of MetaImage and DICOM, so that
+ *      volumes of either format may be compared
+ *  @note Voxels of any type without a storage type of its own, in the other
+ *      byte order, or misaligned for their type are converted into a buffer of
+ *      doubles, and the mapping is released
+ *  @note The mapping is private and writable, so that writes to the voxels
+ *      copy the pages they touch and never reach the file
+ */
+bool gamma_image_open(struct gamma_image *img, const char *path);
+
+
+/** @brief Release an image
+ *  @param img
+ *      Image, whose distribution must no longer be used
+ */
+void gamma_image_close(struct gamma_image *img);
+
+
+EXTERN_C_END
+
+#endif /* GAMMA_IMAGE_H */
@@ -3,18 +3,36 @@
 #include <Python.h>
 #include <structmember.h>
 #include <numpy/arrayobject.h>
+#include <math.h>
+#include <threads.h>
+#include <time.h>
 #include "gamma.h"
+#include "image.h"
 
 
 struct gpy_distribution {
     struct gamma_distribution dist; /* Base distribution object used by C */
     PyArrayObject            *data; /* Borrowed data reference */
+    int                       perm[3]; /* Array axis of each distribution
+                                          axis, by ascending stride */
+};
+
+
+/** @brief NumPy dtype of each storage type */
+static const int gpy_storage_types[] = {
+    [GAMMA_STORAGE_F64] = NPY_DOUBLE,
+    [GAMMA_STORAGE_F32] = NPY_FLOAT32,
+    [GAMMA_STORAGE_U16] = NPY_UINT16,
+    [GAMMA_STORAGE_U32] = NPY_UINT32,
 };
 
 
 struct gpy_results {
-    struct gamma_results res;   /* The results buffer used by the C code */
-    PyArrayObject       *arr;   /* NumPy array containing the gamma distrib. */
+    struct gamma_results *res;  /* The results buffer used by the C code */
+    PyArrayObject        *arr;  /* NumPy array containing the gamma distrib. */
+    PyArrayObject        *disp; /* Displacement map, or NULL */
+    PyArrayObject        *ddiff; /* Dose difference map, or NULL */
+    PyArrayObject        *dta;  /* Distance to agreement map, or NULL */
 };
 
 
@@ -62,6 +80,24 @@ static bool gpy_get_bool(PyObject *obj, const char *attr, bool *res)
 }
 
 
+static bool gpy_get_string(PyObject *obj, const char *attr, const char **res)
+{
+    PyObject *ptr;
+
+    ptr = PyObject_GetAttrString(obj, attr);
+    if (!ptr) {
+        return false;
+    }
+    Py_DECREF(ptr);
+    if (ptr == Py_None) {
+        *res = NULL;
+        return true;
+    }
+    *res = PyUnicode_AsUTF8(ptr);
+    return *res != NULL;
+}
+
+
 static bool gpy_get_arrayf(PyObject *obj, const char *attr,
                            size_t    len, double      arr[])
 {
@@ -131,6 +167,39 @@ static bool gpy_load_norm(PyObject *obj, gamma_norm_t *norm)
 }
 
 
+static bool gpy_load_search(PyObject *obj, gamma_search_t *search)
+{
+    const char *value;
+    PyObject *ptr;
+
+    ptr = PyObject_GetAttrString(obj, "search");
+    if (!ptr) {
+        return false;
+    }
+    Py_DECREF(ptr);
+
+    value = PyUnicode_AsUTF8(ptr);
+    if (!value) {
+        return false;
+    }
+
+    if (!strcmp(value, "PATTERN")) {
+        *search = GAMMA_SEARCH_PATTERN;
+    } else if (!strcmp(value, "EXHAUSTIVE")) {
+        *search = GAMMA_SEARCH_EXHAUSTIVE;
+    } else if (!strcmp(value, "CELLS")) {
+        *search = GAMMA_SEARCH_CELLS;
+    } else if (!strcmp(value, "BRANCH")) {
+        *search = GAMMA_SEARCH_BRANCH;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Search string \"%s\" is invalid",
+                     value);
+        return false;
+    }
+    return true;
+}
+
+
 static bool gpy_load_params(struct gamma_params *params, PyObject *obj)
 {
     return gpy_get_double(obj, "diff", &params->diff)
@@ -144,14 +213,88 @@ static bool gpy_load_params(struct gamma_params *params, PyObject *obj)
 static bool gpy_load_options(struct gamma_options *opts, PyObject *obj)
 {
     return gpy_get_bool(obj, "pass_only", &opts->pass_only)
-        && gpy_get_long(obj, "pattern_shrinks", &opts->shrinks);
+        && gpy_get_long(obj, "pattern_shrinks", &opts->shrinks)
+        && gpy_get_bool(obj, "warm_start", &opts->warm)
+        && gpy_load_search(obj, &opts->search)
+        && gpy_get_long(obj, "subdivisions", &opts->subdiv)
+        && gpy_get_double(obj, "radius", &opts->radius)
+        && gpy_get_long(obj, "threads", &opts->threads)
+        && gpy_get_string(obj, "trace", &opts->trace);
+}
+
+
+static bool gpy_load_storage(PyArrayObject *arr, gamma_storage_t *storage)
+{
+    size_t i;
+
+    for (i = 0; i < BUFLEN(gpy_storage_types); i++) {
+        if (PyArray_TYPE(arr) == gpy_storage_types[i]) {
+            *storage = (gamma_storage_t)i;
+            return true;
+        }
+    }
+    PyErr_SetString(PyExc_TypeError, "Dose data array must have dtype double, "
+                                     "float32, uint16 or uint32");
+    return false;
+}
+
+
+/** @brief Order the axes of a dose array by the magnitude of their strides and
+ *      find their element strides, so that the distribution runs along memory
+ *      whatever the layout of the array
+ *  @param dist
+ *      Distribution whose data array to read, and whose axis order to set
+ *  @param[out] strides
+ *      Element strides of the axes of the distribution
+ *  @returns true on success, false with an exception set if the array is not
+ *      three-dimensional, is misaligned, or has strides that are not whole
+ *      elements or are too large
+ */
+static bool gpy_load_strides(struct gpy_distribution *dist, ptrdiff_t strides[3])
+{
+    const npy_intp size = PyArray_ITEMSIZE(dist->data);
+    npy_intp stride, mags[3];
+    int i, j;
+
+    if (PyArray_NDIM(dist->data) != 3) {
+        PyErr_SetString(PyExc_ValueError, "Dose data must be three-dimensional");
+        return false;
+    }
+    if (!PyArray_ISALIGNED(dist->data)) {
+        PyErr_SetString(PyExc_ValueError, "Dose data must be aligned");
+        return false;
+    }
+    for (i = 0; i < 3; i++) {
+        stride = PyArray_STRIDE(dist->data, i);
+        if (stride % size || stride / size < -INT32_MAX
+                          || stride / size > INT32_MAX) {
+            PyErr_SetString(PyExc_ValueError, "Dose data strides must be whole "
+                                              "elements that fit 32 bits");
+            return false;
+        }
+        mags[i] = stride < 0 ? -stride : stride;
+        /* Stable insertion sort, so that equal strides keep their order */
+        for (j = i; j > 0 && mags[dist->perm[j - 1]] > mags[i]; j--) {
+            dist->perm[j] = dist->perm[j - 1];
+        }
+        dist->perm[j] = i;
+    }
+    for (i = 0; i < 3; i++) {
+        strides[i] = PyArray_STRIDE(dist->data, dist->perm[i]) / size;
+        dist->dist.dims.idx[i] = (gamma_iscal_t)PyArray_DIM(dist->data,
+                                                            dist->perm[i]);
+    }
+    return true;
 }
 
 
 static bool gpy_load_distribution(struct gpy_distribution *dist, PyObject *obj)
 {
-    double buffer[9];
-    npy_intp *dims;
+    gamma_storage_t storage;
+    double buffer[9], scale;
+    ptrdiff_t strides[3];
+    gamma_mat_t matr;
+    int i;
 
     if (!gpy_get_arrayf(obj, "matrix", 9, buffer)) {
         return false;
@@ -196,18 +339,26 @@ static bool gpy_load_distribution(struct gpy_distribution *dist, PyObject *obj)
         return false;
     }
 
-    if (PyArray_TYPE((PyArrayObject *)dist->data) != NPY_DOUBLE) {
-        PyErr_SetString(PyExc_TypeError,
-                        "Dose data array must have dtype=double");
+    if (!gpy_load_storage(dist->data, &storage)
+     || !gpy_get_double(obj, "scale", &scale)) {
+        return false;
+    }
+    if (!(scale > 0.0)) {
+        PyErr_SetString(PyExc_ValueError, "Dose scale must be positive");
+        return false;
+    }
+    if (!gpy_load_strides(dist, strides)) {
         return false;
     }
-    dims = PyArray_DIMS((PyArrayObject *)dist->data);
-    dist->dist.dims.idx[0] = dims[0];
-    dist->dist.dims.idx[1] = dims[1];
-    dist->dist.dims.idx[2] = dims[2];
 
-    if (!gamma_distribution_set(&dist->dist, &dist->dist.matrix, &dist->dist.dims,
-                                PyArray_DATA((PyArrayObject *)dist->data))) {
+    /* The columns follow the axes into stride order, which moves no voxel */
+    matr = dist->dist.matrix;
+    for (i = 0; i < 3; i++) {
+        matr.cols[i] = dist->dist.matrix.cols[dist->perm[i]];
+    }
+    if (!gamma_distribution_set_storage(&dist->dist, &matr, &dist->dist.dims,
+                                        storage, scale, strides,
+                                        PyArray_DATA(dist->data))) {
         PyErr_SetString(PyExc_ArithmeticError, "Affine matrix is singular");
         return false;
     }
@@ -256,26 +407,339 @@ static bool gpy_write_array(PyArrayObject *arr, PyObject *obj, const char *attr)
 }
 
 
+#if defined(GAMMA_COUNTERS)
+
+static bool gpy_set_counter(PyObject *dict, const char *key, PyObject *node)
+{
+    bool res;
+
+    if (!node) {
+        return false;
+    }
+    res = !PyDict_SetItemString(dict, key, node);
+    Py_DECREF(node);
+    return res;
+}
+
+
+static bool gpy_write_counters(const struct gamma_counters *cnt,
+                               PyObject                    *obj)
+{
+    PyObject *dict, *hist;
+    bool res;
+    int i;
+
+    dict = PyDict_New();
+    hist = PyList_New(GAMMA_COUNTER_BINS);
+    res = dict && hist;
+    for (i = 0; res && i < GAMMA_COUNTER_BINS; i++) {
+        PyList_SET_ITEM(hist, i, PyLong_FromLongLong(cnt->hist[i]));
+        res = PyList_GET_ITEM(hist, i) != NULL;
+    }
+    res = res
+        && gpy_set_counter(dict, "evals", PyLong_FromLongLong(cnt->evals))
+        && gpy_set_counter(dict, "iterations", PyLong_FromLongLong(cnt->iters))
+        && gpy_set_counter(dict, "shrinks", PyLong_FromLongLong(cnt->shrinks))
+        && gpy_set_counter(dict, "skipped", PyLong_FromLongLong(cnt->skipped))
+        && gpy_set_counter(dict, "out_of_bounds", PyLong_FromLongLong(cnt->oob))
+        && !PyDict_SetItemString(dict, "histogram", hist)
+        && !PyObject_SetAttrString(obj, "counters", dict);
+    Py_XDECREF(hist);
+    Py_XDECREF(dict);
+    return res;
+}
+
+#else
+
+static bool gpy_write_counters(const struct gamma_counters *cnt,
+                               PyObject                    *obj)
+{
+    (void)cnt;
+    return !PyObject_SetAttrString(obj, "counters", Py_None);
+}
+
+#endif
+
+
+/** @brief Hand a map of the results over to an attribute, if there is one */
+static bool gpy_write_map(PyArrayObject **arr, PyObject *obj, const char *attr)
+{
+    PyArrayObject *map = *arr;
+
+    *arr = NULL;
+    return !map || gpy_write_array(map, obj, attr);
+}
+
+
 static bool gpy_write_results(struct gpy_results *res, PyObject *obj)
 {
-    return gpy_write_long(res->res.stats.total, obj, "total")
-        && gpy_write_long(res->res.pass, obj, "passed")
-        && gpy_write_double(res->res.stats.min, obj, "min")
-        && gpy_write_double(res->res.stats.max, obj, "max")
-        && gpy_write_double(res->res.stats.mean, obj, "mean")
-        && gpy_write_double(res->res.stats.msqr, obj, "msqr")
-        && gpy_write_array(res->arr, obj, "dist");
+    return gpy_write_long(res->res->stats.total, obj, "total")
+        && gpy_write_long(res->res->pass, obj, "passed")
+        && gpy_write_double(res->res->stats.min, obj, "min")
+        && gpy_write_double(res->res->stats.max, obj, "max")
+        && gpy_write_double(res->res->stats.mean, obj, "mean")
+        && gpy_write_double(res->res->stats.msqr, obj, "msqr")
+        && gpy_write_counters(&res->res->counters, obj)
+        && gpy_write_map(&res->arr, obj, "dist")
+        && gpy_write_map(&res->disp, obj, "disp")
+        && gpy_write_map(&res->ddiff, obj, "ddiff")
+        && gpy_write_map(&res->dta, obj, "dta");
+}
+
+
+/** @brief Allocate a map over a measured dose distribution
+ *  @param meas
+ *      Measured dose distribution
+ *  @param comps
+ *      Values per voxel, one or three
+ *  @param[out] buf
+ *      Receives the buffer of the map, which is dense in the axis order of the
+ *      distribution with the values of each voxel together
+ *  @returns The map, in the axis order of the measured dose array and with
+ *      the values of each voxel along a last axis if more than one, or NULL
+ *      with an exception set on failure
+ */
+static PyArrayObject *gpy_new_map(const struct gpy_distribution *meas,
+                                  int                            comps,
+                                  double                       **buf)
+{
+    npy_intp dims[4], inv[4];
+    PyArrayObject *arr, *res;
+    const int lead = comps > 1;
+    int i;
+
+    dims[0] = comps;
+    inv[3] = 0;
+    for (i = 0; i < 3; i++) {
+        dims[1 + i] = meas->dist.dims.idx[i];
+        inv[meas->perm[i]] = lead + i;
+    }
+    arr = (PyArrayObject *)PyArray_EMPTY(3 + lead, dims + !lead, NPY_DOUBLE, 1);
+    if (!arr) {
+        return NULL;
+    }
+    *buf = PyArray_DATA(arr);
+    res = (PyArrayObject *)PyArray_Transpose(
+        arr, &(PyArray_Dims){ .ptr = inv, .len = 3 + lead });
+    Py_DECREF(arr);
+    return res;
+}
+
+
+/** @brief Allocate the gamma array of a measured dose distribution
+ *  @param[out] res
+ *      Results, whose buffers are dense in the axis order of the distribution
+ *      and whose arrays keep the axis order of the measured dose array
+ *  @param buf
+ *      Results buffer to point the C code to the arrays with
+ *  @param meas
+ *      Measured dose distribution
+ *  @param maps
+ *      Allocate the diagnostic maps too
+ *  @param dta
+ *      Allocate the distance to agreement map too
+ *  @returns true on success, false with an exception set on failure
+ */
+static bool gpy_new_results(struct gpy_results            *res,
+                            struct gamma_results          *buf,
+                            const struct gpy_distribution *meas,
+                            bool                           maps,
+                            bool                           dta)
+{
+    *buf = (const struct gamma_results){ .dist = NULL };
+    res->res = buf;
+    res->disp = res->ddiff = res->dta = NULL;
+    res->arr = gpy_new_map(meas, 1, &buf->dist);
+    if (res->arr && maps) {
+        res->disp = gpy_new_map(meas, 3, &buf->disp);
+        res->ddiff = gpy_new_map(meas, 1, &buf->ddiff);
+    }
+    if (res->arr && dta) {
+        res->dta = gpy_new_map(meas, 1, &buf->dta);
+    }
+    return res->arr && (!maps || (res->disp && res->ddiff))
+                    && (!dta || res->dta);
+}
+
+
+/** @brief A computation, holding the Python objects it reads while it runs
+ *      without the GIL
+ */
+struct gpy_job {
+    size_t                  count;  /* Criterion count */
+    struct gamma_params    *params; /* Parameters of each criterion */
+    struct gamma_options    opts;   /* Options */
+    struct gpy_distribution ref;    /* Reference dose */
+    struct gpy_distribution meas;   /* Measured dose */
+    struct gamma_results   *out;    /* Results buffer of each criterion */
+    struct gpy_results     *res;    /* Results of each criterion, with owned
+                                       gamma arrays */
+    PyObject               *pins[3]; /* The dose arrays and the trace file
+                                        name, kept alive until the job ends */
+    bool                    ok;     /* The computation succeeded */
+};
+
+
+/** @brief Release the objects and buffers held by a job */
+static void gpy_job_release(struct gpy_job *job)
+{
+    size_t i;
+
+    for (i = 0; i < BUFLEN(job->pins); i++) {
+        Py_CLEAR(job->pins[i]);
+    }
+    for (i = 0; i < job->count; i++) {
+        Py_CLEAR(job->res[i].arr);
+        Py_CLEAR(job->res[i].disp);
+        Py_CLEAR(job->res[i].ddiff);
+        Py_CLEAR(job->res[i].dta);
+    }
+    free(job->params);
+    free(job->out);
+    free(job->res);
+    job->params = NULL;
+    job->out = NULL;
+    job->res = NULL;
+    job->count = 0;
+}
+
+
+/** @brief Load a job from the arguments of `compute` or `compute_sweep`
+ *  @param[out] job
+ *      Job, which holds new references on success, and nothing on failure
+ *  @param count
+ *      Criterion count, at least one
+ *  @param pyparms
+ *      Parameters of each criterion
+ *  @returns true on success, false with an exception set on failure
+ */
+static bool gpy_job_load(struct gpy_job  *job,
+                         size_t           count,
+                         PyObject *const *pyparms,
+                         PyObject        *pyopts,
+                         PyObject        *pyref,
+                         PyObject        *pymeas)
+{
+    bool maps, dta;
+    size_t i;
+
+    job->pins[0] = job->pins[1] = job->pins[2] = NULL;
+    job->count = 0;
+    job->ok = false;
+    job->params = malloc(sizeof *job->params * count);
+    job->out = malloc(sizeof *job->out * count);
+    job->res = malloc(sizeof *job->res * count);
+    if (!job->params || !job->out || !job->res) {
+        gpy_job_release(job);
+        PyErr_NoMemory();
+        return false;
+    }
+    job->count = count;
+    for (i = 0; i < count; i++) {
+        job->res[i] = (const struct gpy_results){ .arr = NULL };
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!gpy_load_params(&job->params[i], pyparms[i])) {
+            gpy_job_release(job);
+            return false;
+        }
+    }
+    if (!gpy_load_options(&job->opts, pyopts)
+     || !gpy_get_bool(pyopts, "diagnostics", &maps)
+     || !gpy_get_bool(pyopts, "dta_map", &dta)
+     || !gpy_load_distribution(&job->ref, pyref)
+     || !gpy_load_distribution(&job->meas, pymeas)) {
+        gpy_job_release(job);
+        return false;
+    }
+    if (dta && job->opts.search != GAMMA_SEARCH_CELLS
+            && job->opts.search != GAMMA_SEARCH_BRANCH) {
+        PyErr_SetString(PyExc_ValueError, "Only the CELLS and BRANCH searches "
+                                          "can map the distance to agreement");
+        gpy_job_release(job);
+        return false;
+    }
+
+    /* Another thread may rebind the attributes while the GIL is released */
+    Py_INCREF(job->ref.data);
+    Py_INCREF(job->meas.data);
+    job->pins[0] = (PyObject *)job->ref.data;
+    job->pins[1] = (PyObject *)job->meas.data;
+    job->pins[2] = PyObject_GetAttrString(pyopts, "trace");
+    for (i = 0; job->pins[2] && i < count; i++) {
+        if (!gpy_new_results(&job->res[i], &job->out[i], &job->meas, maps,
+                             dta)) {
+            break;
+        }
+    }
+    if (!job->pins[2] || i < count) {
+        gpy_job_release(job);
+        return false;
+    }
+    return true;
+}
+
+
+/** @brief Run a job, which needs no GIL */
+static void gpy_job_run(struct gpy_job *job)
+{
+    job->ok = gamma_compute_sweep(job->params, job->count, &job->opts,
+                                  &job->ref.dist, &job->meas.dist, job->out);
+}
+
+
+/** @brief Check whether the lattice of a distribution is degenerate, as the
+ *      search engines test it
+ *  @param dist
+ *      Distribution
+ *  @returns true if the lattice basis is singular
+ */
+static bool gpy_lattice_singular(const struct gamma_distribution *dist)
+{
+    gamma_mat_t lattice = dist->matrix;
+
+    lattice.cols[3] = gamma_mat_identity.cols[3];
+    return !gamma_mat_invert(&lattice);
+}
+
+
+/** @brief Write out the results of a job that has run, and release it
+ *  @param job
+ *      Job
+ *  @param pyres
+ *      Results object of each criterion
+ *  @returns true on success, false with an exception set on failure
+ */
+static bool gpy_job_finish(struct gpy_job *job, PyObject *const *pyres)
+{
+    bool res = true;
+    size_t i;
+
+    if (!job->ok) {
+        /* A run fails on a degenerate lattice or else for want of memory */
+        if (gpy_lattice_singular(&job->ref.dist)
+         || gpy_lattice_singular(&job->meas.dist)) {
+            PyErr_SetString(PyExc_ArithmeticError, "Dose lattice is singular");
+        } else {
+            PyErr_NoMemory();
+        }
+        gpy_job_release(job);
+        return false;
+    }
+    for (i = 0; res && i < job->count; i++) {
+        res = gpy_write_results(&job->res[i], pyres[i]);
+    }
+    gpy_job_release(job);
+    return res;
 }
 
 
 static PyObject *gpy_compute(PyObject *self, PyObject *args)
 {
     PyObject *pyparms, *pyopts, *pyref, *pymeas, *pyres;
-    struct gamma_params params;
-    struct gamma_options opts;
-    struct gpy_distribution ref, meas;
-    struct gpy_results res;
-    bool code;
+    struct gpy_job *job;
+    bool res;
 
     (void)self;
     if (!PyArg_ParseTuple(args, "OOOOO", &pyparms, &pyopts,
@@ -283,24 +747,425 @@ static PyObject *gpy_compute(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    if (!gpy_load_params(&params, pyparms)
-     || !gpy_load_options(&opts, pyopts)
-     || !gpy_load_distribution(&ref, pyref)
-     || !gpy_load_distribution(&meas, pymeas)) {
+    /* The distributions hold vectors aligned beyond what malloc promises */
+    job = gamma_aligned_alloc(alignof (struct gpy_job), sizeof *job);
+    if (!job) {
+        return PyErr_NoMemory();
+    }
+    if (!gpy_job_load(job, 1, &pyparms, pyopts, pyref, pymeas)) {
+        gamma_aligned_free(job);
         return NULL;
     }
+    Py_BEGIN_ALLOW_THREADS
+    gpy_job_run(job);
+    Py_END_ALLOW_THREADS
+    res = gpy_job_finish(job, &pyres);
+    gamma_aligned_free(job);
+    if (!res) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *gpy_compute_sweep(PyObject *self, PyObject *args)
+{
+    PyObject *pyparms, *pyopts, *pyref, *pymeas, *pyres, *parms, *outs;
+    struct gpy_job *job;
+    Py_ssize_t count;
+    bool res;
 
-    res.arr = (PyArrayObject *)PyArray_NewLikeArray(meas.data, NPY_KEEPORDER, NULL, 1);
-    if (!res.arr) {
+    (void)self;
+    if (!PyArg_ParseTuple(args, "OOOOO", &pyparms, &pyopts,
+                                         &pyref, &pymeas, &pyres)) {
+        return NULL;
+    }
+    parms = PySequence_Fast(pyparms, "Parameters must be a sequence");
+    if (!parms) {
+        return NULL;
+    }
+    outs = PySequence_Fast(pyres, "Results must be a sequence");
+    if (!outs) {
+        Py_DECREF(parms);
+        return NULL;
+    }
+    count = PySequence_Fast_GET_SIZE(parms);
+    if (count != PySequence_Fast_GET_SIZE(outs)) {
+        PyErr_SetString(PyExc_ValueError, "Expected one results object for "
+                                          "each set of parameters");
+        res = false;
+    } else if (!count) {
+        res = true;
+    } else if (!(job = gamma_aligned_alloc(alignof (struct gpy_job),
+                                           sizeof *job))) {
+        PyErr_NoMemory();
+        res = false;
+    } else {
+        res = gpy_job_load(job, (size_t)count, PySequence_Fast_ITEMS(parms),
+                           pyopts, pyref, pymeas);
+        if (res) {
+            Py_BEGIN_ALLOW_THREADS
+            gpy_job_run(job);
+            Py_END_ALLOW_THREADS
+            res = gpy_job_finish(job, PySequence_Fast_ITEMS(outs));
+        }
+        gamma_aligned_free(job);
+    }
+    Py_DECREF(parms);
+    Py_DECREF(outs);
+    if (!res) {
         return NULL;
     }
-    res.res.dist = PyArray_DATA(res.arr);
+    Py_RETURN_NONE;
+}
+
+
+/** @brief A job running on a thread of its own, from which it drives the
+ *      thread pool
+ */
+struct gpy_task {
+    PyObject_HEAD
+    struct gpy_job *job;     /* Job, or NULL once finished */
+    PyObject       *res;     /* Results object to write to */
+    thrd_t          thrd;    /* Thread running the job */
+    mtx_t           lock;    /* Guards done, joining and joined */
+    cnd_t           cond;    /* Signals done and joined */
+    bool            done;    /* The job has run */
+    bool            joining; /* A waiter has claimed the join */
+    bool            joined;  /* The thread has been joined */
+    bool            sync;    /* The lock and condition are initialized */
+};
+
+
+static int gpy_task_main(void *arg)
+{
+    struct gpy_task *task = arg;
+
+    gpy_job_run(task->job);
+    mtx_lock(&task->lock);
+    task->done = true;
+    cnd_broadcast(&task->cond);
+    mtx_unlock(&task->lock);
+    return 0;
+}
+
+
+/** @brief Wait for the job of a task to have run and its thread to have been
+ *      joined, without the GIL
+ *  @param task
+ *      Task
+ *  @param timeout
+ *      Seconds to wait, or less than zero to wait for as long as it takes
+ *  @returns true if the job has run
+ *  @note The first waiter to see the job done claims the join, and any other
+ *      waits for it to finish rather than joining the thread again
+ */
+static bool gpy_task_join(struct gpy_task *task, double timeout)
+{
+    struct timespec until;
+    double secs;
+    bool res = false, claim = false;
+
+    Py_BEGIN_ALLOW_THREADS
+    if (timeout >= 0.0) {
+        timespec_get(&until, TIME_UTC);
+        secs = floor(timeout);
+        until.tv_sec += (time_t)secs;
+        until.tv_nsec += (long)(1e9 * (timeout - secs));
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+    }
+    mtx_lock(&task->lock);
+    for (;;) {
+        if (task->joined) {
+            res = true;
+            break;
+        }
+        if (task->done && !task->joining) {
+            task->joining = claim = true;
+            break;
+        }
+        if (timeout < 0.0) {
+            cnd_wait(&task->cond, &task->lock);
+        } else if (cnd_timedwait(&task->cond, &task->lock, &until)
+                   != thrd_success) {
+            break;
+        }
+    }
+    mtx_unlock(&task->lock);
+    if (claim) {
+        thrd_join(task->thrd, NULL);
+        mtx_lock(&task->lock);
+        task->joined = res = true;
+        cnd_broadcast(&task->cond);
+        mtx_unlock(&task->lock);
+    }
+    Py_END_ALLOW_THREADS
+    return res;
+}
+
 
-    gamma_compute(&params, &opts, &ref.dist, &meas.dist, &res.res);
-    code = gpy_write_results(&res, pyres);
-    Py_DECREF(res.res.dist);
+static void gpy_task_dealloc(PyObject *self)
+{
+    struct gpy_task *task = (struct gpy_task *)self;
 
-    return code ? Py_None : NULL;
+    /* A task dropped unwaited still has to finish before its job goes */
+    if (task->job) {
+        gpy_task_join(task, -1.0);
+        gpy_job_release(task->job);
+        gamma_aligned_free(task->job);
+    }
+    if (task->sync) {
+        mtx_destroy(&task->lock);
+        cnd_destroy(&task->cond);
+    }
+    Py_XDECREF(task->res);
+    Py_TYPE(self)->tp_free(self);
+}
+
+
+static PyObject *gpy_task_done(PyObject *self, PyObject *args)
+{
+    struct gpy_task *task = (struct gpy_task *)self;
+    bool res;
+
+    (void)args;
+    Py_BEGIN_ALLOW_THREADS
+    mtx_lock(&task->lock);
+    res = task->done;
+    mtx_unlock(&task->lock);
+    Py_END_ALLOW_THREADS
+    return PyBool_FromLong(res);
+}
+
+
+static PyObject *gpy_task_wait(PyObject *self, PyObject *args)
+{
+    struct gpy_task *task = (struct gpy_task *)self;
+    PyObject *pytimeout = Py_None;
+    struct gpy_job *job;
+    double timeout = -1.0;
+    bool res;
+
+    if (!PyArg_ParseTuple(args, "|O", &pytimeout)) {
+        return NULL;
+    }
+    if (pytimeout != Py_None) {
+        timeout = PyFloat_AsDouble(pytimeout);
+        if (timeout == -1.0 && PyErr_Occurred()) {
+            return NULL;
+        }
+        timeout = fmax(timeout, 0.0);
+    }
+    if (!gpy_task_join(task, timeout)) {
+        Py_RETURN_FALSE;
+    }
+    if (task->job) {
+        /* Writing the results may let another waiter in, so take the job */
+        job = task->job;
+        task->job = NULL;
+        res = gpy_job_finish(job, &task->res);
+        gamma_aligned_free(job);
+        if (!res) {
+            return NULL;
+        }
+    }
+    Py_RETURN_TRUE;
+}
+
+
+static PyMethodDef gpy_task_methods[] = {
+    {
+        .ml_name  = "done",
+        .ml_meth  = gpy_task_done,
+        .ml_flags = METH_NOARGS,
+        .ml_doc   = "Check whether the computation has finished",
+    },
+    {
+        .ml_name  = "wait",
+        .ml_meth  = gpy_task_wait,
+        .ml_flags = METH_VARARGS,
+        .ml_doc   = "Wait up to a timeout in seconds, or for as long as it "
+                    "takes if None, for the computation to finish and its "
+                    "results to be written. Returns whether it finished",
+    },
+    { 0 }
+};
+
+
+static PyTypeObject gpy_task_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name      = "cgamma.Task",
+    .tp_doc       = "A gamma index computation running in the background",
+    .tp_basicsize = sizeof (struct gpy_task),
+    .tp_flags     = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc   = gpy_task_dealloc,
+    .tp_methods   = gpy_task_methods,
+};
+
+
+static PyObject *gpy_compute_async(PyObject *self, PyObject *args)
+{
+    PyObject *pyparms, *pyopts, *pyref, *pymeas, *pyres;
+    struct gpy_task *task;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "OOOOO", &pyparms, &pyopts,
+                                         &pyref, &pymeas, &pyres)) {
+        return NULL;
+    }
+
+    task = PyObject_New(struct gpy_task, &gpy_task_type);
+    if (!task) {
+        return NULL;
+    }
+    Py_INCREF(pyres);
+    task->res = pyres;
+    task->done = task->joining = false;
+    task->joined = true;
+    task->sync = false;
+    task->job = NULL;
+    if (mtx_init(&task->lock, mtx_plain) != thrd_success) {
+        Py_DECREF(task);
+        PyErr_SetString(PyExc_RuntimeError, "Could not create a lock");
+        return NULL;
+    }
+    if (cnd_init(&task->cond) != thrd_success) {
+        mtx_destroy(&task->lock);
+        Py_DECREF(task);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Could not create a condition variable");
+        return NULL;
+    }
+    task->sync = true;
+    task->job = gamma_aligned_alloc(alignof (struct gpy_job), sizeof *task->job);
+    if (!task->job) {
+        Py_DECREF(task);
+        return PyErr_NoMemory();
+    }
+    if (!gpy_job_load(task->job, 1, &pyparms, pyopts, pyref, pymeas)) {
+        gamma_aligned_free(task->job);
+        task->job = NULL;
+        Py_DECREF(task);
+        return NULL;
+    }
+    if (thrd_create(&task->thrd, gpy_task_main, task) != thrd_success) {
+        gpy_job_release(task->job);
+        gamma_aligned_free(task->job);
+        task->job = NULL;
+        Py_DECREF(task);
+        PyErr_SetString(PyExc_RuntimeError, "Could not start a thread");
+        return NULL;
+    }
+    task->joined = false;
+    return (PyObject *)task;
+}
+
+
+static void gpy_image_free(PyObject *capsule)
+{
+    struct gamma_image *img;
+
+    img = PyCapsule_GetPointer(capsule, NULL);
+    gamma_image_close(img);
+    gamma_aligned_free(img);
+}
+
+
+static bool gpy_write_image(struct gamma_image *img, PyObject *obj)
+{
+    npy_intp mdims[] = { 3, 3 }, vdims[] = { 3, 1 }, dims[3];
+    PyArrayObject *matr, *orig, *spac, *data;
+    const gamma_mat_t *m = &img->dist.matrix;
+    double *mbuf, *obuf, *sbuf;
+    PyObject *capsule;
+    bool res;
+    int i, j;
+
+    capsule = PyCapsule_New(img, NULL, gpy_image_free);
+    if (!capsule) {
+        gamma_image_close(img);
+        gamma_aligned_free(img);
+        return false;
+    }
+    for (i = 0; i < 3; i++) {
+        dims[i] = img->dist.dims.idx[i];
+    }
+    data = (PyArrayObject *)PyArray_New(
+        &PyArray_Type, 3, dims, gpy_storage_types[img->dist.storage], NULL,
+        img->dist.data, 0, NPY_ARRAY_FARRAY, NULL);
+    if (!data) {
+        Py_DECREF(capsule);
+        return false;
+    }
+    if (PyArray_SetBaseObject(data, capsule)) {
+        Py_DECREF(data);
+        return false;
+    }
+
+    matr = (PyArrayObject *)PyArray_SimpleNew(2, mdims, NPY_DOUBLE);
+    orig = (PyArrayObject *)PyArray_SimpleNew(2, vdims, NPY_DOUBLE);
+    spac = (PyArrayObject *)PyArray_SimpleNew(2, vdims, NPY_DOUBLE);
+    if (!matr || !orig || !spac) {
+        Py_XDECREF(matr);
+        Py_XDECREF(orig);
+        Py_XDECREF(spac);
+        Py_DECREF(data);
+        return false;
+    }
+    mbuf = PyArray_DATA(matr);
+    obuf = PyArray_DATA(orig);
+    sbuf = PyArray_DATA(spac);
+    for (i = 0; i < 3; i++) {
+        sbuf[i] = sqrt(gamma_vec_dp(&m->cols[i], &m->cols[i]));
+        for (j = 0; j < 3; j++) {
+            mbuf[3 * i + j] = m->cols[i].vec[j] / sbuf[i];
+        }
+        obuf[i] = m->cols[3].vec[i];
+    }
+
+    res = gpy_write_double(img->dist.scale, obj, "scale");
+    res = gpy_write_array(matr, obj, "matrix") && res;
+    res = gpy_write_array(orig, obj, "origin") && res;
+    res = gpy_write_array(spac, obj, "spacing") && res;
+    return gpy_write_array(data, obj, "data") && res;
+}
+
+
+static PyObject *gpy_load(PyObject *self, PyObject *args)
+{
+    struct gamma_image *img;
+    PyObject *path, *pydist;
+    bool ok;
+
+    (void)self;
+    if (!PyArg_ParseTuple(args, "O&O", PyUnicode_FSConverter, &path, &pydist)) {
+        return NULL;
+    }
+
+    img = gamma_aligned_alloc(alignof (struct gamma_image), sizeof *img);
+    if (!img) {
+        Py_DECREF(path);
+        return PyErr_NoMemory();
+    }
+    Py_BEGIN_ALLOW_THREADS
+    ok = gamma_image_open(img, PyBytes_AS_STRING(path));
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_Format(PyExc_OSError, "Could not load dose volume \"%s\"",
+                     PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        gamma_aligned_free(img);
+        return NULL;
+    }
+    Py_DECREF(path);
+
+    if (!gpy_write_image(img, pydist)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
 
@@ -313,6 +1178,26 @@ PyMODINIT_FUNC PyInit_cgamma(void)
             .ml_flags = METH_VARARGS,
             .ml_doc   = "Compute the gamma index",
         },
+        {
+            .ml_name  = "compute_sweep",
+            .ml_meth  = gpy_compute_sweep,
+            .ml_flags = METH_VARARGS,
+            .ml_doc   = "Compute the gamma index for several criteria in "
+                        "one pass, which shares samples between them only "
+                        "under the exhaustive search",
+        },
+        {
+            .ml_name  = "compute_async",
+            .ml_meth  = gpy_compute_async,
+            .ml_flags = METH_VARARGS,
+            .ml_doc   = "Start computing the gamma index in the background",
+        },
+        {
+            .ml_name  = "load",
+            .ml_meth  = gpy_load,
+            .ml_flags = METH_VARARGS,
+            .ml_doc   = "Memory-map a MetaImage or NRRD dose volume",
+        },
         { 0 }
     };
     static struct PyModuleDef module = {
@@ -323,5 +1208,8 @@ PyMODINIT_FUNC PyInit_cgamma(void)
     };
 
     import_array();
+    if (PyType_Ready(&gpy_task_type)) {
+        return NULL;
+    }
     return PyModuleDef_Init(&module);
 }
@@ -0,0 +1,350 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <threads.h>
+#include "pool.h"
+
+#if defined(_WIN32)
+#   include <windows.h>
+
+#elif defined(__unix__) || defined(__APPLE__)
+#   include <pthread.h>
+#   include <unistd.h>
+#   define GAMMA_POOL_POSIX 1
+
+#endif
+
+
+/** @brief The remaining tasks of one worker, as a range packed into a single
+ *      atomic so that its owner and thieves may both claim tasks with a CAS.
+ *      Padded out to a cache line so that workers never contend for it falsely
+ */
+struct gamma_slot {
+    alignas (64) atomic_uint_least64_t range;   /* First task in the high half,
+                                                   one past the last in the
+                                                   low half */
+};
+
+
+/** @brief A job in progress */
+struct gamma_job {
+    gamma_pool_task_t *func;    /* Task callback */
+    void              *data;    /* Task callback data */
+    int                workers; /* Workers taking part, including the caller */
+    struct gamma_slot *slots;   /* Remaining tasks of each worker */
+};
+
+
+/** @brief Startup parameters of a pool thread */
+struct gamma_worker {
+    int           id;   /* Worker index, from one, as the caller is zero */
+    unsigned long gen;  /* Last job generation dispatched before it started */
+};
+
+
+/** @brief The persistent pool */
+static struct gamma_pool {
+    mtx_t                   run;    /* Held for the whole of a job */
+    mtx_t                   lock;   /* Guards everything below */
+    cnd_t                   wake;   /* Signals a new job or shutdown */
+    cnd_t                   done;   /* Signals the last worker finishing */
+    thrd_t                 *thrds;  /* Pool threads */
+    int                     size;   /* Pool thread count */
+    int                     busy;   /* Pool threads still in the job */
+    unsigned long           gen;    /* Job generation */
+    struct gamma_job       *job;    /* Current job */
+    bool                    quit;   /* Threads are to exit */
+} gamma_pool;
+
+
+static once_flag gamma_pool_once = ONCE_FLAG_INIT;
+
+
+/** @brief Pack a task range */
+static uint_least64_t gamma_slot_pack(uint_least64_t first, uint_least64_t last)
+{
+    return first << 32 | last;
+}
+
+
+/** @brief Claim the next task of a worker's own range
+ *  @param slot
+ *      The worker's slot
+ *  @param[out] task
+ *      Receives the task
+ *  @returns true if a task was claimed, false if the range is empty
+ */
+static bool gamma_slot_pop(struct gamma_slot *slot, size_t *task)
+{
+    uint_least64_t range, first, last;
+
+    range = atomic_load(&slot->range);
+    do {
+        first = range >> 32;
+        last = range & UINT32_MAX;
+        if (first >= last) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&slot->range, &range,
+                                           gamma_slot_pack(first + 1, last)));
+    *task = (size_t)first;
+    return true;
+}
+
+
+/** @brief Steal the upper half of the remaining tasks of another worker
+ *  @param job
+ *      Job
+ *  @param id
+ *      The thief, whose own range must be empty
+ *  @returns true if any tasks were stolen into the thief's range
+ */
+static bool gamma_job_steal(struct gamma_job *job, int id)
+{
+    struct gamma_slot *victim;
+    uint_least64_t range, first, last, half;
+    int i;
+
+    for (i = 1; i < job->workers; i++) {
+        victim = &job->slots[(id + i) % job->workers];
+        range = atomic_load(&victim->range);
+        do {
+            first = range >> 32;
+            last = range & UINT32_MAX;
+            half = (last - first + 1) / 2;
+            if (first >= last) {
+                break;
+            }
+        } while (!atomic_compare_exchange_weak(&victim->range, &range,
+                                               gamma_slot_pack(first,
+                                                               last - half)));
+        if (first < last) {
+            atomic_store(&job->slots[id].range,
+                         gamma_slot_pack(last - half, last));
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** @brief Work on a job until no tasks are left to claim
+ *  @param job
+ *      Job
+ *  @param id
+ *      Worker index
+ */
+static void gamma_job_work(struct gamma_job *job, int id)
+{
+    size_t task;
+
+    for (;;) {
+        if (gamma_slot_pop(&job->slots[id], &task)) {
+            job->func(task, id, job->data);
+        } else if (!gamma_job_steal(job, id)) {
+            break;
+        }
+    }
+}
+
+
+/** @brief Pool thread body
+ *  @param arg
+ *      Heap-allocated `struct gamma_worker`, which this frees
+ *  @returns Zero
+ */
+static int gamma_pool_worker(void *arg)
+{
+    struct gamma_worker self = *(struct gamma_worker *)arg;
+    struct gamma_job *job;
+
+    free(arg);
+    mtx_lock(&gamma_pool.lock);
+    for (;;) {
+        while (!gamma_pool.quit && gamma_pool.gen == self.gen) {
+            cnd_wait(&gamma_pool.wake, &gamma_pool.lock);
+        }
+        if (gamma_pool.quit) {
+            break;
+        }
+        self.gen = gamma_pool.gen;
+        job = gamma_pool.job;
+        mtx_unlock(&gamma_pool.lock);
+        if (self.id < job->workers) {
+            gamma_job_work(job, self.id);
+        }
+        mtx_lock(&gamma_pool.lock);
+        if (--gamma_pool.busy == 0) {
+            cnd_signal(&gamma_pool.done);
+        }
+    }
+    mtx_unlock(&gamma_pool.lock);
+    return 0;
+}
+
+
+/** @brief Initialize the synchronization objects of the pool */
+static void gamma_pool_reset(void)
+{
+    mtx_init(&gamma_pool.run, mtx_plain);
+    mtx_init(&gamma_pool.lock, mtx_plain);
+    cnd_init(&gamma_pool.wake);
+    cnd_init(&gamma_pool.done);
+    gamma_pool.thrds = NULL;
+    gamma_pool.size = 0;
+    gamma_pool.busy = 0;
+    gamma_pool.gen = 0;
+    gamma_pool.job = NULL;
+    gamma_pool.quit = false;
+}
+
+
+#if defined(GAMMA_POOL_POSIX)
+
+/** @brief Forget the threads of the parent in a forked child, where they do
+ *      not exist, so that the child starts its own
+ */
+static void gamma_pool_atfork(void)
+{
+    gamma_pool_reset();
+}
+
+#endif
+
+
+/** @brief Initialize the pool once */
+static void gamma_pool_init(void)
+{
+    gamma_pool_reset();
+#if defined(GAMMA_POOL_POSIX)
+    pthread_atfork(NULL, NULL, gamma_pool_atfork);
+#endif
+}
+
+
+/** @brief Start pool threads, with the run mutex held
+ *  @param size
+ *      Desired pool thread count
+ *  @returns The pool thread count, which may be short of @p size if threads
+ *      could not be started
+ */
+static int gamma_pool_grow(int size)
+{
+    struct gamma_worker *arg;
+    thrd_t *thrds;
+
+    if (size <= gamma_pool.size) {
+        return gamma_pool.size;
+    }
+    thrds = realloc(gamma_pool.thrds, sizeof *thrds * size);
+    if (!thrds) {
+        return gamma_pool.size;
+    }
+    gamma_pool.thrds = thrds;
+    while (gamma_pool.size < size) {
+        arg = malloc(sizeof *arg);
+        if (!arg) {
+            break;
+        }
+        arg->id = gamma_pool.size + 1;
+        arg->gen = gamma_pool.gen;
+        if (thrd_create(&thrds[gamma_pool.size], gamma_pool_worker, arg)
+            != thrd_success) {
+            free(arg);
+            break;
+        }
+        gamma_pool.size++;
+    }
+    return gamma_pool.size;
+}
+
+
+int gamma_pool_threads(long threads)
+{
+    long res = threads;
+
+    if (res <= 0) {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+
+        GetSystemInfo(&info);
+        res = (long)info.dwNumberOfProcessors;
+#elif defined(GAMMA_POOL_POSIX) && defined(_SC_NPROCESSORS_ONLN)
+        res = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+    return res < 1 ? 1 : res > INT_MAX ? INT_MAX : (int)res;
+}
+
+
+void gamma_pool_run(int                threads,
+                    size_t             count,
+                    gamma_pool_task_t *func,
+                    void              *data)
+{
+    struct gamma_job job = { .func = func, .data = data, .workers = 1 };
+    size_t i;
+    int w;
+
+    assert(count <= UINT32_MAX);
+    if (threads > 1 && count > 1) {
+        threads = (size_t)threads < count ? threads : (int)count;
+        call_once(&gamma_pool_once, gamma_pool_init);
+        mtx_lock(&gamma_pool.run);
+        job.workers = 1 + gamma_pool_grow(threads - 1);
+        job.workers = job.workers < threads ? job.workers : threads;
+        job.slots = gamma_aligned_alloc(alignof (struct gamma_slot),
+                                        sizeof *job.slots * job.workers);
+        if (job.slots && job.workers > 1) {
+            for (w = 0; w < job.workers; w++) {
+                atomic_init(&job.slots[w].range, gamma_slot_pack(
+                    count * w / job.workers, count * (w + 1) / job.workers));
+            }
+            mtx_lock(&gamma_pool.lock);
+            gamma_pool.job = &job;
+            gamma_pool.busy = gamma_pool.size;
+            gamma_pool.gen++;
+            cnd_broadcast(&gamma_pool.wake);
+            mtx_unlock(&gamma_pool.lock);
+
+            gamma_job_work(&job, 0);
+
+            mtx_lock(&gamma_pool.lock);
+            while (gamma_pool.busy) {
+                cnd_wait(&gamma_pool.done, &gamma_pool.lock);
+            }
+            gamma_pool.job = NULL;
+            mtx_unlock(&gamma_pool.lock);
+            count = 0;
+        }
+        gamma_aligned_free(job.slots);
+        mtx_unlock(&gamma_pool.run);
+    }
+    for (i = 0; i < count; i++) {
+        func(i, 0, data);
+    }
+}
+
+
+void gamma_pool_shutdown(void)
+{
+    int i;
+
+    call_once(&gamma_pool_once, gamma_pool_init);
+    mtx_lock(&gamma_pool.run);
+    mtx_lock(&gamma_pool.lock);
+    gamma_pool.quit = true;
+    cnd_broadcast(&gamma_pool.wake);
+    mtx_unlock(&gamma_pool.lock);
+    for (i = 0; i < gamma_pool.size; i++) {
+        thrd_join(gamma_pool.thrds[i], NULL);
+    }
+    free(gamma_pool.thrds);
+    gamma_pool.thrds = NULL;
+    gamma_pool.size = 0;
+    gamma_pool.quit = false;
+    mtx_unlock(&gamma_pool.run);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef GAMMA_POOL_H
+#define GAMMA_POOL_H
+
+#include <stddef.h>
+#include "common.h"
+
+EXTERN_C_BEGIN
+
+
+/** @brief Task callback
+ *  @param task
+ *      Index of the task within its job
+ *  @param worker
+ *      Index of the worker running the task, less than the thread count of the
+ *      job. Tasks on the same worker never run concurrently, so this may index
+ *      per-thread state
+ *  @param data
+ *      Your callback data
+ */
+typedef void gamma_pool_task_t(size_t task, int worker, void *data);
+
+
+/** @brief Resolve a requested thread count
+ *  @param threads
+ *      Requested thread count, or zero (or less) for one per processor
+ *  @returns The number of threads to run a job on, at least one
+ */
+int gamma_pool_threads(long threads);
+
+
+/** @brief Run a job on the persistent thread pool, which is started on first
+ *      use and grown as needed. Each worker begins with an even share of the
+ *      tasks and steals half of the remaining tasks of another worker when its
+ *      own run out, so tasks of very uneven cost still balance out
+ *  @param threads
+ *      Thread count including the calling thread, which works on the job too
+ *  @param count
+ *      Task count, at most `UINT32_MAX`
+ *  @param func
+ *      Task callback
+ *  @param data
+ *      Task callback data
+ *  @note This function does not fail: If threads cannot be started, then the
+ *      tasks are run on fewer of them, down to the calling thread alone. Jobs
+ *      from different threads are run one after another, so a task must not
+ *      run a job of its own
+ */
+void gamma_pool_run(int                threads,
+                    size_t             count,
+                    gamma_pool_task_t *func,
+                    void              *data);
+
+
+/** @brief Join and release the threads of the pool. A later job starts them
+ *      again
+ */
+void gamma_pool_shutdown(void);
+
+
+EXTERN_C_END
+
+#endif /* GAMMA_POOL_H */
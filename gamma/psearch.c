@@ -1,74 +1,245 @@
+#include <assert.h>
 #include <stdbool.h>
 #include <tgmath.h>
+#include "counters.h"
 #include "psearch.h"
 
 
-/** @brief Invoke the callback
- *  @param func
- *      Function information
- *  @param pos
- *      Coordinates
- *  @returns The result yielded from the optimizer callback
+/** @brief The outcome of one stencil of a search. The stencil is indexed so
+ *      that point 2i is the center plus the i-th scaled basis vector, and point
+ *      2i + 1 is the center minus it
+ */
+struct gamma_pshist {
+    double center;                          /* Value at the stencil center */
+    double caux;                            /* By-product at the center */
+    double vals[2 * GAMMA_PSRCH_MAXDIMS];   /* Values at the stencil points */
+    double auxs[2 * GAMMA_PSRCH_MAXDIMS];   /* By-products likewise */
+    int    move;                            /* Point moved to, or -1 if the
+                                               stencil shrank instead */
+};
+
+
+/** @brief The state of a search in progress */
+struct gamma_psstate {
+    const struct gamma_psfunc *func;    /* Optimizer function */
+    struct gamma_pspair        center;  /* Current stencil center */
+    gamma_scal_t               res;     /* Stencil resolution */
+    int                        depth;   /* Stencils completed so far */
+    struct gamma_pshist        hist[3]; /* Ring of the current stencil and the
+                                           last two */
+};
+
+
+/** @brief Recall the values already known for points of the current stencil.
+ *      Every point that the stencil may revisit lies on the lattice of earlier
+ *      stencils, and the function is pure, so the last two stencils are
+ *      enough to recognize the common cases without any lookup:
+ *       - After a move, the point opposite the move is the previous center
+ *       - After two moves along different bases, the point opposite the first
+ *         move was the second move's point of the stencil before last
+ *       - After a shrink and a move, the point beyond the move was the same
+ *         point of the coarser stencil
+ *  @param state
+ *      Search state
+ *  @param[out] hist
+ *      Receives the known values of the current stencil
+ *  @param[out] known
+ *      Receives the (at most two) stencil points whose values are known, or -1
  */
-static struct gamma_pspair
-gamma_pattern_invoke(const struct gamma_psfunc *func, const gamma_vec_t *pos)
+static void gamma_pattern_recall(const struct gamma_psstate *state,
+                                 struct gamma_pshist        *hist,
+                                 int                         known[2])
 {
-    return (struct gamma_pspair){
-        .vec = *pos,
-        .val = func->func(pos, func->data)
-    };
+    const struct gamma_pshist *last = &state->hist[(state->depth + 2) % 3];
+    const struct gamma_pshist *prev = &state->hist[(state->depth + 1) % 3];
+
+    known[0] = known[1] = -1;
+    if (state->depth < 1 || last->move < 0) {
+        return;
+    }
+    known[0] = last->move ^ 1;
+    hist->vals[known[0]] = last->center;
+    hist->auxs[known[0]] = last->caux;
+    if (state->depth < 2) {
+        return;
+    } else if (prev->move < 0) {
+        known[1] = last->move;
+    } else if (prev->move / 2 != last->move / 2) {
+        known[1] = prev->move ^ 1;
+    } else {
+        return;
+    }
+    hist->vals[known[1]] = prev->vals[last->move];
+    hist->auxs[known[1]] = prev->auxs[last->move];
 }
 
 
-/** @brief Test a point against the current stencil candidate
- *  @param func
- *      Optimizer function
+/** @brief Find the coordinates of a stencil point
+ *  @param state
+ *      Search state
+ *  @param probe
+ *      Stencil point
+ *  @returns The coordinates of @p probe
+ */
+static gamma_vec_t gamma_pattern_point(const struct gamma_psstate *state,
+                                       int                         probe)
+{
+    const gamma_vec_t *basis = &state->func->bases[probe / 2];
+
+    return probe % 2
+        ? gamma_vec_fmsubs(basis, state->res, &state->center.vec)
+        : gamma_vec_fmadds(basis, state->res, &state->center.vec);
+}
+
+
+/** @brief Test a stencil point against the current candidate
  *  @param cand
- *      Candidate point
+ *      The current candidate
  *  @param pos
- *      Test coordinates
- *  @returns true if a new minimum was found, false if not
+ *      Coordinates of the point
+ *  @param val
+ *      Value at the point
+ *  @param aux
+ *      By-product at the point
+ *  @returns true if the point is the new candidate
  */
-static bool gamma_pattern_test(const struct gamma_psfunc *func,
-                               struct gamma_pspair       *cand,
-                               const gamma_vec_t         *pos)
+static bool gamma_pattern_test(struct gamma_pspair *cand,
+                               const gamma_vec_t   *pos,
+                               double               val,
+                               double               aux)
 {
-    struct gamma_pspair test;
     bool res;
 
-    test = gamma_pattern_invoke(func, pos);
-    res = test.val < cand->val;
+    res = val < cand->val;
     if (res) {
-        *cand = test;
+        cand->vec = *pos;
+        cand->val = val;
+        cand->aux = aux;
     }
     return res;
 }
 
 
+/** @brief Test the whole stencil one point at a time
+ *  @param state
+ *      Search state
+ *  @param[in, out] cand
+ *      The current candidate, which must initially be the center
+ *  @param[in, out] hist
+ *      Holds the recalled stencil values and receives the rest and, if a new
+ *      minimum was found, the point of the new candidate
+ *  @param known
+ *      The recalled stencil points
+ */
+static void gamma_pattern_scan(const struct gamma_psstate *state,
+                               struct gamma_pspair        *cand,
+                               struct gamma_pshist        *hist,
+                               const int                   known[2])
+{
+    const struct gamma_psfunc *func = state->func;
+    gamma_vec_t test;
+    int i;
+
+    for (i = 0; i < 2 * func->dims && !(cand->val < func->accept); i++) {
+        test = gamma_pattern_point(state, i);
+        if (i != known[0] && i != known[1]) {
+            hist->vals[i] = func->func(&test, &hist->auxs[i], func->data);
+        }
+        if (gamma_pattern_test(cand, &test, hist->vals[i], hist->auxs[i])) {
+            hist->move = i;
+        }
+    }
+}
+
+
+/** @brief Evaluate every stencil point not already known with the batch
+ *      callback, then test each point in the same order as `gamma_pattern_scan`
+ *  @param state
+ *      Search state
+ *  @param[in, out] cand
+ *      The current candidate, which must initially be the center
+ *  @param[in, out] hist
+ *      Holds the recalled stencil values and receives the rest and, if a new
+ *      minimum was found, the point of the new candidate
+ *  @param known
+ *      The recalled stencil points
+ */
+static void gamma_pattern_batch(const struct gamma_psstate *state,
+                                struct gamma_pspair        *cand,
+                                struct gamma_pshist        *hist,
+                                const int                   known[2])
+{
+    const struct gamma_psfunc *func = state->func;
+    gamma_vec_t stencil[2 * GAMMA_PSRCH_MAXDIMS];
+    gamma_vec_t eval[2 * GAMMA_PSRCH_MAXDIMS];
+    double vals[2 * GAMMA_PSRCH_MAXDIMS];
+    double auxs[2 * GAMMA_PSRCH_MAXDIMS];
+    int miss[2 * GAMMA_PSRCH_MAXDIMS];
+    int i, n = 0;
+
+    for (i = 0; i < 2 * func->dims; i++) {
+        stencil[i] = gamma_pattern_point(state, i);
+        if (i != known[0] && i != known[1]) {
+            miss[n] = i;
+            eval[n++] = stencil[i];
+        }
+    }
+    if (n) {
+        func->batch(n, eval, vals, auxs, func->data);
+        for (i = 0; i < n; i++) {
+            hist->vals[miss[i]] = vals[i];
+            hist->auxs[miss[i]] = auxs[i];
+        }
+    }
+    for (i = 0; i < 2 * func->dims && !(cand->val < func->accept); i++) {
+        if (gamma_pattern_test(cand, &stencil[i], hist->vals[i],
+                               hist->auxs[i])) {
+            hist->move = i;
+        }
+    }
+}
+
+
 void gamma_pattern_search(const struct gamma_psfunc *func,
                           struct gamma_pspair       *init,
                           gamma_scal_t               res,
                           int                        shrinks)
 {
+    struct gamma_psstate state;
+    struct gamma_pshist *hist;
     struct gamma_pspair cand;
-    gamma_vec_t test;
-    bool found;
-    int i;
+    int known[2];
+
+    assert(func->dims <= GAMMA_PSRCH_MAXDIMS);
+    state.func = func;
+    state.center = *init;
+    state.res = res;
+    state.depth = 0;
 
     do {
-        cand = *init;
-        found = false;
-        for (i = 0; i < func->dims; i++) {
-            test = gamma_vec_fmadds(&func->bases[i], res, &init->vec);
-            found = gamma_pattern_test(func, &cand, &test) || found;
-            test = gamma_vec_fmsubs(&func->bases[i], res, &init->vec);
-            found = gamma_pattern_test(func, &cand, &test) || found;
+        cand = state.center;
+        hist = &state.hist[state.depth % 3];
+        hist->center = cand.val;
+        hist->caux = cand.aux;
+        hist->move = -1;
+        gamma_pattern_recall(&state, hist, known);
+        if (func->batch) {
+            gamma_pattern_batch(&state, &cand, hist, known);
+        } else {
+            gamma_pattern_scan(&state, &cand, hist, known);
         }
-        if (found) {
-            *init = cand;
+        GAMMA_COUNT(iters, 1);
+        if (cand.val < func->accept) {
+            state.center = cand;
+            break;
+        } else if (hist->move >= 0) {
+            state.center = cand;
         } else {
-            res /= 2.0;
+            state.res /= 2.0;
             shrinks--;
+            GAMMA_COUNT(shrinks, 1);
         }
+        state.depth++;
     } while (shrinks >= 0);
+    *init = state.center;
 }
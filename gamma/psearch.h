@@ -3,12 +3,16 @@
 #ifndef GAMMA_PSEARCH_H
 #define GAMMA_PSEARCH_H
 
+#include <stddef.h>
 #include "vec.h"
 
 
 /** @brief Function to be minimized
  *  @param pos
  *      Input coordinates, as a coordinate 4-vector
+ *  @param[out] aux
+ *      Receives any by-product of the value that the caller wants back with
+ *      the minimum, such as an intermediate result, or may be left alone
  *  @param data
  *      Callback data
  *  @return The value at @p pos
@@ -16,15 +20,46 @@
  *      calls with identical coordinates will yield the same results. Failing to
  *      abide this invalidates the result
  */
-typedef double gamma_psrch_func_t(const gamma_vec_t *pos, void *data);
+typedef double gamma_psrch_func_t(const gamma_vec_t *pos,
+                                  double            *aux,
+                                  void              *data);
+
+
+/** @brief Function to be minimized, evaluated at many points at once
+ *  @param len
+ *      Point count
+ *  @param pos
+ *      Input coordinates
+ *  @param[out] res
+ *      Receives the @p len values of the function
+ *  @param[out] aux
+ *      Receives the @p len by-products, as for `gamma_psrch_func_t`
+ *  @param data
+ *      Callback data
+ *  @note The same purity requirements apply as for `gamma_psrch_func_t`. The
+ *      values are compared in the same order as the scalar callback's, so the
+ *      search takes the same path as long as both callbacks agree
+ */
+typedef void gamma_psrch_batch_t(size_t             len,
+                                 const gamma_vec_t *pos,
+                                 double            *res,
+                                 double            *aux,
+                                 void              *data);
+
+
+/** @brief The most basis vectors that a pattern search may stencil */
+#define GAMMA_PSRCH_MAXDIMS 4
 
 
 /** @brief Pattern search data */
 struct gamma_psfunc {
-    gamma_psrch_func_t *func;   /* Function to be minimized */
-    void               *data;   /* Function data */
-    int                 dims;   /* Dimensions (the amount of basis vectors) */
-    const gamma_vec_t  *bases;  /* Basis vectors to be stenciled */
+    gamma_psrch_func_t  *func;  /* Function to be minimized */
+    gamma_psrch_batch_t *batch; /* Evaluates a whole stencil, if nonnull */
+    void                *data;  /* Function data */
+    int                  dims;  /* Dimensions (the amount of basis vectors) */
+    const gamma_vec_t   *bases; /* Basis vectors to be stenciled */
+    double               accept;    /* Stop upon any value below this (or
+                                       never if this is -HUGE_VAL) */
 };
 
 
@@ -32,6 +67,7 @@ struct gamma_psfunc {
 struct gamma_pspair {
     gamma_vec_t vec;    /* Coordinates */
     double      val;    /* Function value */
+    double      aux;    /* By-product of the function value, if any */
 };
 
 
@@ -39,14 +75,17 @@ struct gamma_pspair {
  *  @param func
  *      Function to be minimized
  *  @param[in, out] init
- *      Initial value i.e. the initial coordinates and value of @p func and
- *      where the results are written
+ *      Initial value i.e. the initial coordinates, value and by-product of
+ *      @p func and where the results are written
  *  @param res
  *      Initial stencil resolution
  *  @param shrinks
  *      The maximum number of times the stencil may shrink before the result is
  *      accepted. This parameter may safely be negative. Runtime is at least
  *      linearly dependent on this parameter
+ *  @note The stencil remembers the values at its previous points, so most
+ *      points that it revisits (such as the previous center) are not evaluated
+ *      again
  */
 void gamma_pattern_search(const struct gamma_psfunc *func,
                           struct gamma_pspair       *init,
@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <tgmath.h>
+#include "pyramid.h"
+
+
+/** @brief Round a lower bound down to single precision */
+static float gamma_pyramid_down(double x)
+{
+    float res = (float)x;
+
+    return (double)res > x ? nextafterf(res, -HUGE_VALF) : res;
+}
+
+
+/** @brief Round an upper bound up to single precision */
+static float gamma_pyramid_up(double x)
+{
+    float res = (float)x;
+
+    return (double)res < x ? nextafterf(res, HUGE_VALF) : res;
+}
+
+
+/** @brief Check if a block of level one reaches beyond the lattice along an
+ *      axis, where the values are zero. It spans lattice points `2 * blk - 1`
+ *      through `2 * blk + 1`
+ *  @param blk
+ *      Block index
+ *  @param dim
+ *      Lattice points along the axis
+ *  @returns true if the block reaches beyond the lattice
+ */
+static bool gamma_pyramid_edge(gamma_iscal_t blk, gamma_iscal_t dim)
+{
+    return 2 * blk - 1 < 0 || 2 * blk + 1 >= dim;
+}
+
+
+/** @brief Widen bounds to take in others
+ *  @param len
+ *      Bound count
+ *  @param[in, out] lo
+ *      Lower bounds to widen
+ *  @param[in, out] hi
+ *      Upper bounds to widen
+ *  @param olo
+ *      Lower bounds to take in
+ *  @param ohi
+ *      Upper bounds to take in
+ */
+static void gamma_pyramid_merge(size_t        len,
+                                double       *lo,
+                                double       *hi,
+                                const double *olo,
+                                const double *ohi)
+{
+    size_t n;
+
+    for (n = 0; n < len; n++) {
+        lo[n] = olo[n] < lo[n] ? olo[n] : lo[n];
+        hi[n] = ohi[n] > hi[n] ? ohi[n] : hi[n];
+    }
+}
+
+
+/** @brief Reduce one row of a distribution to the bounds of the blocks of
+ *      level one along its first axis, reading each value once
+ *  @param dist
+ *      Distribution
+ *  @param nx
+ *      Blocks of level one along the first axis
+ *  @param j
+ *      Row
+ *  @param k
+ *      Plane
+ *  @param[out] lo
+ *      Receives the lower bounds of the row
+ *  @param[out] hi
+ *      Receives the upper bounds of the row
+ */
+static void gamma_pyramid_row(const struct gamma_distribution *dist,
+                              gamma_iscal_t                    nx,
+                              gamma_iscal_t                    j,
+                              gamma_iscal_t                    k,
+                              double                          *lo,
+                              double                          *hi)
+{
+    const ptrdiff_t offs = gamma_distribution_offset(dist, 0, j, k);
+    gamma_iscal_t i, bx;
+    double val;
+    bool zero;
+
+    for (bx = 0; bx < nx; bx++) {
+        zero = gamma_pyramid_edge(bx, dist->dims.idx[0]);
+        lo[bx] = zero ? 0.0 : HUGE_VAL;
+        hi[bx] = zero ? 0.0 : -HUGE_VAL;
+    }
+    for (i = 0; i < dist->dims.idx[0]; i++) {
+        val = gamma_distribution_value(dist, offs + i * dist->strides[0]);
+        /* Odd points are shared with the block before */
+        bx = (i + 1) / 2;
+        lo[bx] = val < lo[bx] ? val : lo[bx];
+        hi[bx] = val > hi[bx] ? val : hi[bx];
+        if (i & 1) {
+            lo[bx - 1] = val < lo[bx - 1] ? val : lo[bx - 1];
+            hi[bx - 1] = val > hi[bx - 1] ? val : hi[bx - 1];
+        }
+    }
+}
+
+
+/** @brief Reduce one plane of a distribution to the bounds of the blocks of
+ *      level one along its first two axes
+ *  @param dist
+ *      Distribution
+ *  @param dims
+ *      Blocks of level one along each axis
+ *  @param k
+ *      Plane
+ *  @param row
+ *      Scratch space for the first axis, four per block
+ *  @param[out] lo
+ *      Receives the lower bounds of the plane
+ *  @param[out] hi
+ *      Receives the upper bounds of the plane
+ */
+static void gamma_pyramid_plane(const struct gamma_distribution *dist,
+                                const gamma_idx_t               *dims,
+                                gamma_iscal_t                    k,
+                                double                          *row,
+                                double                          *lo,
+                                double                          *hi)
+{
+    const size_t nx = (size_t)dims->idx[0];
+    double *cur = row, *prev = row + 2 * nx, *swap;
+    gamma_iscal_t j, by, last;
+    double *blo, *bhi;
+    size_t n;
+    bool zero;
+
+    for (by = 0; by < dims->idx[1]; by++) {
+        zero = gamma_pyramid_edge(by, dist->dims.idx[1]);
+        blo = lo + nx * by;
+        bhi = hi + nx * by;
+        for (n = 0; n < nx; n++) {
+            blo[n] = zero ? 0.0 : HUGE_VAL;
+            bhi[n] = zero ? 0.0 : -HUGE_VAL;
+        }
+        if (by) {
+            /* Row 2 * by - 1 was reduced as the last of the block before */
+            gamma_pyramid_merge(nx, blo, bhi, prev, prev + nx);
+        }
+        last = 2 * by + 1 < dist->dims.idx[1] ? 2 * by + 1
+                                              : dist->dims.idx[1] - 1;
+        for (j = 2 * by; j <= last; j++) {
+            gamma_pyramid_row(dist, dims->idx[0], j, k, cur, cur + nx);
+            gamma_pyramid_merge(nx, blo, bhi, cur, cur + nx);
+            if (j == 2 * by + 1) {
+                swap = cur;
+                cur = prev;
+                prev = swap;
+            }
+        }
+    }
+}
+
+
+/** @brief Fill level one of a pyramid from its distribution. Each value is
+ *      read once, and the rows and planes shared by two blocks are reduced
+ *      once and kept for the second
+ *  @param pyr
+ *      Pyramid, whose levels are allocated
+ *  @param dist
+ *      Distribution
+ *  @returns true on success, false on allocation failure
+ */
+static bool gamma_pyramid_base(struct gamma_pyramid            *pyr,
+                               const struct gamma_distribution *dist)
+{
+    const gamma_idx_t *dims = &pyr->dims[1];
+    const size_t plane = (size_t)dims->idx[0] * dims->idx[1];
+    gamma_iscal_t bz, k, last;
+    double *buf, *lo, *hi, *cur, *prev, *swap, *row;
+    size_t n;
+    bool zero;
+
+    buf = malloc(sizeof *buf * (6 * plane + 4 * (size_t)dims->idx[0]));
+    if (!buf) {
+        return false;
+    }
+    lo = buf;
+    hi = lo + plane;
+    cur = hi + plane;
+    prev = cur + 2 * plane;
+    row = prev + 2 * plane;
+    for (bz = 0; bz < dims->idx[2]; bz++) {
+        zero = gamma_pyramid_edge(bz, dist->dims.idx[2]);
+        for (n = 0; n < plane; n++) {
+            lo[n] = zero ? 0.0 : HUGE_VAL;
+            hi[n] = zero ? 0.0 : -HUGE_VAL;
+        }
+        if (bz) {
+            /* Likewise plane 2 * bz - 1 */
+            gamma_pyramid_merge(plane, lo, hi, prev, prev + plane);
+        }
+        last = 2 * bz + 1 < dist->dims.idx[2] ? 2 * bz + 1
+                                              : dist->dims.idx[2] - 1;
+        for (k = 2 * bz; k <= last; k++) {
+            gamma_pyramid_plane(dist, dims, k, row, cur, cur + plane);
+            gamma_pyramid_merge(plane, lo, hi, cur, cur + plane);
+            if (k == 2 * bz + 1) {
+                swap = cur;
+                cur = prev;
+                prev = swap;
+            }
+        }
+        for (n = 0; n < plane; n++) {
+            pyr->lo[1][bz * plane + n] = gamma_pyramid_down(lo[n]);
+            pyr->hi[1][bz * plane + n] = gamma_pyramid_up(hi[n]);
+        }
+    }
+    free(buf);
+    return true;
+}
+
+
+/** @brief Fill a level of a pyramid from the level below it
+ *  @param pyr
+ *      Pyramid
+ *  @param level
+ *      Level, at least two
+ */
+static void gamma_pyramid_fold(struct gamma_pyramid *pyr, int level)
+{
+    const gamma_idx_t *dims = &pyr->dims[level], *below = &pyr->dims[level - 1];
+    gamma_idx_t blk, child;
+    size_t idx = 0;
+    double lo, hi, clo, chi;
+    int c;
+
+    for (blk.idx[2] = 0; blk.idx[2] < dims->idx[2]; blk.idx[2]++) {
+        for (blk.idx[1] = 0; blk.idx[1] < dims->idx[1]; blk.idx[1]++) {
+            for (blk.idx[0] = 0; blk.idx[0] < dims->idx[0]; blk.idx[0]++) {
+                lo = HUGE_VAL;
+                hi = -HUGE_VAL;
+                for (c = 0; c < 8; c++) {
+                    child = (const gamma_idx_t){{
+                        2 * blk.idx[0] + (c & 1),
+                        2 * blk.idx[1] + (c >> 1 & 1),
+                        2 * blk.idx[2] + (c >> 2),
+                        0
+                    }};
+                    if (child.idx[0] < below->idx[0]
+                     && child.idx[1] < below->idx[1]
+                     && child.idx[2] < below->idx[2]) {
+                        gamma_pyramid_at(pyr, level - 1, &child, &clo, &chi);
+                        lo = fmin(lo, clo);
+                        hi = fmax(hi, chi);
+                    }
+                }
+                pyr->lo[level][idx] = (float)lo;
+                pyr->hi[level][idx] = (float)hi;
+                idx++;
+            }
+        }
+    }
+}
+
+
+bool gamma_pyramid_init(struct gamma_pyramid            *pyr,
+                        const struct gamma_distribution *dist)
+{
+    size_t len[GAMMA_PYRAMID_LEVELS], total = 0;
+    gamma_idx_t *dims;
+    int l, axis;
+    bool top;
+
+    pyr->levels = 0;
+    pyr->buf = NULL;
+    /* Level zero also has the cells reaching a point beyond either end */
+    pyr->dims[0] = (const gamma_idx_t){{
+        dist->dims.idx[0] + 1, dist->dims.idx[1] + 1, dist->dims.idx[2] + 1, 0
+    }};
+    pyr->lo[0] = pyr->hi[0] = NULL;
+    for (l = 1, top = false; !top; l++) {
+        dims = &pyr->dims[l];
+        top = true;
+        for (axis = 0; axis < 3; axis++) {
+            dims->idx[axis] = (pyr->dims[l - 1].idx[axis] + 1) / 2;
+            top = top && dims->idx[axis] == 1;
+        }
+        dims->idx[3] = 0;
+        len[l] = (size_t)dims->idx[0] * dims->idx[1] * dims->idx[2];
+        total += len[l];
+    }
+
+    pyr->buf = malloc(sizeof *pyr->buf * 2 * total);
+    if (!pyr->buf) {
+        return false;
+    }
+    pyr->levels = l;
+    for (l = 1, total = 0; l < pyr->levels; l++) {
+        pyr->lo[l] = pyr->buf + total;
+        pyr->hi[l] = pyr->lo[l] + len[l];
+        total += 2 * len[l];
+    }
+    if (!gamma_pyramid_base(pyr, dist)) {
+        gamma_pyramid_destroy(pyr);
+        return false;
+    }
+    for (l = 2; l < pyr->levels; l++) {
+        gamma_pyramid_fold(pyr, l);
+    }
+    return true;
+}
+
+
+void gamma_pyramid_destroy(struct gamma_pyramid *pyr)
+{
+    free(pyr->buf);
+    pyr->buf = NULL;
+    pyr->levels = 0;
+}
+
+
+void gamma_pyramid_bounds(const struct gamma_pyramid      *pyr,
+                          const struct gamma_distribution *dist,
+                          const gamma_vec_t               *pos,
+                          gamma_scal_t                     radius,
+                          double                          *lo,
+                          double                          *hi)
+{
+    const gamma_mat_t *inv = &dist->inverse;
+    gamma_iscal_t first[3], last[3];
+    gamma_idx_t blk;
+    double ext, a, b, blo, bhi;
+    gamma_vec_t ctr, row;
+    bool outside = false;
+    int axis, level, c;
+
+    ctr = gamma_matmul_mv(inv, pos);
+    for (axis = 0; axis < 3; axis++) {
+        row = (const gamma_vec_t){{
+            inv->cols[0].vec[axis], inv->cols[1].vec[axis],
+            inv->cols[2].vec[axis], 0
+        }};
+        ext = radius * sqrt(gamma_vec_dp(&row, &row));
+        /* The cells overlapping the ball, as indices into level zero */
+        a = floor(ctr.vec[axis] - ext) + 1.0;
+        b = floor(ctr.vec[axis] + ext) + 1.0;
+        outside |= a < 0.0 || b >= pyr->dims[0].idx[axis];
+        a = fmin(fmax(a, 0.0), pyr->dims[0].idx[axis] - 1.0);
+        b = fmin(fmax(b, 0.0), pyr->dims[0].idx[axis] - 1.0);
+        first[axis] = (gamma_iscal_t)a;
+        last[axis] = (gamma_iscal_t)b;
+    }
+
+    /* Climb until the cells span at most two blocks along each axis */
+    for (level = 1; level < pyr->levels - 1; level++) {
+        if ((last[0] >> level) - (first[0] >> level) <= 1
+         && (last[1] >> level) - (first[1] >> level) <= 1
+         && (last[2] >> level) - (first[2] >> level) <= 1) {
+            break;
+        }
+    }
+    *lo = outside ? 0.0 : HUGE_VAL;
+    *hi = outside ? 0.0 : -HUGE_VAL;
+    for (c = 0; c < 8; c++) {
+        blk = (const gamma_idx_t){{
+            ((c & 1) ? last[0] : first[0]) >> level,
+            ((c & 2) ? last[1] : first[1]) >> level,
+            ((c & 4) ? last[2] : first[2]) >> level,
+            0
+        }};
+        gamma_pyramid_at(pyr, level, &blk, &blo, &bhi);
+        *lo = fmin(*lo, blo);
+        *hi = fmax(*hi, bhi);
+    }
+}
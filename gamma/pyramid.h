@@ -0,0 +1,133 @@
+#pragma once
+
+/** @file Min/max pyramid over the lattice cells of a distribution. Block B of
+ *      level l spans cells B 2^l - 1 through (B + 1) 2^l - 2 along each axis,
+ *      where cell c is the cube between lattice points c and c + 1, so that
+ *      the cells reaching one point beyond the lattice (whose outer corners
+ *      are zero) are covered too. Level zero is the cells themselves, which
+ *      are not stored
+ */
+
+#ifndef GAMMA_PYRAMID_H
+#define GAMMA_PYRAMID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "common.h"
+#include "distribution.h"
+#include "idx.h"
+
+EXTERN_C_BEGIN
+
+
+/** @brief The most levels of a pyramid, enough for any 32-bit lattice */
+#define GAMMA_PYRAMID_LEVELS 33
+
+
+/** @brief A min/max pyramid */
+struct gamma_pyramid {
+    int          levels;                        /* Levels, including level
+                                                   zero, or zero if none */
+    gamma_idx_t  dims[GAMMA_PYRAMID_LEVELS];    /* Blocks along each axis of
+                                                   each level */
+    float       *lo[GAMMA_PYRAMID_LEVELS];      /* Lowest value of each block
+                                                   above level zero, first
+                                                   axis fastest */
+    float       *hi[GAMMA_PYRAMID_LEVELS];      /* Highest value likewise */
+    float       *buf;                           /* Storage of every level */
+};
+
+
+/** @brief Build the pyramid of a distribution
+ *  @param[out] pyr
+ *      Pyramid
+ *  @param dist
+ *      Distribution
+ *  @returns true on success, false on allocation failure
+ *  @note The bounds are stored in single precision, rounded outward, so that
+ *      they still bound every value interpolated within each block. The
+ *      pyramid takes about one byte per voxel of @p dist
+ */
+bool gamma_pyramid_init(struct gamma_pyramid            *pyr,
+                        const struct gamma_distribution *dist);
+
+
+/** @brief Release a pyramid
+ *  @param pyr
+ *      Pyramid, which may be zero-initialized
+ */
+void gamma_pyramid_destroy(struct gamma_pyramid *pyr);
+
+
+/** @brief Find the block of a level holding a cell
+ *  @param lat
+ *      Lattice index of the first corner of the cell
+ *  @param level
+ *      Level
+ *  @returns The block index, which may be out of range of the level
+ */
+GAMMA_INLINE gamma_idx_t gamma_pyramid_block(const gamma_idx_t *lat, int level)
+{
+    return (const gamma_idx_t){{
+        (lat->idx[0] + 1) >> level,
+        (lat->idx[1] + 1) >> level,
+        (lat->idx[2] + 1) >> level,
+        0
+    }};
+}
+
+
+/** @brief Read the bounds of a block
+ *  @param pyr
+ *      Pyramid
+ *  @param level
+ *      Level, at least one
+ *  @param blk
+ *      Block index, in range of @p level
+ *  @param[out] lo
+ *      Receives the lowest value interpolated within the block
+ *  @param[out] hi
+ *      Receives the highest value interpolated within the block
+ */
+GAMMA_INLINE void gamma_pyramid_at(const struct gamma_pyramid *pyr,
+                                   int                         level,
+                                   const gamma_idx_t          *blk,
+                                   double                     *lo,
+                                   double                     *hi)
+{
+    const gamma_idx_t *dims = &pyr->dims[level];
+    const size_t idx = (size_t)blk->idx[0]
+                     + (size_t)dims->idx[0] * ((size_t)blk->idx[1]
+                     + (size_t)dims->idx[1] * (size_t)blk->idx[2]);
+
+    *lo = pyr->lo[level][idx];
+    *hi = pyr->hi[level][idx];
+}
+
+
+/** @brief Bound the interpolated values within a ball from at most eight
+ *      blocks, as a faster and looser `gamma_distribution_bounds`
+ *  @param pyr
+ *      Pyramid of @p dist
+ *  @param dist
+ *      Distribution
+ *  @param pos
+ *      Physical coordinates of the center of the ball
+ *  @param radius
+ *      Radius of the ball in physical units
+ *  @param[out] lo
+ *      Receives a lower bound on every value interpolated within the ball
+ *  @param[out] hi
+ *      Receives an upper bound on every value interpolated within the ball
+ */
+void gamma_pyramid_bounds(const struct gamma_pyramid      *pyr,
+                          const struct gamma_distribution *dist,
+                          const gamma_vec_t               *pos,
+                          gamma_scal_t                     radius,
+                          double                          *lo,
+                          double                          *hi);
+
+
+EXTERN_C_END
+
+#endif /* GAMMA_PYRAMID_H */
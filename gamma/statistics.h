@@ -37,6 +37,117 @@ GAMMA_INLINE struct gamma_statistics gamma_statistics_init(void)
 #endif
 
 
+/** @brief Running sums of a data set, compensated so that they remain accurate
+ *      for very many points. Accumulators are cheap to update, and partial
+ *      accumulators (e.g. one per thread) may be merged into a single result
+ */
+struct gamma_accumulator {
+    long   total;   /* Total points */
+    double min;     /* Minimum value */
+    double max;     /* Maximum value */
+    double sum;     /* Sum of values */
+    double sumc;    /* Compensation of the sum of values */
+    double sqr;     /* Sum of squares */
+    double sqrc;    /* Compensation of the sum of squares */
+};
+
+
+#if !defined(__cplusplus) || !__cplusplus
+#define gamma_accumulator_init() (struct gamma_accumulator){ \
+    .min = HUGE_VAL, \
+    .max = -HUGE_VAL, \
+}
+
+#else
+GAMMA_INLINE struct gamma_accumulator gamma_accumulator_init(void)
+{
+    struct gamma_accumulator res{ };
+
+    res.min = HUGE_VAL;
+    res.max = -HUGE_VAL;
+    return res;
+}
+
+#endif
+
+
+/** @brief Add a term to a compensated (Kahan-Babuska-Neumaier) sum
+ *  @param[in, out] sum
+ *      Running sum
+ *  @param[in, out] comp
+ *      Running compensation of @p sum
+ *  @param x
+ *      Term
+ */
+GAMMA_INLINE void gamma_kahan_add(double *sum, double *comp, double x)
+{
+    const double t = *sum + x;
+
+    if (fabs(*sum) >= fabs(x)) {
+        *comp += (*sum - t) + x;
+    } else {
+        *comp += (x - t) + *sum;
+    }
+    *sum = t;
+}
+
+
+/** @brief Add a new datapoint to an accumulator
+ *  @param acc
+ *      Accumulator
+ *  @param x
+ *      Data value
+ */
+GAMMA_INLINE void gamma_accumulator_add(struct gamma_accumulator *acc, double x)
+{
+    acc->total++;
+    acc->min = fmin(acc->min, x);
+    acc->max = fmax(acc->max, x);
+    gamma_kahan_add(&acc->sum, &acc->sumc, x);
+    gamma_kahan_add(&acc->sqr, &acc->sqrc, gamma_sqr(x));
+}
+
+
+/** @brief Merge two accumulators
+ *  @param[in, out] dst
+ *      Accumulator to receive the datapoints of @p src
+ *  @param src
+ *      Accumulator
+ */
+GAMMA_INLINE void gamma_accumulator_merge(struct gamma_accumulator       *dst,
+                                          const struct gamma_accumulator *src)
+{
+    dst->total += src->total;
+    dst->min = fmin(dst->min, src->min);
+    dst->max = fmax(dst->max, src->max);
+    gamma_kahan_add(&dst->sum, &dst->sumc, src->sum);
+    gamma_kahan_add(&dst->sum, &dst->sumc, src->sumc);
+    gamma_kahan_add(&dst->sqr, &dst->sqrc, src->sqr);
+    gamma_kahan_add(&dst->sqr, &dst->sqrc, src->sqrc);
+}
+
+
+/** @brief Compute the statistics of an accumulator
+ *  @param acc
+ *      Accumulator
+ *  @returns The statistics of every datapoint added to @p acc
+ */
+GAMMA_INLINE struct gamma_statistics
+gamma_accumulator_finish(const struct gamma_accumulator *acc)
+{
+    struct gamma_statistics res = gamma_statistics_init();
+
+    if (acc->total) {
+        res.total = acc->total;
+        res.min = acc->min;
+        res.max = acc->max;
+        res.mean = (acc->sum + acc->sumc) / (double)acc->total;
+        res.msqr = (acc->sqr + acc->sqrc) / (double)acc->total;
+    }
+    return res;
+}
+
+
 /** @brief Add a new datapoint
  *  @param stat
  *      Statistics
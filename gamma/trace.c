@@ -0,0 +1,222 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#   define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include "trace.h"
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <time.h>
+#   include <unistd.h>
+#endif
+
+
+/** @brief Events remembered by each thread outside of any trace */
+#define GAMMA_TRACE_NOTES 4
+
+
+/** @brief Events of the calling thread awaiting its next trace */
+static thread_local struct gamma_trace_notes {
+    struct gamma_trace_event events[GAMMA_TRACE_NOTES]; /* Ring of events */
+    size_t                   len;                       /* Events noted */
+} gamma_trace_notes;
+
+
+double gamma_trace_now(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+#endif
+}
+
+
+/** @brief Append an event to a buffer
+ *  @param buf
+ *      Buffer
+ *  @param event
+ *      Event
+ *  @returns true on success, false on allocation failure
+ */
+static bool gamma_trace_push(struct gamma_trace_buf         *buf,
+                             const struct gamma_trace_event *event)
+{
+    struct gamma_trace_event *events;
+    size_t cap;
+
+    if (buf->len == buf->cap) {
+        cap = buf->cap ? 2 * buf->cap : 64;
+        events = realloc(buf->events, sizeof *events * cap);
+        if (!events) {
+            return false;
+        }
+        buf->events = events;
+        buf->cap = cap;
+    }
+    buf->events[buf->len++] = *event;
+    return true;
+}
+
+
+bool gamma_trace_begin(struct gamma_trace *trace,
+                       const char         *path,
+                       int                 workers)
+{
+    struct gamma_trace_notes *notes = &gamma_trace_notes;
+    size_t i, first;
+    int w;
+
+    first = notes->len > GAMMA_TRACE_NOTES ? notes->len - GAMMA_TRACE_NOTES
+                                           : 0;
+    trace->path = path ? path : getenv(GAMMA_TRACE_ENV);
+    trace->bufs = NULL;
+    trace->workers = workers;
+    trace->dropped = false;
+    if (!trace->path || !*trace->path) {
+        notes->len = 0;
+        return true;
+    }
+    trace->bufs = gamma_aligned_alloc(alignof (struct gamma_trace_buf),
+                                      sizeof *trace->bufs * workers);
+    if (!trace->bufs) {
+        return false;
+    }
+    for (w = 0; w < workers; w++) {
+        trace->bufs[w] = (const struct gamma_trace_buf){ .events = NULL };
+    }
+    for (i = first; i < notes->len; i++) {
+        trace->dropped |= !gamma_trace_push(
+            &trace->bufs[0], &notes->events[i % GAMMA_TRACE_NOTES]);
+    }
+    notes->len = 0;
+    return true;
+}
+
+
+void gamma_trace_add(struct gamma_trace *trace,
+                     int                 worker,
+                     const char         *name,
+                     double              start,
+                     size_t              arg)
+{
+    struct gamma_trace_event event;
+
+    if (gamma_trace_active(trace)) {
+        event.name = name;
+        event.start = start;
+        event.end = gamma_trace_now();
+        event.arg = arg;
+        if (!gamma_trace_push(&trace->bufs[worker], &event)) {
+            trace->dropped = true;
+        }
+    }
+}
+
+
+void gamma_trace_note(const char *name, double start, double end)
+{
+    struct gamma_trace_notes *notes = &gamma_trace_notes;
+
+    notes->events[notes->len++ % GAMMA_TRACE_NOTES]
+        = (const struct gamma_trace_event){
+            .name = name, .start = start, .end = end, .arg = SIZE_MAX
+        };
+}
+
+
+/** @brief Get an identifier of the process, which keeps apart the events of
+ *      different processes appending to the same file
+ */
+static unsigned long gamma_trace_pid(void)
+{
+#if defined(_WIN32)
+    return (unsigned long)GetCurrentProcessId();
+#else
+    return (unsigned long)getpid();
+#endif
+}
+
+
+/** @brief Write out the events of one worker
+ *  @param file
+ *      Trace file
+ *  @param buf
+ *      Events
+ *  @param pid
+ *      Process identifier
+ *  @param worker
+ *      Worker index
+ */
+static void gamma_trace_write(FILE                         *file,
+                              const struct gamma_trace_buf *buf,
+                              unsigned long                 pid,
+                              int                           worker)
+{
+    const struct gamma_trace_event *event;
+    size_t i;
+
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %lu, "
+                  "\"tid\": %d, \"args\": {\"name\": \"worker %d\"}},\n",
+            pid, worker, worker);
+    for (i = 0; i < buf->len; i++) {
+        event = &buf->events[i];
+        fprintf(file, "{\"name\": \"%s\", \"cat\": \"gamma\", \"ph\": \"X\", "
+                      "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %lu, \"tid\": %d",
+                event->name, 1e6 * event->start,
+                1e6 * (event->end - event->start), pid, worker);
+        if (event->arg != SIZE_MAX) {
+            fprintf(file, ", \"args\": {\"task\": %zu}", event->arg);
+        }
+        fprintf(file, "},\n");
+    }
+}
+
+
+bool gamma_trace_end(struct gamma_trace *trace)
+{
+    const unsigned long pid = gamma_trace_pid();
+    FILE *file;
+    bool res;
+    int w;
+
+    if (!gamma_trace_active(trace)) {
+        return true;
+    }
+    file = fopen(trace->path, "a");
+    res = file != NULL;
+    if (file) {
+        if (!fseek(file, 0, SEEK_END) && ftell(file) == 0) {
+            fprintf(file, "[\n");
+        }
+        for (w = 0; w < trace->workers; w++) {
+            gamma_trace_write(file, &trace->bufs[w], pid, w);
+        }
+        if (trace->dropped) {
+            fprintf(file, "{\"name\": \"events dropped\", \"ph\": \"i\", "
+                          "\"s\": \"p\", \"ts\": %.3f, \"pid\": %lu, "
+                          "\"tid\": 0},\n",
+                    1e6 * gamma_trace_now(), pid);
+        }
+        res = !ferror(file);
+        res = !fclose(file) && res;
+    }
+    for (w = 0; w < trace->workers; w++) {
+        free(trace->bufs[w].events);
+    }
+    gamma_aligned_free(trace->bufs);
+    trace->bufs = NULL;
+    return res;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+/** @file Phase timing of gamma runs, written as Chrome trace events that
+ *      chrome://tracing or Perfetto can load. Each worker thread records its
+ *      own events, stamped by a monotonic clock, so threads never contend for
+ *      the trace
+ */
+
+#ifndef GAMMA_TRACE_H
+#define GAMMA_TRACE_H
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common.h"
+
+EXTERN_C_BEGIN
+
+
+/** @brief Environment variable naming the trace file, if the options do not */
+#define GAMMA_TRACE_ENV "GAMMA_TRACE"
+
+
+/** @brief A complete event, i.e. a timed span on one thread */
+struct gamma_trace_event {
+    const char *name;   /* Event name, which must be a static string */
+    double      start;  /* Start time in seconds */
+    double      end;    /* End time in seconds */
+    size_t      arg;    /* Task index, or SIZE_MAX if none */
+};
+
+
+/** @brief The events of one worker, padded out to a cache line */
+struct gamma_trace_buf {
+    alignas (64) struct gamma_trace_event *events;  /* Events */
+    size_t                                 len;     /* Event count */
+    size_t                                 cap;     /* Event capacity */
+};
+
+
+/** @brief A trace in progress */
+struct gamma_trace {
+    const char             *path;       /* Trace file */
+    struct gamma_trace_buf *bufs;       /* Events of each worker, or NULL if
+                                           not tracing */
+    int                     workers;    /* Worker count */
+    bool                    dropped;    /* Events were lost to allocation
+                                           failure */
+};
+
+
+/** @brief Read the monotonic clock
+ *  @returns Seconds since some fixed point in time, which never goes backwards
+ */
+double gamma_trace_now(void);
+
+
+/** @brief Start a trace if one is requested
+ *  @param[out] trace
+ *      Trace
+ *  @param path
+ *      Trace file, or NULL to use the file named by the environment variable
+ *      `GAMMA_TRACE`, if set
+ *  @param workers
+ *      Worker thread count
+ *  @returns false if a trace was requested but could not be allocated, else
+ *      true, even if no trace was requested
+ *  @note Events noted by the calling thread since it last started a trace,
+ *      such as the setup of the distributions, are moved into this trace
+ */
+bool gamma_trace_begin(struct gamma_trace *trace,
+                       const char         *path,
+                       int                 workers);
+
+
+/** @brief Check whether a trace is being recorded */
+GAMMA_INLINE bool gamma_trace_active(const struct gamma_trace *trace)
+{
+    return trace->bufs != NULL;
+}
+
+
+/** @brief Read the clock if a trace is being recorded
+ *  @param trace
+ *      Trace
+ *  @returns The time, or zero if not tracing, so that the clock costs nothing
+ *      when tracing is off
+ */
+GAMMA_INLINE double gamma_trace_start(const struct gamma_trace *trace)
+{
+    return gamma_trace_active(trace) ? gamma_trace_now() : 0.0;
+}
+
+
+/** @brief Record an event ending now, if a trace is being recorded
+ *  @param trace
+ *      Trace
+ *  @param worker
+ *      Index of the worker thread recording it
+ *  @param name
+ *      Static event name
+ *  @param start
+ *      Start time from `gamma_trace_start`
+ *  @param arg
+ *      Task index, or SIZE_MAX if none
+ */
+void gamma_trace_add(struct gamma_trace *trace,
+                     int                 worker,
+                     const char         *name,
+                     double              start,
+                     size_t              arg);
+
+
+/** @brief Remember an event of the calling thread outside of any trace, to be
+ *      moved into the next trace that the thread starts. Only the last few are
+ *      kept
+ *  @param name
+ *      Static event name
+ *  @param start
+ *      Start time from `gamma_trace_now`
+ *  @param end
+ *      End time from `gamma_trace_now`
+ */
+void gamma_trace_note(const char *name, double start, double end);
+
+
+/** @brief Append the events of a trace to its file and release it. The file is
+ *      in the JSON array format, whose closing bracket is optional, so that
+ *      successive runs may append to the same file
+ *  @param trace
+ *      Trace
+ *  @returns true on success or if not tracing, false if the file could not be
+ *      written
+ */
+bool gamma_trace_end(struct gamma_trace *trace);
+
+
+EXTERN_C_END
+
+#endif /* GAMMA_TRACE_H */
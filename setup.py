@@ -1,6 +1,7 @@
 from setuptools.command.build_ext import build_ext
 from setuptools import setup
 import numpy
+import os
 
 
 class BuildExt(build_ext):
@@ -9,6 +10,13 @@ class BuildExt(build_ext):
             for ext in self.extensions:
                 ext.extra_compile_args += ["/std:c11", "/O2"]
                 ext.include_dirs += [numpy.get_include()]
+        else:
+            for ext in self.extensions:
+                ext.extra_compile_args += ["-pthread"]
+                ext.extra_link_args += ["-pthread"]
+        if os.environ.get("GAMMA_COUNTERS"):
+            for ext in self.extensions:
+                ext.define_macros += [("GAMMA_COUNTERS", None)]
         build_ext.build_extensions(self)
 
 